@@ -0,0 +1,90 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "snappy-appendable.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "snappy-internal.h"
+#include "snappy.h"
+
+namespace snappy {
+
+constexpr size_t AppendableCompressedBuffer::kHeaderSize;
+
+AppendableCompressedBuffer::AppendableCompressedBuffer()
+    : wmem_(new internal::WorkingMemory(kBlockSize)), uncompressed_length_(0) {
+  Clear();
+}
+
+AppendableCompressedBuffer::~AppendableCompressedBuffer() { delete wmem_; }
+
+bool AppendableCompressedBuffer::Append(const char* data, size_t n) {
+  if (n > std::numeric_limits<uint32_t>::max() - uncompressed_length_) {
+    return false;
+  }
+  size_t compressed_length = compressed_.size();
+  while (n > 0) {
+    const size_t fragment_size = std::min(n, kBlockSize);
+    STLStringResizeUninitialized(
+        &compressed_, compressed_length + MaxCompressedLength(fragment_size));
+    char* const dst = string_as_array(&compressed_) + compressed_length;
+    int table_size;
+    uint16_t* table = wmem_->GetHashTable(fragment_size, &table_size);
+    char* const end =
+        internal::CompressFragment(data, fragment_size, dst, table, table_size);
+    compressed_length += end - dst;
+    uncompressed_length_ += static_cast<uint32_t>(fragment_size);
+    data += fragment_size;
+    n -= fragment_size;
+  }
+  compressed_.resize(compressed_length);
+  StoreHeader();
+  return true;
+}
+
+void AppendableCompressedBuffer::Clear() {
+  compressed_.assign(kHeaderSize, '\0');
+  uncompressed_length_ = 0;
+  StoreHeader();
+}
+
+void AppendableCompressedBuffer::StoreHeader() {
+  // A varint with the continuation bit set in all but the last byte, where
+  // the unused high-order groups are zero.
+  char* const header = string_as_array(&compressed_);
+  uint32_t v = uncompressed_length_;
+  for (size_t i = 0; i < kHeaderSize - 1; ++i) {
+    header[i] = static_cast<char>((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  header[kHeaderSize - 1] = static_cast<char>(v);
+}
+
+}  // namespace snappy
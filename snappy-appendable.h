@@ -0,0 +1,99 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A raw Snappy buffer that grows by compressing only the appended data.
+
+#ifndef THIRD_PARTY_SNAPPY_SNAPPY_APPENDABLE_H_
+#define THIRD_PARTY_SNAPPY_SNAPPY_APPENDABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace snappy {
+
+namespace internal {
+class WorkingMemory;
+}  // namespace internal
+
+// Holds data in the raw Snappy format (the format produced by Compress() and
+// read by Uncompress(), RawUncompress() etc.) and supports appending to it.
+//
+// The uncompressed length at the front of a Snappy buffer is a varint, so it
+// normally changes size as data is appended, forcing everything after it to
+// move. Here it is always stored in a padded 5-byte form, which decoders
+// accept, and is updated in place. Each Append() compresses just its own data
+// and adds the result at the end, so it costs O(n) in the appended size.
+//
+// Copies never reach back into the data of earlier Append() calls, so many
+// tiny appends compress worse than a single large one.
+//
+// Example:
+//    AppendableCompressedBuffer log;
+//    log.Append(record1, n1);
+//    log.Append(record2, n2);
+//    Uncompress(log.compressed().data(), log.compressed().size(), &out);
+class AppendableCompressedBuffer {
+ public:
+  // Size of the padded uncompressed length at the front of compressed().
+  static constexpr size_t kHeaderSize = 5;
+
+  AppendableCompressedBuffer();
+  ~AppendableCompressedBuffer();
+
+  // Compresses "data[0,n-1]" and appends it to the buffer.
+  //
+  // returns false, leaving the buffer unchanged, if the total uncompressed
+  // length would not fit in 32 bits
+  bool Append(const char* data, size_t n);
+
+  // Removes all data.
+  void Clear();
+
+  // The data in the raw Snappy format.
+  const std::string& compressed() const { return compressed_; }
+
+  // The total length of the appended data.
+  uint32_t uncompressed_length() const { return uncompressed_length_; }
+
+ private:
+  void StoreHeader();
+
+  internal::WorkingMemory* const wmem_;
+  std::string compressed_;
+  uint32_t uncompressed_length_;
+
+  // No copying
+  AppendableCompressedBuffer(const AppendableCompressedBuffer&);
+  void operator=(const AppendableCompressedBuffer&);
+};
+
+}  // namespace snappy
+
+#endif  // THIRD_PARTY_SNAPPY_SNAPPY_APPENDABLE_H_
@@ -26,9 +26,123 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "snappy-framing.h"
+#include "snappy-sinksource.h"
 #include "snappy.h"
 #include "snappy-c.h"
 
+// Keeps the working memory of the compressor between calls. The compressor
+// only has one allocation live at a time, so a single buffer, grown when a
+// larger one is asked for, serves all of them.
+struct snappy_env : public snappy::Allocator {
+  snappy_env() : buffer(nullptr), capacity(0) {}
+  ~snappy_env() override { delete[] buffer; }
+
+  char* Allocate(size_t size) override {
+    if (size > capacity) {
+      delete[] buffer;
+      buffer = new char[size];
+      capacity = size;
+    }
+    return buffer;
+  }
+
+  void Deallocate(char* ptr, size_t size) override {
+    // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+    (void)ptr;
+    (void)size;
+  }
+
+  char* buffer;
+  size_t capacity;
+};
+
+namespace {
+
+// A Sink that writes into the output buffer of the current call, and keeps
+// what does not fit for the following calls.
+class CallerBufferSink : public snappy::Sink {
+ public:
+  CallerBufferSink() : output_(nullptr), capacity_(0), used_(0), offset_(0) {}
+
+  // Starts a call that writes to "output[0,capacity-1]", beginning with the
+  // data kept from earlier calls.
+  void Begin(char* output, size_t capacity) {
+    output_ = output;
+    capacity_ = capacity;
+    used_ = std::min(capacity, pending());
+    if (used_ == 0) return;
+    std::memcpy(output, overflow_.data() + offset_, used_);
+    offset_ += used_;
+    // Drop what was written out once it is most of "overflow_", so that a
+    // backlog that never drains does not keep the whole stream.
+    if (offset_ == overflow_.size()) {
+      overflow_.clear();
+      offset_ = 0;
+    } else if (offset_ > overflow_.size() / 2) {
+      overflow_.erase(0, offset_);
+      offset_ = 0;
+    }
+  }
+
+  // Returns the number of bytes written to the output buffer of this call.
+  size_t End() {
+    output_ = nullptr;
+    capacity_ = 0;
+    return used_;
+  }
+
+  size_t pending() const { return overflow_.size() - offset_; }
+
+  void Append(const char* bytes, size_t n) override {
+    // Do no copying if the caller filled in the result of GetAppendBuffer().
+    if (bytes == output_ + used_ && n <= capacity_ - used_) {
+      used_ += n;
+      return;
+    }
+    if (pending() == 0) {
+      const size_t to_copy = std::min(n, capacity_ - used_);
+      std::memcpy(output_ + used_, bytes, to_copy);
+      used_ += to_copy;
+      bytes += to_copy;
+      n -= to_copy;
+    }
+    overflow_.append(bytes, n);
+  }
+
+  char* GetAppendBuffer(size_t length, char* scratch) override {
+    if (pending() == 0 && capacity_ - used_ >= length) return output_ + used_;
+    return scratch;
+  }
+
+ private:
+  char* output_;
+  size_t capacity_;
+  size_t used_;
+  std::string overflow_;
+  size_t offset_;  // the number of bytes of "overflow_" already written out
+};
+
+}  // namespace
+
+struct snappy_framed_compressor {
+  explicit snappy_framed_compressor(bool with_seek_table)
+      : writer(&sink, with_seek_table), finished(false) {}
+
+  CallerBufferSink sink;
+  snappy::FramedWriter writer;
+  bool finished;
+};
+
+struct snappy_framed_decompressor {
+  CallerBufferSink sink;
+  snappy::FramedDecoder decoder;
+};
+
 extern "C" {
 
 snappy_status snappy_compress(const char* input,
@@ -87,4 +201,193 @@ snappy_status snappy_validate_compressed_buffer(const char *compressed,
   }
 }
 
+snappy_env* snappy_env_create(void) {
+  return new snappy_env();
+}
+
+void snappy_env_destroy(snappy_env* env) {
+  delete env;
+}
+
+snappy_status snappy_env_compress(snappy_env* env,
+                                  const char* input,
+                                  size_t input_length,
+                                  char* compressed,
+                                  size_t* compressed_length) {
+  if (*compressed_length < snappy_max_compressed_length(input_length)) {
+    return SNAPPY_BUFFER_TOO_SMALL;
+  }
+  snappy::RawCompress(input, input_length, compressed, compressed_length, env);
+  return SNAPPY_OK;
+}
+
+snappy_status snappy_env_uncompress(snappy_env* env,
+                                    const char* compressed,
+                                    size_t compressed_length,
+                                    char* uncompressed,
+                                    size_t* uncompressed_length) {
+  // Decompression needs no scratch memory.
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)env;
+
+  return snappy_uncompress(compressed, compressed_length, uncompressed,
+                           uncompressed_length);
+}
+
+snappy_status snappy_env_compress_batch(snappy_env* env,
+                                        size_t count,
+                                        const char* const* inputs,
+                                        const size_t* input_lengths,
+                                        char* const* compressed,
+                                        size_t* compressed_lengths,
+                                        snappy_status* statuses) {
+  snappy_status result = SNAPPY_OK;
+  for (size_t i = 0; i < count; ++i) {
+    const snappy_status status =
+        snappy_env_compress(env, inputs[i], input_lengths[i], compressed[i],
+                            &compressed_lengths[i]);
+    if (statuses != nullptr) statuses[i] = status;
+    if (result == SNAPPY_OK) result = status;
+  }
+  return result;
+}
+
+snappy_status snappy_env_uncompress_batch(snappy_env* env,
+                                          size_t count,
+                                          const char* const* compressed,
+                                          const size_t* compressed_lengths,
+                                          char* const* uncompressed,
+                                          size_t* uncompressed_lengths,
+                                          snappy_status* statuses) {
+  snappy_status result = SNAPPY_OK;
+  for (size_t i = 0; i < count; ++i) {
+    const snappy_status status =
+        snappy_env_uncompress(env, compressed[i], compressed_lengths[i],
+                              uncompressed[i], &uncompressed_lengths[i]);
+    if (statuses != nullptr) statuses[i] = status;
+    if (result == SNAPPY_OK) result = status;
+  }
+  return result;
+}
+
+snappy_status snappy_uncompress_iov(const char* compressed,
+                                    size_t compressed_length,
+                                    const struct iovec* iov,
+                                    size_t iov_cnt) {
+  size_t uncompressed_length;
+  if (!snappy::GetUncompressedLength(compressed, compressed_length,
+                                     &uncompressed_length)) {
+    return SNAPPY_INVALID_INPUT;
+  }
+  size_t available = 0;
+  for (size_t i = 0; i < iov_cnt && available < uncompressed_length; ++i) {
+    available += iov[i].iov_len;
+  }
+  if (available < uncompressed_length) {
+    return SNAPPY_BUFFER_TOO_SMALL;
+  }
+  if (!snappy::RawUncompressToIOVec(compressed, compressed_length, iov,
+                                    iov_cnt)) {
+    return SNAPPY_INVALID_INPUT;
+  }
+  return SNAPPY_OK;
+}
+
+snappy_framed_compressor* snappy_framed_compressor_create(int with_seek_table) {
+  return new snappy_framed_compressor(with_seek_table != 0);
+}
+
+void snappy_framed_compressor_destroy(snappy_framed_compressor* compressor) {
+  delete compressor;
+}
+
+snappy_status snappy_framed_compressor_feed(
+    snappy_framed_compressor* compressor, const char* input,
+    size_t* input_length, char* output, size_t* output_length) {
+  compressor->sink.Begin(output, *output_length);
+  if (*input_length > 0 && compressor->finished) {
+    *input_length = 0;
+    *output_length = compressor->sink.End();
+    return SNAPPY_INVALID_INPUT;
+  }
+  // Input is taken a chunk at a time, and no more once output is left over,
+  // so that at most one compressed chunk is kept.
+  size_t consumed = 0;
+  while (consumed < *input_length && compressor->sink.pending() == 0) {
+    const size_t n = std::min(*input_length - consumed, snappy::kBlockSize);
+    compressor->writer.Append(input + consumed, n);
+    consumed += n;
+  }
+  *input_length = consumed;
+  *output_length = compressor->sink.End();
+  return SNAPPY_OK;
+}
+
+snappy_status snappy_framed_compressor_flush(
+    snappy_framed_compressor* compressor, char* output, size_t* output_length) {
+  compressor->sink.Begin(output, *output_length);
+  if (!compressor->finished) compressor->writer.Flush();
+  *output_length = compressor->sink.End();
+  return compressor->finished ? SNAPPY_INVALID_INPUT : SNAPPY_OK;
+}
+
+snappy_status snappy_framed_compressor_finish(
+    snappy_framed_compressor* compressor, char* output, size_t* output_length) {
+  compressor->sink.Begin(output, *output_length);
+  if (!compressor->finished) {
+    compressor->writer.Finish();
+    compressor->finished = true;
+  }
+  *output_length = compressor->sink.End();
+  return SNAPPY_OK;
+}
+
+size_t snappy_framed_compressor_pending(
+    const snappy_framed_compressor* compressor) {
+  return compressor->sink.pending();
+}
+
+snappy_framed_decompressor* snappy_framed_decompressor_create(void) {
+  return new snappy_framed_decompressor();
+}
+
+void snappy_framed_decompressor_destroy(
+    snappy_framed_decompressor* decompressor) {
+  delete decompressor;
+}
+
+snappy_status snappy_framed_decompressor_feed(
+    snappy_framed_decompressor* decompressor, const char* input,
+    size_t* input_length, char* output, size_t* output_length) {
+  decompressor->sink.Begin(output, *output_length);
+  // Chunks are decoded one at a time, and no more once output is left over,
+  // so that at most one uncompressed chunk is kept.
+  size_t consumed = 0;
+  // Fails if the stream failed before.
+  bool ok = decompressor->decoder.Feed(input, 0, &decompressor->sink);
+  while (ok && consumed < *input_length &&
+         decompressor->sink.pending() == 0) {
+    size_t n;
+    ok = decompressor->decoder.Feed(input + consumed, *input_length - consumed,
+                                    &decompressor->sink, &n);
+    consumed += n;
+  }
+  *input_length = consumed;
+  *output_length = decompressor->sink.End();
+  return ok ? SNAPPY_OK : SNAPPY_INVALID_INPUT;
+}
+
+snappy_status snappy_framed_decompressor_finish(
+    snappy_framed_decompressor* decompressor, char* output,
+    size_t* output_length) {
+  decompressor->sink.Begin(output, *output_length);
+  *output_length = decompressor->sink.End();
+  return decompressor->decoder.Finished() ? SNAPPY_OK : SNAPPY_INVALID_INPUT;
+}
+
+size_t snappy_framed_decompressor_pending(
+    const snappy_framed_decompressor* decompressor) {
+  return decompressor->sink.pending();
+}
+
 }  // extern "C"
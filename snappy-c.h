@@ -39,6 +39,8 @@ extern "C" {
 
 #include <stddef.h>
 
+struct iovec;
+
 /*
  * Return values; see the documentation for each function to know
  * what each can return.
@@ -131,6 +133,196 @@ snappy_status snappy_uncompressed_length(const char* compressed,
 snappy_status snappy_validate_compressed_buffer(const char* compressed,
                                                 size_t compressed_length);
 
+/*
+ * An environment holds the scratch memory of the compressor, so that it is
+ * allocated once instead of on every call. Create one with
+ * snappy_env_create() and release it with snappy_env_destroy(); a NULL
+ * environment may also be destroyed. An environment may be used by only one
+ * thread at a time.
+ *
+ * Example:
+ *   snappy_env* env = snappy_env_create();
+ *   for (...) {
+ *     size_t output_length = snappy_max_compressed_length(input_length);
+ *     if (snappy_env_compress(env, input, input_length, output,
+ *                             &output_length) == SNAPPY_OK) {
+ *       ... Process(output, output_length) ...
+ *     }
+ *   }
+ *   snappy_env_destroy(env);
+ */
+typedef struct snappy_env snappy_env;
+
+snappy_env* snappy_env_create(void);
+
+void snappy_env_destroy(snappy_env* env);
+
+/*
+ * Same as snappy_compress() and snappy_uncompress(), using the scratch
+ * memory of "env".
+ */
+snappy_status snappy_env_compress(snappy_env* env,
+                                  const char* input,
+                                  size_t input_length,
+                                  char* compressed,
+                                  size_t* compressed_length);
+
+snappy_status snappy_env_uncompress(snappy_env* env,
+                                    const char* compressed,
+                                    size_t compressed_length,
+                                    char* uncompressed,
+                                    size_t* uncompressed_length);
+
+/*
+ * Compresses "count" messages in one call, which amortizes the cost of
+ * calling into the library, e.g. from other languages, over all of them.
+ * Message i is "inputs[i][0..input_lengths[i]-1]"; it is compressed into
+ * "compressed[i]", which has room for "compressed_lengths[i]" bytes, as by
+ * snappy_env_compress(), which also sets "compressed_lengths[i]".
+ *
+ * If "statuses" is not NULL, the status of message i is stored in
+ * "statuses[i]". All messages are processed even if some fail. Returns
+ * SNAPPY_OK if all messages succeeded, and the status of the first one that
+ * failed otherwise.
+ */
+snappy_status snappy_env_compress_batch(snappy_env* env,
+                                        size_t count,
+                                        const char* const* inputs,
+                                        const size_t* input_lengths,
+                                        char* const* compressed,
+                                        size_t* compressed_lengths,
+                                        snappy_status* statuses);
+
+/*
+ * Same as snappy_env_compress_batch(), for decompression as by
+ * snappy_env_uncompress().
+ */
+snappy_status snappy_env_uncompress_batch(snappy_env* env,
+                                          size_t count,
+                                          const char* const* compressed,
+                                          const size_t* compressed_lengths,
+                                          char* const* uncompressed,
+                                          size_t* uncompressed_lengths,
+                                          snappy_status* statuses);
+
+/*
+ * Same as snappy_uncompress(), except that the uncompressed data is stored
+ * in the buffers described by "iov[0..iov_cnt-1]", one after the other.
+ * Returns SNAPPY_BUFFER_TOO_SMALL if they cannot hold all of it.
+ */
+snappy_status snappy_uncompress_iov(const char* compressed,
+                                    size_t compressed_length,
+                                    const struct iovec* iov,
+                                    size_t iov_cnt);
+
+/*
+ * Streaming compression and decompression in the framing format described in
+ * framing_format.txt, which splits the data into checksummed chunks.
+ *
+ * The functions that produce output write as much of it as fits into
+ * "output[0..*output_length-1]" and set "*output_length" to the number of
+ * bytes written. Output that does not fit is kept in the stream object and
+ * written first by later calls; snappy_framed_*_pending() returns how much
+ * of it there is, and calls with no input retrieve it. Chunks are compressed
+ * and decompressed straight into "output" when it has room for them, so
+ * output buffers of 128 KiB or more avoid copies.
+ *
+ * The functions that take input are passed its length in "*input_length"
+ * and set it to the number of bytes consumed. They stop taking input once
+ * "output" is full, so that at most about one chunk of output is kept; the
+ * rest of the input must be passed again, like zlib's avail_in.
+ *
+ * Stream objects may be used by only one thread at a time.
+ *
+ * Example:
+ *   snappy_framed_compressor* c = snappy_framed_compressor_create(0);
+ *   while (... read input ...) {
+ *     while (input_length > 0) {
+ *       size_t consumed = input_length;
+ *       size_t output_length = sizeof(output);
+ *       snappy_framed_compressor_feed(c, input, &consumed, output,
+ *                                     &output_length);
+ *       ... Write(output, output_length) ...
+ *       input += consumed;
+ *       input_length -= consumed;
+ *     }
+ *   }
+ *   do {
+ *     size_t output_length = sizeof(output);
+ *     snappy_framed_compressor_finish(c, output, &output_length);
+ *     ... Write(output, output_length) ...
+ *   } while (snappy_framed_compressor_pending(c) > 0);
+ *   snappy_framed_compressor_destroy(c);
+ */
+typedef struct snappy_framed_compressor snappy_framed_compressor;
+
+/*
+ * If "with_seek_table" is non-zero, the stream ends with a seek table, which
+ * allows decompressing parts of it without reading it from the start.
+ */
+snappy_framed_compressor* snappy_framed_compressor_create(int with_seek_table);
+
+void snappy_framed_compressor_destroy(snappy_framed_compressor* compressor);
+
+/*
+ * Appends "input[0..*input_length-1]", or the first "*input_length" bytes of
+ * it on return, to the stream. Input is compressed in 64 KiB chunks; a
+ * partial chunk is kept until more input arrives, or until
+ * snappy_framed_compressor_flush() or snappy_framed_compressor_finish().
+ * Returns SNAPPY_INVALID_INPUT if the stream was finished.
+ */
+snappy_status snappy_framed_compressor_feed(
+    snappy_framed_compressor* compressor, const char* input,
+    size_t* input_length, char* output, size_t* output_length);
+
+/*
+ * Compresses the input kept from earlier calls as a (possibly short) chunk,
+ * so that all input fed so far can be decompressed from the output.
+ * Returns SNAPPY_INVALID_INPUT if the stream was finished.
+ */
+snappy_status snappy_framed_compressor_flush(
+    snappy_framed_compressor* compressor, char* output, size_t* output_length);
+
+/*
+ * Flushes the stream and ends it, writing the seek table if enabled. After
+ * this, only snappy_framed_compressor_finish() may be called again, to
+ * retrieve output that is still pending.
+ */
+snappy_status snappy_framed_compressor_finish(
+    snappy_framed_compressor* compressor, char* output, size_t* output_length);
+
+size_t snappy_framed_compressor_pending(
+    const snappy_framed_compressor* compressor);
+
+typedef struct snappy_framed_decompressor snappy_framed_decompressor;
+
+snappy_framed_decompressor* snappy_framed_decompressor_create(void);
+
+void snappy_framed_decompressor_destroy(
+    snappy_framed_decompressor* decompressor);
+
+/*
+ * Decodes "input[0..*input_length-1]", the next bytes of a framed stream,
+ * which may end anywhere, and sets "*input_length" to the number of bytes
+ * consumed. The uncompressed data of every chunk they complete is output.
+ * Returns SNAPPY_INVALID_INPUT if the stream is corrupted, and for all later
+ * calls.
+ */
+snappy_status snappy_framed_decompressor_feed(
+    snappy_framed_decompressor* decompressor, const char* input,
+    size_t* input_length, char* output, size_t* output_length);
+
+/*
+ * Writes pending output like a call with no input, and returns
+ * SNAPPY_INVALID_INPUT if the bytes fed so far are not a complete stream.
+ */
+snappy_status snappy_framed_decompressor_finish(
+    snappy_framed_decompressor* decompressor, char* output,
+    size_t* output_length);
+
+size_t snappy_framed_decompressor_pending(
+    const snappy_framed_decompressor* decompressor);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -0,0 +1,148 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// CRC-32C (Castagnoli), used by the framing format for data checksums.
+
+#include "snappy-internal.h"
+
+#if !defined(SNAPPY_HAVE_X86_CRC32)
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(__AVX__))
+#define SNAPPY_HAVE_X86_CRC32 1
+#else
+#define SNAPPY_HAVE_X86_CRC32 0
+#endif
+#endif  // !defined(SNAPPY_HAVE_X86_CRC32)
+
+#if !defined(SNAPPY_HAVE_NEON_CRC32)
+#if defined(__ARM_FEATURE_CRC32)
+#define SNAPPY_HAVE_NEON_CRC32 1
+#else
+#define SNAPPY_HAVE_NEON_CRC32 0
+#endif
+#endif  // !defined(SNAPPY_HAVE_NEON_CRC32)
+
+#if SNAPPY_HAVE_X86_CRC32
+// Please do not replace with <x86intrin.h>. or with headers that assume more
+// advanced SSE versions without checking with all the OWNERS.
+#include <nmmintrin.h>
+#elif SNAPPY_HAVE_NEON_CRC32
+#include <arm_acle.h>
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace snappy {
+namespace internal {
+
+namespace {
+
+#if !SNAPPY_HAVE_X86_CRC32 && !SNAPPY_HAVE_NEON_CRC32
+
+// Reflected CRC-32C polynomial.
+constexpr uint32_t kCrc32cPoly = 0x82f63b78;
+
+// Tables for the slicing-by-4 software implementation. t[0] is the classic
+// byte-at-a-time table; t[k][b] is the CRC of byte b followed by k zero bytes.
+struct Crc32cTables {
+  std::array<std::array<uint32_t, 256>, 4> t;
+
+  Crc32cTables() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j) {
+        crc = (crc >> 1) ^ ((crc & 1) ? kCrc32cPoly : 0);
+      }
+      t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 4; ++k) {
+        const uint32_t prev = t[k - 1][i];
+        t[k][i] = (prev >> 8) ^ t[0][prev & 0xff];
+      }
+    }
+  }
+};
+
+const Crc32cTables& GetCrc32cTables() {
+  static const Crc32cTables* const tables = new Crc32cTables();
+  return *tables;
+}
+
+#endif  // !SNAPPY_HAVE_X86_CRC32 && !SNAPPY_HAVE_NEON_CRC32
+
+}  // namespace
+
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t n) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* const end = p + n;
+  uint32_t l = ~crc;
+
+#if SNAPPY_HAVE_X86_CRC32
+#if defined(__x86_64__) || defined(_M_X64)
+  uint64_t l64 = l;
+  while (end - p >= 8) {
+    l64 = _mm_crc32_u64(l64, LittleEndian::Load64(p));
+    p += 8;
+  }
+  l = static_cast<uint32_t>(l64);
+#endif  // defined(__x86_64__) || defined(_M_X64)
+  while (end - p >= 4) {
+    l = _mm_crc32_u32(l, LittleEndian::Load32(p));
+    p += 4;
+  }
+  while (p < end) {
+    l = _mm_crc32_u8(l, *p++);
+  }
+#elif SNAPPY_HAVE_NEON_CRC32
+  while (end - p >= 8) {
+    l = __crc32cd(l, LittleEndian::Load64(p));
+    p += 8;
+  }
+  while (p < end) {
+    l = __crc32cb(l, *p++);
+  }
+#else
+  const Crc32cTables& tables = GetCrc32cTables();
+  while (end - p >= 4) {
+    l ^= LittleEndian::Load32(p);
+    l = tables.t[3][l & 0xff] ^ tables.t[2][(l >> 8) & 0xff] ^
+        tables.t[1][(l >> 16) & 0xff] ^ tables.t[0][l >> 24];
+    p += 4;
+  }
+  while (p < end) {
+    l = tables.t[0][(l ^ *p++) & 0xff] ^ (l >> 8);
+  }
+#endif  // SNAPPY_HAVE_X86_CRC32
+
+  return ~l;
+}
+
+}  // namespace internal
+}  // namespace snappy
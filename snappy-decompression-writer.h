@@ -0,0 +1,205 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Decompression into user-defined writers. snappy.h decompresses
+// into flat arrays, iovecs and Sinks; UncompressTo() decompresses into any
+// type that models the DecompressionWriter concept below, without a virtual
+// call per element.
+//
+// Writers whose output is a flat char array can also provide GetBase(), and
+// then UncompressTo() decodes most of the data with the same loop as
+// RawUncompress(), leaving only long literals, copies with 4-byte offsets and
+// the last bytes of the input and output to the generic per-element loop.
+// On the benchmark files, such a writer runs within about 5% of
+// RawUncompress(), except on inputs of a few hundred bytes, which end up
+// mostly in the generic loop. Writers without GetBase() get only the generic
+// loop, which measured 38-68% of RawUncompress()'s throughput on compressible
+// data (38-59% on html). Compare BM_UFlatDecompressionWriter with BM_UFlat.
+
+#ifndef THIRD_PARTY_SNAPPY_SNAPPY_DECOMPRESSION_WRITER_H_
+#define THIRD_PARTY_SNAPPY_SNAPPY_DECOMPRESSION_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snappy-tag-iterator.h"
+
+namespace snappy {
+
+// A DecompressionWriter is any class with the following members. OutputPtr is
+// a copyable type chosen by the writer that identifies the current output
+// position, e.g. a char* into the destination or a count of bytes written.
+// The decoder keeps it in a local variable, passes it to the append methods
+// by pointer, and hands it back with SetOutputPtr() once it is done.
+//
+//   class MyWriter {
+//    public:
+//     // Called once, before any other method, with the uncompressed length
+//     // stored in the header of the compressed data. The length is not
+//     // trusted: the data may be corrupt and produce fewer or more bytes.
+//     void SetExpectedLength(size_t len);
+//
+//     // Returns the position of the first output byte.
+//     OutputPtr GetOutputPtr();
+//
+//     // Appends the literal "ip[0..len-1]" at "*op" and advances "*op".
+//     // Returns false, which aborts decompression, if the output would exceed
+//     // the expected length.
+//     bool Append(const char* ip, size_t len, OutputPtr* op);
+//
+//     // Called first for every literal, whatever its length, as a fast path.
+//     // "ip[0..available-1]" is readable, and "available" may exceed "len",
+//     // which allows copying more than "len" bytes at once. The writer may
+//     // decline by returning false, in which case Append() is called
+//     // instead; writers without a fast path simply return false. A writer
+//     // that accepts must make the same checks as Append(): "len" comes from
+//     // the untrusted input and may be anything up to 4 GiB, so it has to be
+//     // checked against the room left in the output.
+//     bool TryFastAppend(const char* ip, size_t available, size_t len,
+//                        OutputPtr* op);
+//
+//     // Appends "len" bytes copied from "offset" bytes before "*op", byte by
+//     // byte, so "len" may exceed "offset" (the copied bytes then repeat).
+//     // "len" is at least 1. Returns false, which aborts decompression, if
+//     // "offset" is 0, if it points before the start of the output, or if the
+//     // output would exceed the expected length. These checks are what
+//     // rejects corrupt data, so they must not be skipped.
+//     bool AppendFromSelf(size_t offset, size_t len, OutputPtr* op);
+//
+//     // Called once when decoding stops, with the final output position.
+//     void SetOutputPtr(OutputPtr op);
+//
+//     // Called after SetOutputPtr(), also when decoding failed.
+//     void Flush();
+//
+//     // Returns true iff exactly the expected length was produced.
+//     bool CheckLength() const;
+//
+//     // Optional, and only for writers whose OutputPtr is char*. Returns the
+//     // start of a flat output array that the current output position is in,
+//     // or nullptr to decline, and stores in "*op_limit_min_slop" an offset
+//     // from it such that writing kDecompressionSlopBytes bytes at any
+//     // position before it is safe. The decoder may then write the output
+//     // directly, and leaves the position at most kDecompressionSlopBytes - 1
+//     // bytes past that offset, so the offset must be at least that much below
+//     // the end of the expected length. Called again after every element that
+//     // goes through the methods above.
+//     char* GetBase(ptrdiff_t* op_limit_min_slop);
+//   };
+//
+// Writers are used by a single call at a time and are not copied.
+
+// The number of bytes the decoder writes at once through GetBase().
+constexpr size_t kDecompressionSlopBytes = 64;
+
+namespace internal {
+
+// Runs the decoding loop of RawUncompress() on "[ip, ip_limit)", writing to
+// "op_base + *op" with the limit described for GetBase(). Stops before a long
+// literal, a copy with a 4-byte offset or an invalid element, and when it
+// gets close to either limit. Returns the input position it stopped at and
+// advances "*op" to match.
+const uint8_t* DecompressFlat(const uint8_t* ip, const uint8_t* ip_limit,
+                              char* op_base, ptrdiff_t* op,
+                              ptrdiff_t op_limit_min_slop);
+
+// Runs DecompressFlat() if "*writer" has a GetBase() method that does not
+// decline.
+template <typename Writer>
+inline auto MaybeDecompressFlat(Writer* writer, const uint8_t** ip,
+                                const uint8_t* ip_limit, char** op, int)
+    -> decltype(writer->GetBase(static_cast<ptrdiff_t*>(nullptr)), void()) {
+  ptrdiff_t op_limit_min_slop;
+  char* const op_base = writer->GetBase(&op_limit_min_slop);
+  if (op_base == nullptr) return;
+  ptrdiff_t offset = *op - op_base;
+  *ip = DecompressFlat(*ip, ip_limit, op_base, &offset, op_limit_min_slop);
+  *op = op_base + offset;
+}
+
+template <typename Writer, typename OutputPtr>
+inline void MaybeDecompressFlat(Writer*, const uint8_t**, const uint8_t*,
+                                OutputPtr*, long) {}
+
+// Decodes the tags in "[ip, ip_limit)" into "*writer". Returns false if the
+// writer rejected an element or the input ends in the middle of one.
+template <typename Writer, typename OutputPtr>
+inline bool UncompressToAllTags(const uint8_t* ip, const uint8_t* ip_limit,
+                                Writer* writer, OutputPtr* op) {
+  for (;;) {
+    MaybeDecompressFlat(writer, &ip, ip_limit, op, 0);
+    if (ip >= ip_limit) break;
+    bool is_literal;
+    size_t length, copy_offset;
+    const uint8_t* const next =
+        DecodeTag(ip, ip_limit, &is_literal, &length, &copy_offset);
+    if (next == nullptr) return false;
+    if (is_literal) {
+      const char* const literal = reinterpret_cast<const char*>(next - length);
+      if (!writer->TryFastAppend(literal, ip_limit - (next - length), length,
+                                 op) &&
+          !writer->Append(literal, length, op)) {
+        return false;
+      }
+    } else if (!writer->AppendFromSelf(copy_offset, length, op)) {
+      return false;
+    }
+    ip = next;
+  }
+  return true;
+}
+
+}  // namespace internal
+
+// Decompresses "compressed[0..compressed_length-1]", as produced by
+// snappy::Compress(), into "*writer", a DecompressionWriter (see above).
+// Accepts and rejects exactly the inputs that RawUncompress() does, provided
+// the writer performs the checks described above.
+//
+// returns false if the message is corrupted and could not be decrypted
+template <typename Writer>
+bool UncompressTo(const char* compressed, size_t compressed_length,
+                  Writer* writer) {
+  const uint8_t* ip = reinterpret_cast<const uint8_t*>(compressed);
+  const uint8_t* const ip_limit = ip + compressed_length;
+  uint32_t uncompressed_length;
+  if (!internal::ParseUncompressedLength(&ip, ip_limit, &uncompressed_length)) {
+    return false;
+  }
+
+  writer->SetExpectedLength(uncompressed_length);
+  auto op = writer->GetOutputPtr();
+  const bool ok = internal::UncompressToAllTags(ip, ip_limit, writer, &op);
+  writer->SetOutputPtr(op);
+  writer->Flush();
+  return ok && writer->CheckLength();
+}
+
+}  // namespace snappy
+
+#endif  // THIRD_PARTY_SNAPPY_SNAPPY_DECOMPRESSION_WRITER_H_
@@ -0,0 +1,603 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "snappy-framing.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "snappy-internal.h"
+#include "snappy-sinksource.h"
+#include "snappy.h"
+
+namespace snappy {
+
+namespace {
+
+constexpr uint8_t kCompressedChunkType = 0x00;
+constexpr uint8_t kUncompressedChunkType = 0x01;
+constexpr uint8_t kStreamIdentifierChunkType = 0xff;
+
+constexpr char kStreamIdentifier[] = "\xff\x06\x00\x00sNaPpY";
+constexpr size_t kStreamIdentifierSize = sizeof(kStreamIdentifier) - 1;
+
+constexpr size_t kChunkHeaderSize = 4;
+constexpr size_t kChecksumSize = 4;
+constexpr size_t kMaxChunkDataLength = (1 << 24) - 1;
+
+// Seek table layout, see framing_format.txt, section 4.7.
+constexpr char kSeekTableMagic[] = "sNaPsEeK";
+constexpr size_t kSeekTableMagicSize = sizeof(kSeekTableMagic) - 1;
+constexpr size_t kSeekEntrySize = 8 + 8 + 4;
+constexpr size_t kSeekTrailerSize = 8 + 4 + 4 + kSeekTableMagicSize;
+
+inline void StoreChunkHeader(char* dst, uint8_t type, size_t length) {
+  assert(length <= kMaxChunkDataLength);
+  dst[0] = static_cast<char>(type);
+  dst[1] = static_cast<char>(length);
+  dst[2] = static_cast<char>(length >> 8);
+  dst[3] = static_cast<char>(length >> 16);
+}
+
+inline size_t LoadChunkLength(const char* header) {
+  return LittleEndian::Load32(header) >> 8;
+}
+
+// Returns a pointer to the next "n" bytes of "*source". If they are available
+// in a single flat region, that region is returned and "*to_skip" is set to
+// "n"; the caller must Skip() them once done with the data. Otherwise the
+// bytes are gathered into "*scratch", consumed from "*source", and "*to_skip"
+// is set to 0.
+//
+// REQUIRES: source->Available() >= n
+const char* PeekExactly(Source* source, size_t n, std::string* scratch,
+                        size_t* to_skip) {
+  size_t available;
+  const char* p = source->Peek(&available);
+  if (available >= n) {
+    *to_skip = n;
+    return p;
+  }
+  STLStringResizeUninitialized(scratch, n);
+  char* dst = string_as_array(scratch);
+  size_t gathered = 0;
+  while (gathered < n) {
+    p = source->Peek(&available);
+    const size_t to_copy = std::min(available, n - gathered);
+    std::memcpy(dst + gathered, p, to_copy);
+    source->Skip(to_copy);
+    gathered += to_copy;
+  }
+  *to_skip = 0;
+  return dst;
+}
+
+// How a chunk is handled, based on its type.
+enum class ChunkAction { kInvalid, kSkip, kDecode };
+
+ChunkAction ClassifyChunk(uint8_t type, bool seen_stream_identifier) {
+  if (type != kStreamIdentifierChunkType && !seen_stream_identifier) {
+    return ChunkAction::kInvalid;
+  }
+  if (type >= 0x02 && type <= 0x7f) {  // Reserved unskippable.
+    return ChunkAction::kInvalid;
+  }
+  if (type >= 0x80 && type <= 0xfe) {  // Padding and reserved skippable.
+    return ChunkAction::kSkip;
+  }
+  return ChunkAction::kDecode;
+}
+
+// Decodes the chunk of type "type" with data "data[0,length-1]", appending
+// its uncompressed data, if any, to "*sink". "*output_scratch" is used when
+// the sink does not provide a buffer for decompression.
+//
+// returns false if the chunk is corrupted or not allowed at this point
+bool DecodeChunk(uint8_t type, const char* data, size_t length, Sink* sink,
+                 std::string* output_scratch, bool* seen_stream_identifier) {
+  switch (ClassifyChunk(type, *seen_stream_identifier)) {
+    case ChunkAction::kInvalid:
+      return false;
+    case ChunkAction::kSkip:
+      return true;
+    case ChunkAction::kDecode:
+      break;
+  }
+  if (type == kStreamIdentifierChunkType) {
+    if (length != kStreamIdentifierSize - kChunkHeaderSize ||
+        std::memcmp(data, kStreamIdentifier + kChunkHeaderSize, length) != 0) {
+      return false;
+    }
+    *seen_stream_identifier = true;
+    return true;
+  }
+
+  if (length < kChecksumSize) return false;
+  const uint32_t crc = internal::UnmaskCrc32c(LittleEndian::Load32(data));
+  const char* payload = data + kChecksumSize;
+  const size_t payload_length = length - kChecksumSize;
+  const char* uncompressed = payload;
+  size_t uncompressed_length = payload_length;
+  if (type == kCompressedChunkType) {
+    if (!GetUncompressedLength(payload, payload_length,
+                               &uncompressed_length) ||
+        uncompressed_length > kBlockSize) {
+      return false;
+    }
+    if (output_scratch->size() < kBlockSize) {
+      STLStringResizeUninitialized(output_scratch, kBlockSize);
+    }
+    char* dst = sink->GetAppendBuffer(uncompressed_length,
+                                      string_as_array(output_scratch));
+    if (!RawUncompress(payload, payload_length, dst)) return false;
+    uncompressed = dst;
+  } else if (uncompressed_length > kBlockSize) {
+    return false;
+  }
+  if (internal::Crc32c(uncompressed, uncompressed_length) != crc) {
+    return false;
+  }
+  sink->Append(uncompressed, uncompressed_length);
+  return true;
+}
+
+}  // namespace
+
+FramedWriter::FramedWriter(Sink* sink, bool with_seek_table)
+    : sink_(sink),
+      with_seek_table_(with_seek_table),
+      finished_(false),
+      wmem_(new internal::WorkingMemory(kBlockSize)),
+      compressed_bytes_(0),
+      uncompressed_bytes_(0) {
+  pending_.reserve(kBlockSize);
+  STLStringResizeUninitialized(
+      &scratch_,
+      kChunkHeaderSize + kChecksumSize + MaxCompressedLength(kBlockSize));
+}
+
+FramedWriter::~FramedWriter() { delete wmem_; }
+
+void FramedWriter::Append(const char* data, size_t n) {
+  assert(!finished_);
+  if (!pending_.empty()) {
+    const size_t to_copy = std::min(n, kBlockSize - pending_.size());
+    pending_.append(data, to_copy);
+    data += to_copy;
+    n -= to_copy;
+    if (pending_.size() < kBlockSize) return;
+    EmitChunk(pending_.data(), pending_.size());
+    pending_.clear();
+  }
+  // Full chunks are compressed directly from the caller's buffer.
+  while (n >= kBlockSize) {
+    EmitChunk(data, kBlockSize);
+    data += kBlockSize;
+    n -= kBlockSize;
+  }
+  pending_.append(data, n);
+}
+
+void FramedWriter::Flush() {
+  if (pending_.empty()) return;
+  EmitChunk(pending_.data(), pending_.size());
+  pending_.clear();
+}
+
+size_t FramedWriter::Finish() {
+  assert(!finished_);
+  Flush();
+  EmitStreamIdentifier();
+  if (with_seek_table_) EmitSeekTable();
+  finished_ = true;
+  return static_cast<size_t>(compressed_bytes_);
+}
+
+void FramedWriter::EmitStreamIdentifier() {
+  if (compressed_bytes_ != 0) return;
+  sink_->Append(kStreamIdentifier, kStreamIdentifierSize);
+  compressed_bytes_ += kStreamIdentifierSize;
+}
+
+void FramedWriter::EmitChunk(const char* data, size_t n) {
+  assert(n > 0 && n <= kBlockSize);
+  EmitStreamIdentifier();
+
+  const uint32_t masked_crc = internal::MaskCrc32c(internal::Crc32c(data, n));
+  if (with_seek_table_) {
+    seek_table_.push_back({compressed_bytes_, uncompressed_bytes_, masked_crc});
+  }
+
+  char* const dst = sink_->GetAppendBuffer(scratch_.size(),
+                                           string_as_array(&scratch_));
+  char* const compressed = dst + kChunkHeaderSize + kChecksumSize;
+  char* const op = Varint::Encode32(compressed, static_cast<uint32_t>(n));
+  int table_size;
+  uint16_t* table = wmem_->GetHashTable(n, &table_size);
+  char* const end = internal::CompressFragment(data, n, op, table, table_size);
+  const size_t compressed_length = end - compressed;
+
+  // Store data that does not compress by at least 12.5% as-is; it is not
+  // worth the decompression time.
+  if (compressed_length < n - n / 8) {
+    StoreChunkHeader(dst, kCompressedChunkType,
+                     kChecksumSize + compressed_length);
+    LittleEndian::Store32(dst + kChunkHeaderSize, masked_crc);
+    const size_t chunk_size =
+        kChunkHeaderSize + kChecksumSize + compressed_length;
+    sink_->Append(dst, chunk_size);
+    compressed_bytes_ += chunk_size;
+  } else {
+    char header[kChunkHeaderSize + kChecksumSize];
+    StoreChunkHeader(header, kUncompressedChunkType, kChecksumSize + n);
+    LittleEndian::Store32(header + kChunkHeaderSize, masked_crc);
+    sink_->Append(header, sizeof(header));
+    sink_->Append(data, n);
+    compressed_bytes_ += sizeof(header) + n;
+  }
+  uncompressed_bytes_ += n;
+}
+
+void FramedWriter::EmitSeekTable() {
+  const uint64_t data_length =
+      seek_table_.size() * kSeekEntrySize + kSeekTrailerSize;
+  // A stream with too many chunks to index in one chunk is still a valid
+  // framed stream; it just cannot be read with SeekableFramedReader.
+  if (data_length > kMaxChunkDataLength) return;
+
+  std::string chunk;
+  STLStringResizeUninitialized(&chunk, kChunkHeaderSize + data_length);
+  char* const data = string_as_array(&chunk) + kChunkHeaderSize;
+  StoreChunkHeader(string_as_array(&chunk), kFramingSeekTableChunkType,
+                   data_length);
+  char* p = data;
+  for (const SeekEntry& entry : seek_table_) {
+    LittleEndian::Store64(p, entry.compressed_offset);
+    LittleEndian::Store64(p + 8, entry.uncompressed_offset);
+    LittleEndian::Store32(p + 16, entry.masked_crc);
+    p += kSeekEntrySize;
+  }
+  LittleEndian::Store64(p, uncompressed_bytes_);
+  LittleEndian::Store32(p + 8, static_cast<uint32_t>(seek_table_.size()));
+  p += 12;
+  LittleEndian::Store32(p,
+                        internal::MaskCrc32c(internal::Crc32c(data, p - data)));
+  std::memcpy(p + 4, kSeekTableMagic, kSeekTableMagicSize);
+
+  sink_->Append(chunk.data(), chunk.size());
+  compressed_bytes_ += chunk.size();
+}
+
+size_t CompressFramed(Source* source, Sink* sink, bool with_seek_table) {
+  FramedWriter writer(sink, with_seek_table);
+  while (source->Available() > 0) {
+    size_t fragment_size;
+    const char* fragment = source->Peek(&fragment_size);
+    fragment_size = std::min(fragment_size, source->Available());
+    writer.Append(fragment, fragment_size);
+    source->Skip(fragment_size);
+  }
+  return writer.Finish();
+}
+
+bool UncompressFramed(Source* source, Sink* sink) {
+  std::string chunk_scratch;
+  std::string output_scratch;
+  bool seen_stream_identifier = false;
+
+  while (source->Available() > 0) {
+    if (source->Available() < kChunkHeaderSize) return false;
+    char header[kChunkHeaderSize];
+    size_t to_skip;
+    std::memcpy(header, PeekExactly(source, kChunkHeaderSize, &chunk_scratch,
+                                    &to_skip),
+                kChunkHeaderSize);
+    source->Skip(to_skip);
+
+    const uint8_t type = static_cast<uint8_t>(header[0]);
+    const size_t length = LoadChunkLength(header);
+    if (source->Available() < length) return false;
+    switch (ClassifyChunk(type, seen_stream_identifier)) {
+      case ChunkAction::kInvalid:
+        return false;
+      case ChunkAction::kSkip:
+        source->Skip(length);
+        continue;
+      case ChunkAction::kDecode:
+        break;
+    }
+
+    const char* data = PeekExactly(source, length, &chunk_scratch, &to_skip);
+    if (!DecodeChunk(type, data, length, sink, &output_scratch,
+                     &seen_stream_identifier)) {
+      return false;
+    }
+    source->Skip(to_skip);
+  }
+  return seen_stream_identifier;
+}
+
+FramedDecoder::FramedDecoder()
+    : seen_stream_identifier_(false), failed_(false), skip_(0) {}
+
+FramedDecoder::~FramedDecoder() = default;
+
+bool FramedDecoder::Feed(const char* data, size_t n, Sink* sink) {
+  while (n > 0) {
+    size_t consumed;
+    if (!Feed(data, n, sink, &consumed)) return false;
+    data += consumed;
+    n -= consumed;
+  }
+  return !failed_;
+}
+
+bool FramedDecoder::Feed(const char* data, size_t n, Sink* sink,
+                         size_t* consumed) {
+  *consumed = 0;
+  if (failed_) return false;
+  const char* const start = data;
+  while (n > 0) {
+    if (skip_ > 0) {
+      const size_t to_skip = std::min(n, skip_);
+      skip_ -= to_skip;
+      data += to_skip;
+      n -= to_skip;
+      continue;
+    }
+
+    // A chunk that lies entirely in "data" is decoded in place.
+    if (pending_.empty() && n >= kChunkHeaderSize &&
+        n - kChunkHeaderSize >= LoadChunkLength(data)) {
+      const size_t length = LoadChunkLength(data);
+      if (!DecodeChunk(static_cast<uint8_t>(data[0]), data + kChunkHeaderSize,
+                       length, sink, &output_scratch_,
+                       &seen_stream_identifier_)) {
+        failed_ = true;
+        return false;
+      }
+      data += kChunkHeaderSize + length;
+      break;
+    }
+
+    // Otherwise the chunk is gathered in "pending_", except for skippable
+    // chunks, which are dropped as they arrive.
+    if (pending_.size() < kChunkHeaderSize) {
+      const size_t to_copy = std::min(n, kChunkHeaderSize - pending_.size());
+      pending_.append(data, to_copy);
+      data += to_copy;
+      n -= to_copy;
+      if (pending_.size() < kChunkHeaderSize) break;
+      switch (ClassifyChunk(static_cast<uint8_t>(pending_[0]),
+                            seen_stream_identifier_)) {
+        case ChunkAction::kInvalid:
+          failed_ = true;
+          return false;
+        case ChunkAction::kSkip:
+          skip_ = LoadChunkLength(pending_.data());
+          pending_.clear();
+          continue;
+        case ChunkAction::kDecode:
+          break;
+      }
+    }
+    const size_t length = LoadChunkLength(pending_.data());
+    const size_t to_copy =
+        std::min(n, kChunkHeaderSize + length - pending_.size());
+    pending_.append(data, to_copy);
+    data += to_copy;
+    n -= to_copy;
+    if (pending_.size() < kChunkHeaderSize + length) break;
+    if (!DecodeChunk(static_cast<uint8_t>(pending_[0]),
+                     pending_.data() + kChunkHeaderSize, length, sink,
+                     &output_scratch_, &seen_stream_identifier_)) {
+      failed_ = true;
+      return false;
+    }
+    pending_.clear();
+    break;
+  }
+  *consumed = data - start;
+  return true;
+}
+
+bool FramedDecoder::Finished() const {
+  return !failed_ && seen_stream_identifier_ && pending_.empty() && skip_ == 0;
+}
+
+SeekableFramedReader::SeekableFramedReader(const char* framed, size_t n)
+    : framed_(framed),
+      framed_length_(n),
+      uncompressed_length_(0),
+      current_chunk_(0),
+      chunk_data_(nullptr),
+      chunk_length_(0) {}
+
+SeekableFramedReader::~SeekableFramedReader() = default;
+
+bool SeekableFramedReader::ReadSeekTable() {
+  entries_.clear();
+  current_chunk_ = 0;
+  if (framed_length_ <
+      kStreamIdentifierSize + kChunkHeaderSize + kSeekTrailerSize) {
+    return false;
+  }
+  if (std::memcmp(framed_, kStreamIdentifier, kStreamIdentifierSize) != 0) {
+    return false;
+  }
+  const char* const end = framed_ + framed_length_;
+  if (std::memcmp(end - kSeekTableMagicSize, kSeekTableMagic,
+                  kSeekTableMagicSize) != 0) {
+    return false;
+  }
+
+  const uint32_t num_entries = LittleEndian::Load32(end - 16);
+  const uint64_t data_length =
+      uint64_t{num_entries} * kSeekEntrySize + kSeekTrailerSize;
+  if (data_length >
+      framed_length_ - kStreamIdentifierSize - kChunkHeaderSize) {
+    return false;
+  }
+  const char* const data = end - data_length;
+  const char* const header = data - kChunkHeaderSize;
+  if (static_cast<uint8_t>(header[0]) != kFramingSeekTableChunkType ||
+      LoadChunkLength(header) != data_length) {
+    return false;
+  }
+  const uint32_t crc = internal::UnmaskCrc32c(LittleEndian::Load32(end - 12));
+  if (internal::Crc32c(data, data_length - 12) != crc) return false;
+
+  // The chunks indexed by the table must lie between the stream identifier
+  // and the table, in order, and cover the uncompressed data without gaps.
+  const uint64_t table_offset = header - framed_;
+  const uint64_t uncompressed_length = LittleEndian::Load64(end - 24);
+  uint64_t next_compressed = kStreamIdentifierSize;
+  uint64_t next_uncompressed = 0;
+  entries_.reserve(num_entries);
+  for (const char* p = data; p < data + num_entries * kSeekEntrySize;
+       p += kSeekEntrySize) {
+    Entry entry;
+    entry.compressed_offset = LittleEndian::Load64(p);
+    entry.uncompressed_offset = LittleEndian::Load64(p + 8);
+    entry.masked_crc = LittleEndian::Load32(p + 16);
+    const bool in_order = entry.compressed_offset >= next_compressed &&
+                          entry.compressed_offset < table_offset &&
+                          entry.uncompressed_offset >= next_uncompressed;
+    const bool contiguous =
+        entries_.empty() ? entry.uncompressed_offset == 0
+                         : entry.uncompressed_offset -
+                                   entries_.back().uncompressed_offset <=
+                               kBlockSize;
+    if (!in_order || !contiguous) {
+      entries_.clear();
+      return false;
+    }
+    next_compressed = entry.compressed_offset + kChunkHeaderSize + 1;
+    next_uncompressed = entry.uncompressed_offset + 1;
+    entries_.push_back(entry);
+  }
+  const bool complete =
+      entries_.empty() ? uncompressed_length == 0
+                       : uncompressed_length >= next_uncompressed &&
+                             uncompressed_length -
+                                     entries_.back().uncompressed_offset <=
+                                 kBlockSize;
+  if (!complete) {
+    entries_.clear();
+    return false;
+  }
+  uncompressed_length_ = uncompressed_length;
+  current_chunk_ = entries_.size();
+  return true;
+}
+
+bool SeekableFramedReader::LoadChunk(size_t index) {
+  if (index == current_chunk_) return true;
+  current_chunk_ = entries_.size();
+
+  const Entry& entry = entries_[index];
+  const uint64_t next_offset = index + 1 < entries_.size()
+                                   ? entries_[index + 1].uncompressed_offset
+                                   : uncompressed_length_;
+  const size_t expected_length =
+      static_cast<size_t>(next_offset - entry.uncompressed_offset);
+
+  const size_t available = framed_length_ - entry.compressed_offset;
+  if (available < kChunkHeaderSize + kChecksumSize) return false;
+  const char* const header = framed_ + entry.compressed_offset;
+  const size_t length = LoadChunkLength(header);
+  if (length < kChecksumSize || length > available - kChunkHeaderSize) {
+    return false;
+  }
+  const uint32_t masked_crc = LittleEndian::Load32(header + kChunkHeaderSize);
+  if (masked_crc != entry.masked_crc) return false;
+  const char* const payload = header + kChunkHeaderSize + kChecksumSize;
+  const size_t payload_length = length - kChecksumSize;
+
+  switch (static_cast<uint8_t>(header[0])) {
+    case kCompressedChunkType: {
+      size_t uncompressed_length;
+      if (!GetUncompressedLength(payload, payload_length,
+                                 &uncompressed_length) ||
+          uncompressed_length != expected_length) {
+        return false;
+      }
+      STLStringResizeUninitialized(&chunk_buffer_, expected_length);
+      if (!RawUncompress(payload, payload_length,
+                         string_as_array(&chunk_buffer_))) {
+        return false;
+      }
+      chunk_data_ = chunk_buffer_.data();
+      break;
+    }
+    case kUncompressedChunkType:
+      if (payload_length != expected_length) return false;
+      chunk_data_ = payload;
+      break;
+    default:
+      return false;
+  }
+  if (internal::Crc32c(chunk_data_, expected_length) !=
+      internal::UnmaskCrc32c(masked_crc)) {
+    return false;
+  }
+  chunk_length_ = expected_length;
+  current_chunk_ = index;
+  return true;
+}
+
+bool SeekableFramedReader::ReadAt(uint64_t offset, size_t n, char* dst) {
+  if (offset > uncompressed_length_ || n > uncompressed_length_ - offset) {
+    return false;
+  }
+  if (n == 0) return true;
+
+  // Find the last chunk starting at or before "offset"; entries_[0] always
+  // starts at 0, so there is one.
+  auto it = std::upper_bound(
+      entries_.begin(), entries_.end(), offset,
+      [](uint64_t value, const Entry& entry) {
+        return value < entry.uncompressed_offset;
+      });
+  size_t index = (it - entries_.begin()) - 1;
+  while (n > 0) {
+    if (!LoadChunk(index)) return false;
+    const size_t chunk_offset =
+        static_cast<size_t>(offset - entries_[index].uncompressed_offset);
+    const size_t to_copy = std::min(n, chunk_length_ - chunk_offset);
+    std::memcpy(dst, chunk_data_ + chunk_offset, to_copy);
+    dst += to_copy;
+    offset += to_copy;
+    n -= to_copy;
+    ++index;
+  }
+  return true;
+}
+
+}  // namespace snappy
@@ -0,0 +1,214 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Support for the Snappy framing format described in framing_format.txt,
+// including an optional seek table chunk that allows random access into a
+// framed stream without decompressing it from the start.
+
+#ifndef THIRD_PARTY_SNAPPY_SNAPPY_FRAMING_H_
+#define THIRD_PARTY_SNAPPY_SNAPPY_FRAMING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace snappy {
+
+class Source;
+class Sink;
+
+namespace internal {
+class WorkingMemory;
+}  // namespace internal
+
+// Chunk type of the seek table chunk, see framing_format.txt, section 4.7.
+// It lies in the reserved skippable range, so decoders that do not know about
+// seek tables simply ignore it.
+static constexpr uint8_t kFramingSeekTableChunkType = 0x99;
+
+// Compresses the bytes read from "*source" into the framing format and
+// appends them to "*sink". If "with_seek_table" is true, a seek table chunk
+// is written at the end of the stream. Returns the number of bytes written.
+size_t CompressFramed(Source* source, Sink* sink, bool with_seek_table);
+
+// Decompresses the framed stream read from "*source" and appends the result
+// to "*sink". Checksums are verified and skippable chunks (including seek
+// tables) are ignored.
+//
+// returns false if the stream is corrupted and could not be decompressed
+bool UncompressFramed(Source* source, Sink* sink);
+
+// Incrementally writes a framed stream to a Sink. Data is buffered until a
+// full 64 KiB chunk is available, so the chunk boundaries do not depend on how
+// the input is split across Append() calls.
+//
+// Example:
+//    FramedWriter writer(&sink, /*with_seek_table=*/true);
+//    writer.Append(data1, n1);
+//    writer.Append(data2, n2);
+//    writer.Finish();
+class FramedWriter {
+ public:
+  FramedWriter(Sink* sink, bool with_seek_table);
+  ~FramedWriter();
+
+  // Appends "data[0,n-1]" to the uncompressed stream.
+  // REQUIRES: Finish() has not been called.
+  void Append(const char* data, size_t n);
+
+  // Emits any buffered data as a (possibly short) chunk.
+  void Flush();
+
+  // Flushes buffered data and writes the seek table, if enabled. Returns the
+  // total number of bytes written to the sink.
+  // REQUIRES: Finish() has not been called.
+  size_t Finish();
+
+ private:
+  struct SeekEntry {
+    uint64_t compressed_offset;
+    uint64_t uncompressed_offset;
+    uint32_t masked_crc;
+  };
+
+  void EmitStreamIdentifier();
+  void EmitChunk(const char* data, size_t n);
+  void EmitSeekTable();
+
+  Sink* const sink_;
+  const bool with_seek_table_;
+  bool finished_;
+  internal::WorkingMemory* const wmem_;
+  // Holds at most kBlockSize bytes of input not yet written as a chunk.
+  std::string pending_;
+  std::string scratch_;
+  uint64_t compressed_bytes_;
+  uint64_t uncompressed_bytes_;
+  std::vector<SeekEntry> seek_table_;
+
+  // No copying
+  FramedWriter(const FramedWriter&);
+  void operator=(const FramedWriter&);
+};
+
+// Incrementally decodes a framed stream that arrives in pieces of any size,
+// such as reads from a socket. Each chunk is decompressed as soon as its
+// last byte has been fed, directly from the caller's buffer when it lies
+// entirely in one piece. Skippable chunks are dropped without buffering.
+//
+// Example:
+//    FramedDecoder decoder;
+//    while (... read data ...) {
+//      if (!decoder.Feed(data, n, &sink)) ... fail ...
+//    }
+//    if (!decoder.Finished()) ... fail: truncated stream ...
+class FramedDecoder {
+ public:
+  FramedDecoder();
+  ~FramedDecoder();
+
+  // Decodes "data[0,n-1]", the next bytes of the stream, appending the
+  // uncompressed data of the chunks they complete to "*sink".
+  //
+  // returns false if the stream is corrupted; all later calls fail as well
+  bool Feed(const char* data, size_t n, Sink* sink);
+
+  // Like Feed(), but returns after the first chunk that is decoded, which
+  // bounds the output of one call to a chunk. Stores the number of bytes of
+  // "data" used in "*consumed".
+  bool Feed(const char* data, size_t n, Sink* sink, size_t* consumed);
+
+  // Returns true if the bytes fed so far form a complete, valid stream,
+  // which is what UncompressFramed() would accept.
+  bool Finished() const;
+
+ private:
+  bool seen_stream_identifier_;
+  bool failed_;
+  // The number of bytes of a skippable chunk that are still to be dropped.
+  size_t skip_;
+  // The header and data received so far of a chunk that is not complete.
+  std::string pending_;
+  std::string output_scratch_;
+
+  // No copying
+  FramedDecoder(const FramedDecoder&);
+  void operator=(const FramedDecoder&);
+};
+
+// Random access reader over a flat framed stream that ends with a seek table
+// chunk. ReadAt() finds the covering chunks with a binary search over the
+// table and decompresses only those chunks. The most recently decompressed
+// chunk is cached, so sequential small reads decompress each chunk once.
+class SeekableFramedReader {
+ public:
+  // "framed[0,n-1]" must outlive the reader.
+  SeekableFramedReader(const char* framed, size_t n);
+  ~SeekableFramedReader();
+
+  // Locates and validates the seek table. Must be called before any other
+  // method. Returns false if the stream has no valid seek table.
+  bool ReadSeekTable();
+
+  uint64_t UncompressedLength() const { return uncompressed_length_; }
+  size_t NumChunks() const { return entries_.size(); }
+
+  // Stores the uncompressed bytes at "[offset, offset+n-1]" in "dst".
+  //
+  // returns false if the range is out of bounds or a chunk is corrupted
+  bool ReadAt(uint64_t offset, size_t n, char* dst);
+
+ private:
+  struct Entry {
+    uint64_t compressed_offset;
+    uint64_t uncompressed_offset;
+    uint32_t masked_crc;
+  };
+
+  // Makes chunk "index" current, decompressing it if needed.
+  bool LoadChunk(size_t index);
+
+  const char* const framed_;
+  const size_t framed_length_;
+  uint64_t uncompressed_length_;
+  std::vector<Entry> entries_;
+  size_t current_chunk_;  // entries_.size() when no chunk is loaded
+  const char* chunk_data_;
+  size_t chunk_length_;
+  std::string chunk_buffer_;
+
+  // No copying
+  SeekableFramedReader(const SeekableFramedReader&);
+  void operator=(const SeekableFramedReader&);
+};
+
+}  // namespace snappy
+
+#endif  // THIRD_PARTY_SNAPPY_SNAPPY_FRAMING_H_
@@ -33,6 +33,8 @@
 
 #include "snappy-stubs-internal.h"
 
+#include <vector>
+
 #if SNAPPY_HAVE_SSSE3
 // Please do not replace with <x86intrin.h> or with headers that assume more
 // advanced SSE versions without checking with all the OWNERS.
@@ -51,6 +53,9 @@
 #endif
 
 namespace snappy {
+
+class Allocator;
+
 namespace internal {
 
 #if SNAPPY_HAVE_VECTOR_BYTE_SHUFFLE
@@ -112,10 +117,11 @@ inline V128 V128_DupChar(char c) { return vdupq_n_u8(c); }
 #endif  // SNAPPY_HAVE_VECTOR_BYTE_SHUFFLE
 
 // Working memory performs a single allocation to hold all scratch space
-// required for compression.
+// required for compression. The memory comes from "*allocator", or from the
+// heap if it is null.
 class WorkingMemory {
  public:
-  explicit WorkingMemory(size_t input_size);
+  explicit WorkingMemory(size_t input_size, Allocator* allocator = nullptr);
   ~WorkingMemory();
 
   // Allocates and clears a hash table using memory in "*this",
@@ -126,11 +132,12 @@ class WorkingMemory {
   char* GetScratchOutput() const { return output_; }
 
  private:
-  char* mem_;        // the allocated memory, never nullptr
-  size_t size_;      // the size of the allocated memory, never 0
-  uint16_t* table_;  // the pointer to the hashtable
-  char* input_;      // the pointer to the input scratch buffer
-  char* output_;     // the pointer to the output scratch buffer
+  char* mem_;             // the allocated memory, never nullptr
+  size_t size_;           // the size of the allocated memory, never 0
+  uint16_t* table_;       // the pointer to the hashtable
+  char* input_;           // the pointer to the input scratch buffer
+  char* output_;          // the pointer to the output scratch buffer
+  Allocator* allocator_;  // where "mem_" came from, or null for the heap
 
   // No copying
   WorkingMemory(const WorkingMemory&);
@@ -154,6 +161,44 @@ char* CompressFragment(const char* input,
                        uint16_t* table,
                        const int table_size);
 
+// A point where ParallelRawUncompress() can split decoding: the offset of a
+// tag in the compressed buffer and the number of bytes produced before it.
+struct SegmentBoundary {
+  size_t compressed_offset;
+  size_t uncompressed_offset;
+};
+
+// Scans the tags in "[ip, ip_limit)" without producing any output, and stores
+// in "*boundaries" the tag starts at multiples of "segment_size" bytes of
+// output that no later copy reaches back across. Decoding can restart at any
+// of them with a fresh SnappyArrayWriter whose base is the boundary.
+//
+// Returns false if the tags do not decode to exactly "uncompressed_len"
+// bytes; the caller should then let the regular decoder report the error.
+bool FindSegmentBoundaries(const char* ip_start, const char* ip_limit,
+                           size_t uncompressed_len, size_t segment_size,
+                           std::vector<SegmentBoundary>* boundaries);
+
+// Returns the CRC-32C (Castagnoli) of "data[0, n-1]", continuing from the
+// CRC-32C "crc" of some preceding data. Pass 0 as "crc" to start a new
+// checksum. Uses the SSE4.2 / ARMv8 CRC instructions when they are available.
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t n);
+
+inline uint32_t Crc32c(const char* data, size_t n) {
+  return Crc32cExtend(0, data, n);
+}
+
+// Masks a CRC-32C as described in framing_format.txt, section 3.
+inline uint32_t MaskCrc32c(uint32_t crc) {
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8u;
+}
+
+// Reverses MaskCrc32c().
+inline uint32_t UnmaskCrc32c(uint32_t masked_crc) {
+  const uint32_t rotated = masked_crc - 0xa282ead8u;
+  return (rotated >> 17) | (rotated << 15);
+}
+
 // Find the largest n such that
 //
 //   s1[0,n-1] == s2[0,n-1]
@@ -26,10 +26,29 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stddef.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstring>
 
+#if HAVE_UNISTD_H
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // HAVE_UNISTD_H
+
+#if HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif  // HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H
+
 #include "snappy-sinksource.h"
+#include "snappy-stubs-internal.h"
 
 namespace snappy {
 
@@ -118,4 +137,447 @@ char* UncheckedByteArraySink::GetAppendBufferVariable(
   return dest_;
 }
 
+StringSink::StringSink(std::string* dest) : dest_(dest), size_(dest->size()) {}
+
+StringSink::~StringSink() { dest_->resize(size_); }
+
+char* StringSink::Extend(size_t n) {
+  const size_t needed = size_ + n;
+  if (dest_->capacity() < needed) {
+    dest_->reserve(std::max(needed, 2 * dest_->capacity()));
+  }
+  // The caller overwrites the new bytes, so they need not be zeroed.
+  STLStringResizeUninitialized(dest_, needed);
+  return &(*dest_)[size_];
+}
+
+void StringSink::Append(const char* bytes, size_t n) {
+  // Do no copying if the caller filled in the result of GetAppendBuffer*().
+  if (dest_->size() > size_ && bytes == &(*dest_)[size_]) {
+    size_ += n;
+    STLStringResizeUninitialized(dest_, size_);
+    return;
+  }
+  std::memcpy(Extend(n), bytes, n);
+  size_ += n;
+}
+
+char* StringSink::GetAppendBuffer(size_t length, char* scratch) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)scratch;
+
+  return Extend(length);
+}
+
+char* StringSink::GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)scratch;
+  (void)scratch_size;
+
+  *allocated_size = std::max(min_size, desired_size_hint);
+  return Extend(*allocated_size);
+}
+
+constexpr size_t RopeSink::kDefaultBlockSize;
+
+RopeSink::RopeSink(size_t block_size)
+    : block_size_(block_size), tail_capacity_(0), size_(0) {}
+
+RopeSink::~RopeSink() {
+  for (const Piece& piece : pieces_) {
+    (*piece.deleter)(piece.deleter_arg, piece.data, piece.size);
+  }
+}
+
+void RopeSink::DeleteTail(void* arg, const char* bytes, size_t size) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)arg;
+  (void)size;
+
+  delete[] bytes;
+}
+
+size_t RopeSink::TailRoom() const {
+  if (pieces_.empty() || pieces_.back().deleter != &RopeSink::DeleteTail) {
+    return 0;
+  }
+  return tail_capacity_ - pieces_.back().size;
+}
+
+void RopeSink::NewTail(size_t n) {
+  // Replace an owned piece that is still empty instead of keeping it around.
+  if (TailRoom() > 0 && pieces_.back().size == 0) {
+    delete[] pieces_.back().data;
+    pieces_.pop_back();
+  }
+  tail_capacity_ = std::max(n, block_size_);
+  Piece piece = {new char[tail_capacity_], 0, &RopeSink::DeleteTail, nullptr};
+  pieces_.push_back(piece);
+}
+
+void RopeSink::Append(const char* bytes, size_t n) {
+  size_ += n;
+  // Do no copying if the caller filled in the result of GetAppendBuffer*().
+  if (TailRoom() > 0) {
+    Piece& tail = pieces_.back();
+    if (bytes == tail.data + tail.size) {
+      tail.size += n;
+      return;
+    }
+  }
+  while (n > 0) {
+    if (TailRoom() == 0) NewTail(n);
+    Piece& tail = pieces_.back();
+    const size_t to_copy = std::min(n, tail_capacity_ - tail.size);
+    std::memcpy(const_cast<char*>(tail.data) + tail.size, bytes, to_copy);
+    tail.size += to_copy;
+    bytes += to_copy;
+    n -= to_copy;
+  }
+}
+
+char* RopeSink::GetAppendBuffer(size_t length, char* scratch) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)scratch;
+
+  if (TailRoom() < length) NewTail(length);
+  const Piece& tail = pieces_.back();
+  return const_cast<char*>(tail.data) + tail.size;
+}
+
+void RopeSink::AppendAndTakeOwnership(
+    char* bytes, size_t n,
+    void (*deleter)(void*, const char*, size_t),
+    void *deleter_arg) {
+  Piece piece = {bytes, n, deleter, deleter_arg};
+  pieces_.push_back(piece);
+  size_ += n;
+}
+
+char* RopeSink::GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) {
+  // A caller that wants more than a block is better off handing over its own
+  // blocks with AppendAndTakeOwnership(); Uncompress() does so when it gets
+  // less than it asked for.
+  if (desired_size_hint > block_size_ && scratch_size >= min_size &&
+      TailRoom() < desired_size_hint) {
+    *allocated_size = scratch_size;
+    return scratch;
+  }
+  const size_t wanted = std::max(min_size, desired_size_hint);
+  if (TailRoom() < wanted) NewTail(wanted);
+  const Piece& tail = pieces_.back();
+  *allocated_size = tail_capacity_ - tail.size;
+  return const_cast<char*>(tail.data) + tail.size;
+}
+
+void RopeSink::CopyTo(char* dest) const {
+  for (const Piece& piece : pieces_) {
+    std::memcpy(dest, piece.data, piece.size);
+    dest += piece.size;
+  }
+}
+
+constexpr size_t FileSource::kDefaultBufferSize;
+constexpr size_t FileSink::kDefaultBufferSize;
+
+#if HAVE_UNISTD_H
+
+namespace {
+
+constexpr size_t kBufferAlignment = 4096;
+
+char* AlignBuffer(char* p) {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+  return p + (-address & (kBufferAlignment - 1));
+}
+
+}  // namespace
+
+FileSource::FileSource(int fd, size_t buffer_size)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      allocated_(new char[buffer_size + kBufferAlignment]),
+      buffer_(AlignBuffer(allocated_)),
+      begin_(0),
+      end_(0),
+      left_(0),
+      ok_(true) {
+  struct stat st;
+  const off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (fstat(fd, &st) != 0 || offset < 0 || st.st_size < offset) {
+    ok_ = false;
+    return;
+  }
+  left_ = static_cast<size_t>(st.st_size - offset);
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+FileSource::~FileSource() { delete[] allocated_; }
+
+size_t FileSource::Available() const { return left_; }
+
+const char* FileSource::Peek(size_t* len) {
+  if (begin_ == end_ && left_ > 0) {
+    begin_ = end_ = 0;
+    const size_t to_read = std::min(left_, buffer_size_);
+    while (end_ < to_read) {
+      const ssize_t n = read(fd_, buffer_ + end_, to_read - end_);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        // A read error, or the file shrank: end the source here.
+        ok_ = false;
+        left_ = end_;
+        break;
+      }
+      end_ += static_cast<size_t>(n);
+    }
+  }
+  *len = end_ - begin_;
+  return buffer_ + begin_;
+}
+
+void FileSource::Skip(size_t n) {
+  left_ -= n;
+  const size_t buffered = end_ - begin_;
+  if (n <= buffered) {
+    begin_ += n;
+    return;
+  }
+  begin_ = end_ = 0;
+  if (lseek(fd_, static_cast<off_t>(n - buffered), SEEK_CUR) < 0) {
+    ok_ = false;
+    left_ = 0;
+  }
+}
+
+FileSink::FileSink(int fd, size_t buffer_size)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      allocated_(new char[buffer_size + kBufferAlignment]),
+      buffer_(AlignBuffer(allocated_)),
+      used_(0),
+      ok_(true) {}
+
+FileSink::~FileSink() {
+  Flush();
+  delete[] allocated_;
+}
+
+void FileSink::Append(const char* bytes, size_t n) {
+  // Do no copying if the caller filled in the result of GetAppendBuffer()
+  if (bytes == buffer_ + used_) {
+    used_ += n;
+    return;
+  }
+  if (n > buffer_size_ - used_) {
+    Flush();
+    if (n >= buffer_size_) {
+      Write(bytes, n);
+      return;
+    }
+  }
+  std::memcpy(buffer_ + used_, bytes, n);
+  used_ += n;
+}
+
+char* FileSink::GetAppendBuffer(size_t length, char* scratch) {
+  if (length > buffer_size_ - used_) {
+    if (length > buffer_size_) return scratch;
+    Flush();
+  }
+  return buffer_ + used_;
+}
+
+char* FileSink::GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)desired_size_hint;
+
+  if (min_size > buffer_size_ - used_) {
+    if (min_size > buffer_size_) {
+      *allocated_size = scratch_size;
+      return scratch;
+    }
+    Flush();
+  }
+  *allocated_size = buffer_size_ - used_;
+  return buffer_ + used_;
+}
+
+bool FileSink::Flush() {
+  Write(buffer_, used_);
+  used_ = 0;
+  return ok_;
+}
+
+void FileSink::Write(const char* data, size_t n) {
+  while (n > 0 && ok_) {
+    const ssize_t written = write(fd_, data, n);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) {
+      ok_ = false;
+      break;
+    }
+    data += written;
+    n -= static_cast<size_t>(written);
+  }
+}
+
+#else  // HAVE_UNISTD_H
+
+// Without file descriptors to read or write, the source is empty and the sink
+// drops its data, and both report an error.
+
+FileSource::FileSource(int fd, size_t buffer_size)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      allocated_(nullptr),
+      buffer_(nullptr),
+      begin_(0),
+      end_(0),
+      left_(0),
+      ok_(false) {}
+
+FileSource::~FileSource() = default;
+
+size_t FileSource::Available() const { return 0; }
+
+const char* FileSource::Peek(size_t* len) {
+  *len = 0;
+  return nullptr;
+}
+
+void FileSource::Skip(size_t n) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)n;
+}
+
+FileSink::FileSink(int fd, size_t buffer_size)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      allocated_(nullptr),
+      buffer_(nullptr),
+      used_(0),
+      ok_(false) {}
+
+FileSink::~FileSink() = default;
+
+void FileSink::Append(const char* bytes, size_t n) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)bytes;
+  (void)n;
+}
+
+char* FileSink::GetAppendBuffer(size_t length, char* scratch) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)length;
+
+  return scratch;
+}
+
+char* FileSink::GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)min_size;
+  (void)desired_size_hint;
+
+  *allocated_size = scratch_size;
+  return scratch;
+}
+
+bool FileSink::Flush() { return false; }
+
+void FileSink::Write(const char* data, size_t n) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)data;
+  (void)n;
+}
+
+#endif  // HAVE_UNISTD_H
+
+#if HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+
+MmapSource::MmapSource(int fd, bool populate)
+    : mapping_(nullptr), mapping_size_(0), ptr_(nullptr), left_(0), ok_(true) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ok_ = false;
+    return;
+  }
+  // mmap() rejects empty mappings.
+  if (st.st_size == 0) return;
+  int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+  if (populate) flags |= MAP_POPULATE;
+#else
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)populate;
+#endif  // defined(MAP_POPULATE)
+  void* mapping =
+      mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, flags, fd, 0);
+  if (mapping == MAP_FAILED) {
+    ok_ = false;
+    return;
+  }
+  mapping_ = static_cast<char*>(mapping);
+  mapping_size_ = static_cast<size_t>(st.st_size);
+  ptr_ = mapping_;
+  left_ = mapping_size_;
+  madvise(mapping_, mapping_size_, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+  madvise(mapping_, mapping_size_, MADV_HUGEPAGE);
+#endif  // defined(MADV_HUGEPAGE)
+}
+
+MmapSource::~MmapSource() {
+  if (mapping_ != nullptr) munmap(mapping_, mapping_size_);
+}
+
+size_t MmapSource::Available() const { return left_; }
+
+const char* MmapSource::Peek(size_t* len) {
+  *len = left_;
+  return ptr_;
+}
+
+void MmapSource::Skip(size_t n) {
+  left_ -= n;
+  ptr_ += n;
+}
+
+#else  // HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+
+// Without mmap(), no file can be mapped.
+
+MmapSource::MmapSource(int fd, bool populate)
+    : mapping_(nullptr), mapping_size_(0), ptr_(nullptr), left_(0), ok_(false) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)fd;
+  (void)populate;
+}
+
+MmapSource::~MmapSource() = default;
+
+size_t MmapSource::Available() const { return 0; }
+
+const char* MmapSource::Peek(size_t* len) {
+  *len = 0;
+  return nullptr;
+}
+
+void MmapSource::Skip(size_t n) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)n;
+}
+
+#endif  // HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H && HAVE_UNISTD_H
+
 }  // namespace snappy
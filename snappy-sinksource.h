@@ -31,6 +31,9 @@
 
 #include <stddef.h>
 
+#include <string>
+#include <vector>
+
 namespace snappy {
 
 // A Sink is an interface that consumes a sequence of bytes.
@@ -177,6 +180,189 @@ class UncheckedByteArraySink : public Sink {
   char* dest_;
 };
 
+// A Sink that appends to a std::string, growing it geometrically.
+// GetAppendBuffer() and GetAppendBufferVariable() return space at the end of
+// the string itself, so compression and decompression write straight into it.
+// Between such a call and the following Append(), the string holds
+// uninitialized bytes past the appended data; otherwise its size is exactly
+// what was appended.
+class StringSink : public Sink {
+ public:
+  explicit StringSink(std::string* dest);
+  ~StringSink() override;
+  void Append(const char* bytes, size_t n) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+  char* GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) override;
+
+ private:
+  // Makes room for "n" bytes after the appended data and returns them.
+  char* Extend(size_t n);
+
+  std::string* dest_;
+  size_t size_;  // the number of bytes of "*dest_" that were appended
+};
+
+// A Sink that keeps the appended data as a chain of flat pieces instead of
+// one contiguous buffer. AppendAndTakeOwnership() adopts the given buffer as
+// a piece without copying it; in particular, Uncompress(Source*, Sink*)
+// hands over its kBlockSize output blocks this way instead of copying them
+// into a flat buffer. Other appends are copied into pieces of at least
+// "block_size" bytes owned by the sink, which GetAppendBuffer() and
+// GetAppendBufferVariable() also hand out.
+//
+// The pieces are released when the sink is destroyed.
+class RopeSink : public Sink {
+ public:
+  static constexpr size_t kDefaultBlockSize = 1 << 16;
+
+  explicit RopeSink(size_t block_size = kDefaultBlockSize);
+  ~RopeSink() override;
+  void Append(const char* bytes, size_t n) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+  void AppendAndTakeOwnership(
+      char* bytes, size_t n, void (*deleter)(void*, const char*, size_t),
+      void *deleter_arg) override;
+  char* GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) override;
+
+  // The total number of bytes appended.
+  size_t size() const { return size_; }
+
+  // The pieces holding the appended bytes, in order. Pieces may be empty.
+  size_t num_pieces() const { return pieces_.size(); }
+  const char* piece_data(size_t i) const { return pieces_[i].data; }
+  size_t piece_size(size_t i) const { return pieces_[i].size; }
+
+  // Copies the appended bytes to "dest[0..size()-1]".
+  void CopyTo(char* dest) const;
+
+ private:
+  struct Piece {
+    const char* data;
+    size_t size;
+    void (*deleter)(void*, const char*, size_t);
+    void* deleter_arg;
+  };
+
+  // Returns the number of bytes left in the last piece if the sink owns
+  // it, and 0 otherwise.
+  size_t TailRoom() const;
+  // Starts a piece owned by the sink with room for at least "n" bytes.
+  void NewTail(size_t n);
+  static void DeleteTail(void* arg, const char* bytes, size_t size);
+
+  const size_t block_size_;
+  std::vector<Piece> pieces_;
+  size_t tail_capacity_;  // the capacity of the last piece, if owned
+  size_t size_;
+};
+
+// A Source that reads a POSIX file descriptor through a large buffer. The
+// buffer is page-aligned, and the kernel is told that the file is read
+// sequentially so it can read ahead aggressively.
+//
+// "fd" must refer to a regular file; it is read from its current offset to
+// the end of the file as of construction, which is what Available() reports.
+// The descriptor is not closed. If a read fails, the source ends early and
+// ok() returns false; decompression then fails as for truncated data.
+//
+// On platforms without <unistd.h>, the source is empty and ok() returns false.
+class FileSource : public Source {
+ public:
+  static constexpr size_t kDefaultBufferSize = 1 << 20;
+
+  explicit FileSource(int fd, size_t buffer_size = kDefaultBufferSize);
+  ~FileSource() override;
+  size_t Available() const override;
+  const char* Peek(size_t* len) override;
+  void Skip(size_t n) override;
+
+  // Returns false if a read error occurred.
+  bool ok() const { return ok_; }
+
+ private:
+  const int fd_;
+  const size_t buffer_size_;
+  char* const allocated_;
+  char* const buffer_;  // page-aligned, within allocated_
+  size_t begin_;        // unread bytes are in buffer_[begin_..end_-1]
+  size_t end_;
+  size_t left_;         // bytes left to read, including buffered ones
+  bool ok_;
+};
+
+// A Source over a read-only memory mapping of a whole file. Peek() returns all
+// of the remaining data, so it is read straight from the page cache without
+// being copied, and consumers such as Compress() never have to gather input
+// into a scratch buffer. The kernel is told that the mapping is read
+// sequentially and, where supported, that it may use huge pages for it. With
+// "populate", the whole file is faulted in up front (MAP_POPULATE) instead of
+// page by page while it is read.
+//
+// "fd" must refer to a regular file; it may be closed once the source is
+// constructed. If the file cannot be mapped, the source is empty and ok()
+// returns false, as it always does on platforms without mmap().
+class MmapSource : public Source {
+ public:
+  explicit MmapSource(int fd, bool populate = false);
+  ~MmapSource() override;
+  size_t Available() const override;
+  const char* Peek(size_t* len) override;
+  void Skip(size_t n) override;
+
+  // Returns false if the file could not be mapped.
+  bool ok() const { return ok_; }
+
+ private:
+  char* mapping_;
+  size_t mapping_size_;
+  const char* ptr_;
+  size_t left_;
+  bool ok_;
+};
+
+// A Sink that writes to a POSIX file descriptor through a large page-aligned
+// buffer. GetAppendBuffer() and GetAppendBufferVariable() hand out space in
+// the buffer itself, so compressed and uncompressed data is written to it
+// directly instead of being copied in.
+//
+// Buffered data is written by Flush() and by the destructor. The descriptor
+// is not closed. Write errors are sticky and reported by ok() and Flush().
+//
+// On platforms without <unistd.h>, the data is dropped and ok() returns false.
+class FileSink : public Sink {
+ public:
+  static constexpr size_t kDefaultBufferSize = 1 << 20;
+
+  explicit FileSink(int fd, size_t buffer_size = kDefaultBufferSize);
+  ~FileSink() override;
+  void Append(const char* bytes, size_t n) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+  char* GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) override;
+
+  // Writes the buffered data to the file. Returns false if this or any
+  // earlier write failed.
+  bool Flush();
+
+  // Returns false if a write error occurred.
+  bool ok() const { return ok_; }
+
+ private:
+  void Write(const char* data, size_t n);
+
+  const int fd_;
+  const size_t buffer_size_;
+  char* const allocated_;
+  char* const buffer_;  // page-aligned, within allocated_
+  size_t used_;
+  bool ok_;
+};
+
 }  // namespace snappy
 
 #endif  // THIRD_PARTY_SNAPPY_SNAPPY_SINKSOURCE_H_
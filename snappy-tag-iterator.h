@@ -0,0 +1,377 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Header-only, allocation-free iteration over the elements (literals and
+// copies) of compressed data, for tools that inspect compressed data without
+// decompressing it: match statistics, decode cost estimates, indexing, or
+// locating corruption.
+
+#ifndef THIRD_PARTY_SNAPPY_SNAPPY_TAG_ITERATOR_H_
+#define THIRD_PARTY_SNAPPY_SNAPPY_TAG_ITERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace snappy {
+
+// One element of compressed data, as produced by CompressedTagIterator.
+struct CompressedTag {
+  // True for a literal, false for a copy of earlier output.
+  bool is_literal;
+  // Position of the element's tag byte in the compressed data, and the number
+  // of compressed bytes it occupies, including any literal bytes.
+  size_t compressed_offset;
+  size_t compressed_length;
+  // Position in the uncompressed data of the first byte the element produces,
+  // and the number of bytes it produces.
+  size_t uncompressed_offset;
+  size_t length;
+  // For literals, the literal bytes, which point into the compressed data.
+  // Null for copies.
+  const char* literal;
+  // For copies, the distance from "uncompressed_offset" back to the first
+  // copied byte. Copies may overlap their own output (length > copy_offset).
+  // Zero for literals.
+  size_t copy_offset;
+};
+
+namespace internal {
+
+// Returns the 4 bytes at "p" as a little-endian integer. Compilers turn this
+// into a single load on little-endian machines.
+inline uint32_t LoadLittleEndian32(const uint8_t* p) {
+  return uint32_t{p[0]} | uint32_t{p[1]} << 8 | uint32_t{p[2]} << 16 |
+         uint32_t{p[3]} << 24;
+}
+
+// Returns the "n" (1..4) bytes at "p" as a little-endian integer.
+inline uint32_t LoadLittleEndianBytes(const uint8_t* p, size_t n) {
+  uint32_t result = 0;
+  for (size_t i = 0; i < n; ++i) result |= uint32_t{p[i]} << (8 * i);
+  return result;
+}
+
+// Parses the varint uncompressed length at the start of compressed data in
+// "[*ip, ip_limit)" and advances "*ip" past it. The length is at most 5 bytes
+// and must fit in 32 bits.
+inline bool ParseUncompressedLength(const uint8_t** ip,
+                                    const uint8_t* ip_limit,
+                                    uint32_t* result) {
+  const uint8_t* p = *ip;
+  uint32_t length = 0;
+  for (uint32_t shift = 0;; shift += 7) {
+    if (shift >= 32 || p == ip_limit) return false;
+    const uint32_t byte = *p++;
+    const uint32_t value = byte & 0x7f;
+    if (shift > 0 && (value >> (32 - shift)) != 0) return false;
+    length |= value << shift;
+    if (byte < 128) break;
+  }
+  *ip = p;
+  *result = length;
+  return true;
+}
+
+// Decoding data for each tag byte, the same as char_table in
+// snappy-internal.h: the low byte is the length (1 for long literals, whose
+// length minus 1 follows the tag), bits 8-10 are the high bits of the offset
+// of copies with a 1-byte offset, and bits 11-13 are the number of bytes
+// following the tag, not counting literal bytes. A class template lets the
+// table be defined in this header.
+template <typename T = void>
+struct TagTable {
+  static const uint16_t kEntries[256];
+  // Masks for 0 to 4 bytes following the tag.
+  static const uint32_t kTrailerMasks[5];
+};
+
+template <typename T>
+const uint16_t TagTable<T>::kEntries[256] = {
+    // clang-format off
+    0x0001, 0x0804, 0x1001, 0x2001, 0x0002, 0x0805, 0x1002, 0x2002,
+    0x0003, 0x0806, 0x1003, 0x2003, 0x0004, 0x0807, 0x1004, 0x2004,
+    0x0005, 0x0808, 0x1005, 0x2005, 0x0006, 0x0809, 0x1006, 0x2006,
+    0x0007, 0x080a, 0x1007, 0x2007, 0x0008, 0x080b, 0x1008, 0x2008,
+    0x0009, 0x0904, 0x1009, 0x2009, 0x000a, 0x0905, 0x100a, 0x200a,
+    0x000b, 0x0906, 0x100b, 0x200b, 0x000c, 0x0907, 0x100c, 0x200c,
+    0x000d, 0x0908, 0x100d, 0x200d, 0x000e, 0x0909, 0x100e, 0x200e,
+    0x000f, 0x090a, 0x100f, 0x200f, 0x0010, 0x090b, 0x1010, 0x2010,
+    0x0011, 0x0a04, 0x1011, 0x2011, 0x0012, 0x0a05, 0x1012, 0x2012,
+    0x0013, 0x0a06, 0x1013, 0x2013, 0x0014, 0x0a07, 0x1014, 0x2014,
+    0x0015, 0x0a08, 0x1015, 0x2015, 0x0016, 0x0a09, 0x1016, 0x2016,
+    0x0017, 0x0a0a, 0x1017, 0x2017, 0x0018, 0x0a0b, 0x1018, 0x2018,
+    0x0019, 0x0b04, 0x1019, 0x2019, 0x001a, 0x0b05, 0x101a, 0x201a,
+    0x001b, 0x0b06, 0x101b, 0x201b, 0x001c, 0x0b07, 0x101c, 0x201c,
+    0x001d, 0x0b08, 0x101d, 0x201d, 0x001e, 0x0b09, 0x101e, 0x201e,
+    0x001f, 0x0b0a, 0x101f, 0x201f, 0x0020, 0x0b0b, 0x1020, 0x2020,
+    0x0021, 0x0c04, 0x1021, 0x2021, 0x0022, 0x0c05, 0x1022, 0x2022,
+    0x0023, 0x0c06, 0x1023, 0x2023, 0x0024, 0x0c07, 0x1024, 0x2024,
+    0x0025, 0x0c08, 0x1025, 0x2025, 0x0026, 0x0c09, 0x1026, 0x2026,
+    0x0027, 0x0c0a, 0x1027, 0x2027, 0x0028, 0x0c0b, 0x1028, 0x2028,
+    0x0029, 0x0d04, 0x1029, 0x2029, 0x002a, 0x0d05, 0x102a, 0x202a,
+    0x002b, 0x0d06, 0x102b, 0x202b, 0x002c, 0x0d07, 0x102c, 0x202c,
+    0x002d, 0x0d08, 0x102d, 0x202d, 0x002e, 0x0d09, 0x102e, 0x202e,
+    0x002f, 0x0d0a, 0x102f, 0x202f, 0x0030, 0x0d0b, 0x1030, 0x2030,
+    0x0031, 0x0e04, 0x1031, 0x2031, 0x0032, 0x0e05, 0x1032, 0x2032,
+    0x0033, 0x0e06, 0x1033, 0x2033, 0x0034, 0x0e07, 0x1034, 0x2034,
+    0x0035, 0x0e08, 0x1035, 0x2035, 0x0036, 0x0e09, 0x1036, 0x2036,
+    0x0037, 0x0e0a, 0x1037, 0x2037, 0x0038, 0x0e0b, 0x1038, 0x2038,
+    0x0039, 0x0f04, 0x1039, 0x2039, 0x003a, 0x0f05, 0x103a, 0x203a,
+    0x003b, 0x0f06, 0x103b, 0x203b, 0x003c, 0x0f07, 0x103c, 0x203c,
+    0x0801, 0x0f08, 0x103d, 0x203d, 0x1001, 0x0f09, 0x103e, 0x203e,
+    0x1801, 0x0f0a, 0x103f, 0x203f, 0x2001, 0x0f0b, 0x1040, 0x2040,
+    // clang-format on
+};
+
+template <typename T>
+const uint32_t TagTable<T>::kTrailerMasks[5] = {0, 0xff, 0xffff, 0xffffff,
+                                                0xffffffff};
+
+// The slow path of DecodeTag(), for the last 4 bytes of the input: decodes
+// like the fast path, but reads only as many bytes as the tag has.
+inline const uint8_t* DecodeTagSlow(const uint8_t* ip, const uint8_t* ip_limit,
+                                    bool* is_literal, size_t* length,
+                                    size_t* copy_offset) {
+  const uint8_t c = *ip++;
+  const uint16_t entry = TagTable<>::kEntries[c];
+  const size_t trailer_length = entry >> 11;
+  if (static_cast<size_t>(ip_limit - ip) < trailer_length) return nullptr;
+  const uint32_t trailer = LoadLittleEndianBytes(ip, trailer_length);
+  ip += trailer_length;
+  *is_literal = (c & 3) == 0;
+  if (*is_literal) {
+    // Computed in 64 bits, since a length of 2^32 wraps around in a 32-bit
+    // size_t.
+    const uint64_t literal_length = (entry & 0xff) + uint64_t{trailer};
+    *length = static_cast<size_t>(literal_length);
+    *copy_offset = 0;
+    if (static_cast<uint64_t>(ip_limit - ip) < literal_length) return nullptr;
+    return ip + *length;
+  }
+  *length = entry & 0xff;
+  *copy_offset = (entry & 0x700) + trailer;
+  return ip;
+}
+
+// Decodes the element whose tag byte is at "ip", which must be below
+// "ip_limit". Stores its kind, the number of bytes it produces and, for
+// copies, its offset. Returns a pointer just past the element (past the
+// literal bytes for literals, which end at the returned pointer), or null if
+// the element extends past "ip_limit".
+inline const uint8_t* DecodeTag(const uint8_t* ip, const uint8_t* ip_limit,
+                                bool* is_literal, size_t* length,
+                                size_t* copy_offset) {
+  const size_t available = ip_limit - ip;
+  if (available > 4) {
+    // The longest possible trailer is readable, so it is loaded
+    // unconditionally, and the element is decoded from the table without
+    // branching on its type, whose sequence is hard to predict.
+    const uint8_t c = ip[0];
+    const uint16_t entry = TagTable<>::kEntries[c];
+    const size_t trailer_length = entry >> 11;
+    const uint32_t trailer = LoadLittleEndian32(ip + 1) &
+                             TagTable<>::kTrailerMasks[trailer_length];
+    // All ones for literals, all zeros for copies.
+    const uint64_t literal_mask = uint64_t{0} - ((c & 3) == 0);
+    // The trailer of a literal is its length minus 1, if it has one. The
+    // sums are computed in 64 bits, since a literal length of 2^32 wraps
+    // around in a 32-bit size_t; they fit again once checked against the
+    // input.
+    const uint64_t element_length = (entry & 0xff) + (trailer & literal_mask);
+    const uint64_t advance =
+        1 + trailer_length + (element_length & literal_mask);
+    *is_literal = literal_mask != 0;
+    *length = static_cast<size_t>(element_length);
+    *copy_offset = ((entry & 0x700) + size_t{trailer}) &
+                   ~static_cast<size_t>(literal_mask);
+    return advance <= available ? ip + advance : nullptr;
+  }
+  return DecodeTagSlow(ip, ip_limit, is_literal, length, copy_offset);
+}
+
+}  // namespace internal
+
+// Iterates over the elements of compressed data produced by
+// snappy::Compress(), in order, without decompressing it or allocating
+// memory. The iterator validates the data as it goes, exactly like
+// IsValidCompressedBuffer(): it stops at the first element that is truncated,
+// copies from before the start of the output, or produces more bytes than the
+// header announces.
+//
+//   snappy::CompressedTagIterator it(compressed, compressed_length);
+//   snappy::CompressedTag tag;
+//   while (it.Next(&tag)) { ... }
+//   if (!it.done()) { /* corrupt at it.compressed_offset() */ }
+//
+// The compressed data must outlive the iterator.
+class CompressedTagIterator {
+ public:
+  CompressedTagIterator(const char* compressed, size_t compressed_length)
+      : begin_(reinterpret_cast<const uint8_t*>(compressed)),
+        ip_(begin_),
+        ip_limit_(begin_ + compressed_length),
+        uncompressed_length_(0),
+        produced_(0),
+        ok_(internal::ParseUncompressedLength(&ip_, ip_limit_,
+                                              &uncompressed_length_)),
+        preload_(ip_ < ip_limit_ ? *ip_ : 0) {}
+
+  // The uncompressed length stored in the header of the compressed data.
+  uint32_t uncompressed_length() const { return uncompressed_length_; }
+
+  // Stores the next element in "*tag" and returns true. Returns false at the
+  // end of the data or at the first corrupt element.
+  bool Next(CompressedTag* tag) {
+    if (!ok_ || ip_ == ip_limit_) return false;
+    const size_t available = ip_limit_ - ip_;
+    if (available <= 4) return NextSlow(tag);
+
+    // Like the validator in snappy.cc: the tag byte was loaded by the previous
+    // call, the 4 bytes after it are loaded unconditionally, and the table
+    // gives the length and offset of copies without decoding the tag.
+    const uint8_t c = preload_;
+    const uint32_t word = internal::LoadLittleEndian32(ip_ + 1);
+    if ((c & 3) == 0) {
+      size_t length = (c >> 2) + 1;
+      size_t header_length = 1;
+      if (length > 60) {
+        // A long literal, whose length minus 1 follows the tag.
+        const size_t length_length = length - 60;
+        const uint32_t mask =
+            internal::TagTable<>::kTrailerMasks[length_length];
+        header_length += length_length;
+        // Checked against the input before adding 1, which wraps around for
+        // 0xffffffff in a 32-bit size_t.
+        const size_t length_minus_1 = word & mask;
+        if (length_minus_1 >= available - header_length) {
+          ok_ = false;
+          return false;
+        }
+        length = length_minus_1 + 1;
+      }
+      const size_t advance = header_length + length;
+      if (advance > available || uncompressed_length_ - produced_ < length) {
+        ok_ = false;
+        return false;
+      }
+      Fill(tag, true, advance, length, 0);
+      tag->literal = reinterpret_cast<const char*>(ip_ + header_length);
+      ip_ += advance;
+      preload_ = ip_ < ip_limit_ ? *ip_ : 0;
+      return true;
+    }
+
+    const uint16_t entry = internal::TagTable<>::kEntries[c];
+    const size_t trailer_length = entry >> 11;
+    const uint32_t trailer =
+        word & internal::TagTable<>::kTrailerMasks[trailer_length];
+    const size_t length = entry & 0xff;
+    const size_t copy_offset = (entry & 0x700) + size_t{trailer};
+    // A copy offset of 0 wraps around and fails the second check.
+    if ((uncompressed_length_ - produced_ < length) |
+        (copy_offset - 1 >= produced_)) {
+      ok_ = false;
+      return false;
+    }
+    Fill(tag, false, 1 + trailer_length, length, copy_offset);
+    tag->literal = nullptr;
+    if ((c & 3) != 3) {
+      // The next tag is within the 4 bytes already loaded. Taking it from
+      // there, and the trailer length from the tag rather than the table,
+      // keeps memory loads off the chain from one tag to the next.
+      ip_ += 1 + (c & 3);
+      preload_ = static_cast<uint8_t>(word >> (8 * (c & 3)));
+    } else {
+      ip_ += 5;
+      preload_ = ip_ < ip_limit_ ? *ip_ : 0;
+    }
+    return true;
+  }
+
+  // Returns true iff Next() has visited every element and the data is valid.
+  bool done() const {
+    return ok_ && ip_ == ip_limit_ && produced_ == uncompressed_length_;
+  }
+
+  // Returns false once corruption was found, including a corrupt header.
+  bool ok() const { return ok_; }
+
+  // The position in the compressed data of the next element, or of the
+  // corrupt element once ok() is false.
+  size_t compressed_offset() const { return ip_ - begin_; }
+
+  // The number of uncompressed bytes produced by the elements visited so far.
+  size_t uncompressed_offset() const { return produced_; }
+
+ private:
+  const uint8_t* const begin_;
+  const uint8_t* ip_;
+  const uint8_t* const ip_limit_;
+  uint32_t uncompressed_length_;
+  size_t produced_;
+  bool ok_;
+  // The tag byte at "ip_", if any.
+  uint8_t preload_;
+
+  void Fill(CompressedTag* tag, bool is_literal, size_t compressed_length,
+            size_t length, size_t copy_offset) {
+    tag->is_literal = is_literal;
+    tag->compressed_offset = ip_ - begin_;
+    tag->compressed_length = compressed_length;
+    tag->uncompressed_offset = produced_;
+    tag->length = length;
+    tag->copy_offset = copy_offset;
+    produced_ += length;
+  }
+
+  // Next() for the last 4 bytes of the input, which are too few for the
+  // unconditional load.
+  bool NextSlow(CompressedTag* tag) {
+    bool is_literal;
+    size_t length, copy_offset;
+    const uint8_t* const next =
+        internal::DecodeTag(ip_, ip_limit_, &is_literal, &length, &copy_offset);
+    // A copy offset of 0 wraps around and fails the second check.
+    if (next == nullptr ||
+        ((uncompressed_length_ - produced_ < length) |
+         (!is_literal & (copy_offset - 1 >= produced_)))) {
+      ok_ = false;
+      return false;
+    }
+    Fill(tag, is_literal, next - ip_, length, copy_offset);
+    tag->literal =
+        is_literal ? reinterpret_cast<const char*>(next - length) : nullptr;
+    ip_ = next;
+    preload_ = ip_ < ip_limit_ ? *ip_ : 0;
+    return true;
+  }
+};
+
+}  // namespace snappy
+
+#endif  // THIRD_PARTY_SNAPPY_SNAPPY_TAG_ITERATOR_H_
@@ -35,6 +35,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <new>
 #include <string>
 
 namespace file {
@@ -99,6 +100,39 @@ StatusStub SetContents(const std::string &file_name, const std::string &content,
 
 namespace snappy {
 
+namespace {
+
+// Per thread, so that tests and benchmarks only see their own allocations.
+thread_local int64_t allocation_count = 0;
+thread_local int64_t allocated_bytes = 0;
+
+void* CountedAllocate(size_t size) {
+  ++allocation_count;
+  allocated_bytes += static_cast<int64_t>(size);
+  // operator new must return a unique pointer even for zero bytes.
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  // There are no exceptions to report std::bad_alloc with.
+  if (ptr == nullptr) std::abort();
+  return ptr;
+}
+
+}  // namespace
+
+AllocationCounter::AllocationCounter() { Reset(); }
+
+int64_t AllocationCounter::allocations() const {
+  return allocation_count - start_allocations_;
+}
+
+int64_t AllocationCounter::bytes() const {
+  return allocated_bytes - start_bytes_;
+}
+
+void AllocationCounter::Reset() {
+  start_allocations_ = allocation_count;
+  start_bytes_ = allocated_bytes;
+}
+
 std::string ReadTestDataFile(const std::string& base, size_t size_limit) {
   std::string contents;
   const char* srcdir = getenv("srcdir");  // This is set by Automake.
@@ -501,3 +535,34 @@ int ZLib::Uncompress(Bytef *dest, uLongf *destLen,
 #endif  // HAVE_LIBZ
 
 }  // namespace snappy
+
+// Replacements for the global allocation functions, which feed
+// snappy::AllocationCounter.
+
+void* operator new(size_t size) { return snappy::CountedAllocate(size); }
+
+void* operator new[](size_t size) { return snappy::CountedAllocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return snappy::CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return snappy::CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
@@ -164,6 +164,24 @@ class CycleTimer {
 #endif
 };
 
+// Counts the allocations the calling thread makes through the global operator
+// new from construction on. snappy-test.cc replaces operator new in every
+// binary that links it, which covers the library as well as std containers.
+class AllocationCounter {
+ public:
+  AllocationCounter();
+
+  // Allocations and bytes requested since construction or the last Reset().
+  int64_t allocations() const;
+  int64_t bytes() const;
+
+  void Reset();
+
+ private:
+  int64_t start_allocations_;
+  int64_t start_bytes_;
+};
+
 // Logging.
 
 class LogMessage {
@@ -0,0 +1,670 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "snappy-uring.h"
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#if HAVE_UNISTD_H
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // HAVE_UNISTD_H
+
+#if HAVE_LINUX_IO_URING_H && HAVE_SYS_MMAN_H && HAVE_SYS_UIO_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif  // HAVE_LINUX_IO_URING_H && HAVE_SYS_MMAN_H && HAVE_SYS_UIO_H
+
+// The C library may predate io_uring even if the kernel headers do not.
+#if HAVE_LINUX_IO_URING_H && HAVE_SYS_MMAN_H && HAVE_SYS_UIO_H && \
+    HAVE_UNISTD_H && defined(__NR_io_uring_setup)
+#define SNAPPY_HAVE_URING 1
+#else
+#define SNAPPY_HAVE_URING 0
+#endif
+
+namespace snappy {
+
+namespace internal {
+
+#if SNAPPY_HAVE_URING
+
+// A minimal io_uring driver over the raw system calls, for a fixed set of
+// buffers with at most one request in flight each. Requests are identified by
+// buffer index.
+//
+// A buffer belongs to the kernel from Read() or Write() until Wait() returns
+// its completion. If that cannot be waited for, the buffers must not be freed
+// while busy() is true.
+class Uring {
+ public:
+  // Returns nullptr if io_uring cannot be used.
+  static Uring* Create(int fd, char* const* buffers, int num_buffers,
+                       size_t buffer_size) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    const long ring_fd =
+        syscall(__NR_io_uring_setup, static_cast<unsigned>(num_buffers),
+                &params);
+    if (ring_fd < 0) return nullptr;
+    Uring* ring = new Uring(static_cast<int>(ring_fd), fd, num_buffers);
+    if (!ring->Map(params)) {
+      delete ring;
+      return nullptr;
+    }
+    for (int i = 0; i < num_buffers; ++i) {
+      ring->iovecs_[i].iov_base = buffers[i];
+      ring->iovecs_[i].iov_len = buffer_size;
+    }
+    // Registered buffers save mapping the pages on every request, but count
+    // against RLIMIT_MEMLOCK; fall back to plain vectored I/O if that fails.
+    ring->fixed_ = syscall(__NR_io_uring_register, ring->ring_fd_,
+                           IORING_REGISTER_BUFFERS, ring->iovecs_.data(),
+                           static_cast<unsigned>(num_buffers)) == 0;
+    return ring;
+  }
+
+  ~Uring() {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+      munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_size_);
+    close(ring_fd_);
+  }
+
+  bool Read(int index, size_t length, uint64_t offset) {
+    return Submit(fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READV, index,
+                  length, offset);
+  }
+
+  bool Write(int index, size_t length, uint64_t offset) {
+    return Submit(fixed_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITEV, index,
+                  length, offset);
+  }
+
+  // Returns true while a request has not been returned by Wait().
+  bool busy() const { return num_in_flight_ > 0; }
+
+  // Waits for a request to complete, and stores its buffer index and result.
+  bool Wait(int* index, int32_t* result) {
+    for (;;) {
+      const unsigned head = *cq_head_;
+      if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe cqe = cqes_[head & *cq_mask_];
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        // Completions of the cancellations themselves carry no buffer.
+        if (cqe.user_data == kCancelUserData) continue;
+        *index = static_cast<int>(cqe.user_data);
+        *result = cqe.res;
+        in_flight_[*index] = false;
+        --num_in_flight_;
+        return true;
+      }
+      if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                  IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+          errno != EINTR) {
+        return false;
+      }
+    }
+  }
+
+  // Called after Wait() failed. Asks the kernel to cancel the requests in
+  // flight and waits for all of their completions, which arrive whether or
+  // not the cancellation succeeds. Returns false, leaving busy() true, if
+  // they cannot be waited for either.
+  bool CancelAll() {
+    for (int i = 0; i < static_cast<int>(in_flight_.size()); ++i) {
+      if (!in_flight_[i]) continue;
+      // Old kernels without IORING_OP_ASYNC_CANCEL fail the cancellation,
+      // and the request then completes on its own.
+      Enqueue(IORING_OP_ASYNC_CANCEL, -1, static_cast<uint64_t>(i), 0,
+              kCancelUserData);
+      if (!Enter()) break;
+    }
+    while (busy()) {
+      int index;
+      int32_t result;
+      if (!Wait(&index, &result)) return false;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr uint64_t kCancelUserData = ~uint64_t{0};
+
+  Uring(int ring_fd, int fd, int num_buffers)
+      : ring_fd_(ring_fd),
+        fd_(fd),
+        sq_ptr_(MAP_FAILED),
+        cq_ptr_(MAP_FAILED),
+        sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+        iovecs_(num_buffers),
+        in_flight_(num_buffers, false),
+        num_in_flight_(0),
+        fixed_(false) {}
+
+  bool Map(const struct io_uring_params& params) {
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) return false;
+    cq_ptr_ = single_mmap ? sq_ptr_
+                          : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                 IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) return false;
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(
+        mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) return false;
+
+    char* const sq = static_cast<char*>(sq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* const cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // Every entry is submitted right away, so the submission queue never
+  // overflows.
+  bool Submit(uint8_t opcode, int index, size_t length, uint64_t offset) {
+    struct io_uring_sqe* const sqe =
+        Enqueue(opcode, fd_, 0, offset, static_cast<uint64_t>(index));
+    if (fixed_) {
+      sqe->addr = reinterpret_cast<uintptr_t>(iovecs_[index].iov_base);
+      sqe->len = static_cast<uint32_t>(length);
+      sqe->buf_index = static_cast<uint16_t>(index);
+    } else {
+      iovecs_[index].iov_len = length;
+      sqe->addr = reinterpret_cast<uintptr_t>(&iovecs_[index]);
+      sqe->len = 1;
+    }
+    __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+    if (!Enter()) return false;
+    in_flight_[index] = true;
+    ++num_in_flight_;
+    return true;
+  }
+
+  // Fills in the next submission queue entry, without publishing it.
+  struct io_uring_sqe* Enqueue(uint8_t opcode, int fd, uint64_t addr,
+                               uint64_t offset, uint64_t user_data) {
+    const unsigned slot = *sq_tail_ & *sq_mask_;
+    struct io_uring_sqe* const sqe = &sqes_[slot];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sq_array_[slot] = slot;
+    return sqe;
+  }
+
+  // Submits the entry published last.
+  bool Enter() {
+    for (;;) {
+      const long submitted =
+          syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0);
+      if (submitted == 1) return true;
+      if (submitted < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+      return false;
+    }
+  }
+
+  const int ring_fd_;
+  const int fd_;
+  void* sq_ptr_;
+  size_t sq_size_;
+  void* cq_ptr_;
+  size_t cq_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  struct io_uring_cqe* cqes_;
+  std::vector<struct iovec> iovecs_;
+  std::vector<bool> in_flight_;
+  int num_in_flight_;
+  bool fixed_;
+};
+
+#else  // SNAPPY_HAVE_URING
+
+class Uring {
+ public:
+  static Uring* Create(int, char* const*, int, size_t) { return nullptr; }
+  bool Read(int, size_t, uint64_t) { return false; }
+  bool Write(int, size_t, uint64_t) { return false; }
+  bool busy() const { return false; }
+  bool Wait(int*, int32_t*) { return false; }
+  bool CancelAll() { return true; }
+};
+
+#endif  // SNAPPY_HAVE_URING
+
+}  // namespace internal
+
+constexpr size_t UringFileSource::kDefaultBufferSize;
+constexpr int UringFileSource::kDefaultNumBuffers;
+constexpr size_t UringFileSink::kDefaultBufferSize;
+constexpr int UringFileSink::kDefaultNumBuffers;
+
+#if HAVE_UNISTD_H
+
+namespace {
+
+constexpr size_t kBufferAlignment = 4096;
+
+char* AlignBuffer(char* p) {
+  const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+  return p + (-address & (kBufferAlignment - 1));
+}
+
+// Fills "data[0..n-1]" from "fd" at "offset". Returns false on error or end
+// of file.
+bool PreadFully(int fd, char* data, size_t n, uint64_t offset) {
+  while (n > 0) {
+    const ssize_t r = pread(fd, data, n, static_cast<off_t>(offset));
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+    data += r;
+    n -= static_cast<size_t>(r);
+    offset += static_cast<uint64_t>(r);
+  }
+  return true;
+}
+
+// Writes "data[0..n-1]" to "fd" at "offset". Returns false on error.
+bool PwriteFully(int fd, const char* data, size_t n, uint64_t offset) {
+  while (n > 0) {
+    const ssize_t w = pwrite(fd, data, n, static_cast<off_t>(offset));
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return false;
+    data += w;
+    n -= static_cast<size_t>(w);
+    offset += static_cast<uint64_t>(w);
+  }
+  return true;
+}
+
+// Allocates the buffers of "*buffers" in one page-aligned block of memory
+// and returns the allocation.
+template <typename Buffer>
+char* AllocateBuffers(int num_buffers, size_t buffer_size,
+                      std::vector<Buffer>* buffers) {
+  char* const allocated = new char[num_buffers * buffer_size +
+                                   kBufferAlignment];
+  char* const aligned = AlignBuffer(allocated);
+  buffers->resize(num_buffers);
+  for (int i = 0; i < num_buffers; ++i) {
+    (*buffers)[i] = Buffer();
+    (*buffers)[i].data = aligned + i * buffer_size;
+  }
+  return allocated;
+}
+
+template <typename Buffer>
+internal::Uring* CreateRing(int fd, const std::vector<Buffer>& buffers,
+                            size_t buffer_size) {
+  std::vector<char*> data;
+  for (const Buffer& buffer : buffers) data.push_back(buffer.data);
+  return internal::Uring::Create(fd, data.data(),
+                                 static_cast<int>(data.size()), buffer_size);
+}
+
+}  // namespace
+
+UringFileSource::UringFileSource(int fd, size_t buffer_size, int num_buffers)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      buffers_(),
+      allocated_(AllocateBuffers(num_buffers, buffer_size, &buffers_)),
+      ring_(nullptr),
+      current_(0),
+      next_offset_(0),
+      end_offset_(0),
+      left_(0),
+      ok_(true) {
+  struct stat st;
+  const off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (fstat(fd, &st) != 0 || offset < 0 || st.st_size < offset) {
+    ok_ = false;
+    return;
+  }
+  next_offset_ = static_cast<uint64_t>(offset);
+  end_offset_ = static_cast<uint64_t>(st.st_size);
+  left_ = static_cast<size_t>(end_offset_ - next_offset_);
+  if (left_ > buffer_size_) ring_ = CreateRing(fd, buffers_, buffer_size_);
+  for (int i = 0; i < num_buffers; ++i) StartRead(i);
+}
+
+UringFileSource::~UringFileSource() {
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    WaitFor(static_cast<int>(i));
+  }
+  // The kernel may still write to the buffers, so leak them with the ring.
+  if (ring_ != nullptr && ring_->busy()) return;
+  delete ring_;
+  delete[] allocated_;
+}
+
+size_t UringFileSource::Available() const { return left_; }
+
+const char* UringFileSource::Peek(size_t* len) {
+  Buffer& buffer = buffers_[current_];
+  if (left_ == 0) {
+    *len = 0;
+    return buffer.data;
+  }
+  WaitFor(current_);
+  *len = std::min(buffer.length - buffer.pos, left_);
+  return buffer.data + buffer.pos;
+}
+
+void UringFileSource::Skip(size_t n) {
+  left_ -= n;
+  while (n > 0 && ok_) {
+    WaitFor(current_);
+    Buffer& buffer = buffers_[current_];
+    const size_t to_skip = std::min(n, buffer.length - buffer.pos);
+    buffer.pos += to_skip;
+    n -= to_skip;
+    if (buffer.pos == buffer.length) {
+      StartRead(current_);
+      current_ = (current_ + 1) % static_cast<int>(buffers_.size());
+    }
+  }
+}
+
+void UringFileSource::StartRead(int index) {
+  Buffer& buffer = buffers_[index];
+  buffer.length = static_cast<size_t>(
+      std::min<uint64_t>(buffer_size_, end_offset_ - next_offset_));
+  buffer.offset = next_offset_;
+  buffer.pos = 0;
+  if (buffer.length == 0 || !ok_) return;
+  if (ring_ != nullptr && ring_->Read(index, buffer.length, next_offset_)) {
+    buffer.in_flight = true;
+  } else if (!PreadFully(fd_, buffer.data, buffer.length, next_offset_)) {
+    ok_ = false;
+    left_ = 0;
+  }
+  next_offset_ += buffer.length;
+}
+
+void UringFileSource::WaitFor(int index) {
+  while (buffers_[index].in_flight) {
+    int completed;
+    int32_t result;
+    if (!ring_->Wait(&completed, &result)) {
+      ok_ = false;
+      left_ = 0;
+      // A buffer is only free once its completion arrived.
+      if (ring_->CancelAll()) {
+        for (Buffer& buffer : buffers_) buffer.in_flight = false;
+      }
+      return;
+    }
+    Buffer& buffer = buffers_[completed];
+    buffer.in_flight = false;
+    // Finish short reads synchronously.
+    if (result <= 0 ||
+        (static_cast<size_t>(result) < buffer.length &&
+         !PreadFully(fd_, buffer.data + result, buffer.length - result,
+                     buffer.offset + result))) {
+      ok_ = false;
+      left_ = 0;
+    }
+  }
+}
+
+UringFileSink::UringFileSink(int fd, size_t buffer_size, int num_buffers)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      buffers_(),
+      allocated_(AllocateBuffers(num_buffers, buffer_size, &buffers_)),
+      ring_(CreateRing(fd, buffers_, buffer_size)),
+      current_(0),
+      used_(0),
+      offset_(0),
+      ok_(true) {
+  const off_t offset = lseek(fd, 0, SEEK_CUR);
+  if (offset < 0) {
+    ok_ = false;
+    return;
+  }
+  offset_ = static_cast<uint64_t>(offset);
+}
+
+UringFileSink::~UringFileSink() {
+  Flush();
+  // The kernel may still read from the buffers, so leak them with the ring.
+  if (ring_ != nullptr && ring_->busy()) return;
+  delete ring_;
+  delete[] allocated_;
+}
+
+void UringFileSink::Append(const char* bytes, size_t n) {
+  // Do no copying if the caller filled in the result of GetAppendBuffer()
+  if (bytes == buffers_[current_].data + used_) {
+    used_ += n;
+    if (used_ == buffer_size_) SubmitCurrent();
+    return;
+  }
+  while (n > 0) {
+    const size_t to_copy = std::min(n, buffer_size_ - used_);
+    std::memcpy(buffers_[current_].data + used_, bytes, to_copy);
+    used_ += to_copy;
+    bytes += to_copy;
+    n -= to_copy;
+    if (used_ == buffer_size_) SubmitCurrent();
+  }
+}
+
+char* UringFileSink::GetAppendBuffer(size_t length, char* scratch) {
+  if (length > buffer_size_ - used_) {
+    if (length > buffer_size_) return scratch;
+    SubmitCurrent();
+  }
+  return buffers_[current_].data + used_;
+}
+
+char* UringFileSink::GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)desired_size_hint;
+
+  if (min_size > buffer_size_ - used_) {
+    if (min_size > buffer_size_) {
+      *allocated_size = scratch_size;
+      return scratch;
+    }
+    SubmitCurrent();
+  }
+  *allocated_size = buffer_size_ - used_;
+  return buffers_[current_].data + used_;
+}
+
+bool UringFileSink::Flush() {
+  SubmitCurrent();
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    WaitFor(static_cast<int>(i));
+  }
+  if (ok_ && lseek(fd_, static_cast<off_t>(offset_), SEEK_SET) < 0) {
+    ok_ = false;
+  }
+  return ok_;
+}
+
+void UringFileSink::SubmitCurrent() {
+  if (used_ == 0) return;
+  Buffer& buffer = buffers_[current_];
+  buffer.length = used_;
+  buffer.offset = offset_;
+  if (ok_) {
+    if (ring_ != nullptr && ring_->Write(current_, used_, offset_)) {
+      buffer.in_flight = true;
+    } else if (!PwriteFully(fd_, buffer.data, used_, offset_)) {
+      ok_ = false;
+    }
+  }
+  offset_ += used_;
+  used_ = 0;
+  current_ = (current_ + 1) % static_cast<int>(buffers_.size());
+  WaitFor(current_);
+}
+
+void UringFileSink::WaitFor(int index) {
+  while (buffers_[index].in_flight) {
+    int completed;
+    int32_t result;
+    if (!ring_->Wait(&completed, &result)) {
+      ok_ = false;
+      // A buffer is only free once its completion arrived.
+      if (ring_->CancelAll()) {
+        for (Buffer& buffer : buffers_) buffer.in_flight = false;
+      }
+      return;
+    }
+    Buffer& buffer = buffers_[completed];
+    buffer.in_flight = false;
+    // Finish short writes synchronously.
+    if (result <= 0 ||
+        (static_cast<size_t>(result) < buffer.length &&
+         !PwriteFully(fd_, buffer.data + result, buffer.length - result,
+                      buffer.offset + result))) {
+      ok_ = false;
+    }
+  }
+}
+
+#else  // HAVE_UNISTD_H
+
+// Without file descriptors to read or write, the source is empty and the sink
+// drops its data, and both report an error.
+
+UringFileSource::UringFileSource(int fd, size_t buffer_size, int num_buffers)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      buffers_(),
+      allocated_(nullptr),
+      ring_(nullptr),
+      current_(0),
+      next_offset_(0),
+      end_offset_(0),
+      left_(0),
+      ok_(false) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)num_buffers;
+}
+
+UringFileSource::~UringFileSource() = default;
+
+size_t UringFileSource::Available() const { return 0; }
+
+const char* UringFileSource::Peek(size_t* len) {
+  *len = 0;
+  return nullptr;
+}
+
+void UringFileSource::Skip(size_t n) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)n;
+}
+
+UringFileSink::UringFileSink(int fd, size_t buffer_size, int num_buffers)
+    : fd_(fd),
+      buffer_size_(buffer_size),
+      buffers_(),
+      allocated_(nullptr),
+      ring_(nullptr),
+      current_(0),
+      used_(0),
+      offset_(0),
+      ok_(false) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)num_buffers;
+}
+
+UringFileSink::~UringFileSink() = default;
+
+void UringFileSink::Append(const char* bytes, size_t n) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)bytes;
+  (void)n;
+}
+
+char* UringFileSink::GetAppendBuffer(size_t length, char* scratch) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)length;
+
+  return scratch;
+}
+
+char* UringFileSink::GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) {
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)min_size;
+  (void)desired_size_hint;
+
+  *allocated_size = scratch_size;
+  return scratch;
+}
+
+bool UringFileSink::Flush() { return false; }
+
+#endif  // HAVE_UNISTD_H
+
+}  // namespace snappy
@@ -0,0 +1,172 @@
+// Copyright 2021 Google Inc. All Rights Reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// File Source and Sink implementations that overlap I/O with compression by
+// keeping several reads or writes in flight through io_uring.
+
+#ifndef THIRD_PARTY_SNAPPY_SNAPPY_URING_H_
+#define THIRD_PARTY_SNAPPY_SNAPPY_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "snappy-sinksource.h"
+
+namespace snappy {
+
+namespace internal {
+class Uring;
+}  // namespace internal
+
+// A Source that reads a regular file through a ring of buffers, keeping reads
+// of the buffers ahead of the one being consumed in flight. While Compress()
+// works on one buffer, the kernel fills the others.
+//
+// "fd" must refer to a regular file; it is read from its current offset to
+// the end of the file as of construction, using positional reads, so the
+// descriptor's offset is left unchanged. The descriptor is not closed.
+//
+// Where io_uring is not available (other platforms, old kernels, or sandboxes
+// that forbid it) the buffers are filled synchronously with pread() instead;
+// async() tells which. If a read fails, the source ends early and ok()
+// returns false.
+class UringFileSource : public Source {
+ public:
+  static constexpr size_t kDefaultBufferSize = 1 << 20;
+  static constexpr int kDefaultNumBuffers = 4;
+
+  explicit UringFileSource(int fd, size_t buffer_size = kDefaultBufferSize,
+                           int num_buffers = kDefaultNumBuffers);
+  ~UringFileSource() override;
+  size_t Available() const override;
+  const char* Peek(size_t* len) override;
+  void Skip(size_t n) override;
+
+  // Returns false if a read error occurred.
+  bool ok() const { return ok_; }
+
+  // Returns true if reads are done asynchronously through io_uring.
+  bool async() const { return ring_ != nullptr; }
+
+ private:
+  struct Buffer {
+    char* data;
+    size_t length;    // bytes requested from the file
+    uint64_t offset;  // file offset of data[0]
+    size_t pos;       // bytes consumed
+    bool in_flight;
+  };
+
+  void StartRead(int index);
+  void WaitFor(int index);
+
+  const int fd_;
+  const size_t buffer_size_;
+  std::vector<Buffer> buffers_;
+  char* const allocated_;  // holds the data of buffers_
+  internal::Uring* ring_;
+  int current_;
+  uint64_t next_offset_;  // file offset of the next buffer to request
+  uint64_t end_offset_;
+  size_t left_;
+  bool ok_;
+
+  // No copying
+  UringFileSource(const UringFileSource&);
+  void operator=(const UringFileSource&);
+};
+
+// A Sink that writes a regular file through a ring of buffers. Full buffers
+// are written in the background through io_uring while the next one is being
+// filled, so compression does not stall on write(). GetAppendBuffer() and
+// GetAppendBufferVariable() hand out space in the current buffer.
+//
+// "fd" must refer to a regular file; it is written from its current offset
+// with positional writes, and Flush() moves the offset past the written data.
+// The descriptor is not closed. Buffered data is written by Flush() and by
+// the destructor.
+//
+// Where io_uring is not available the buffers are written synchronously with
+// pwrite() instead; async() tells which. Write errors are sticky and
+// reported by ok() and Flush().
+class UringFileSink : public Sink {
+ public:
+  static constexpr size_t kDefaultBufferSize = 1 << 20;
+  static constexpr int kDefaultNumBuffers = 4;
+
+  explicit UringFileSink(int fd, size_t buffer_size = kDefaultBufferSize,
+                         int num_buffers = kDefaultNumBuffers);
+  ~UringFileSink() override;
+  void Append(const char* bytes, size_t n) override;
+  char* GetAppendBuffer(size_t length, char* scratch) override;
+  char* GetAppendBufferVariable(
+      size_t min_size, size_t desired_size_hint, char* scratch,
+      size_t scratch_size, size_t* allocated_size) override;
+
+  // Writes all buffered data and waits for it to reach the file. Returns false
+  // if this or any earlier write failed.
+  bool Flush();
+
+  // Returns false if a write error occurred.
+  bool ok() const { return ok_; }
+
+  // Returns true if writes are done asynchronously through io_uring.
+  bool async() const { return ring_ != nullptr; }
+
+ private:
+  struct Buffer {
+    char* data;
+    size_t length;  // bytes being written
+    uint64_t offset;
+    bool in_flight;
+  };
+
+  // Starts writing the current buffer and moves on to the next one.
+  void SubmitCurrent();
+  void WaitFor(int index);
+
+  const int fd_;
+  const size_t buffer_size_;
+  std::vector<Buffer> buffers_;
+  char* const allocated_;  // holds the data of buffers_
+  internal::Uring* ring_;
+  int current_;
+  size_t used_;  // bytes in the current buffer
+  uint64_t offset_;  // file offset of the current buffer
+  bool ok_;
+
+  // No copying
+  UringFileSink(const UringFileSink&);
+  void operator=(const UringFileSink&);
+};
+
+}  // namespace snappy
+
+#endif  // THIRD_PARTY_SNAPPY_SNAPPY_URING_H_
@@ -27,7 +27,9 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "snappy-internal.h"
+#include "snappy-decompression-writer.h"
 #include "snappy-sinksource.h"
+#include "snappy-tag-iterator.h"
 #include "snappy.h"
 
 #if !defined(SNAPPY_HAVE_BMI2)
@@ -51,16 +53,59 @@
 #include <immintrin.h>
 #endif
 
+#if !defined(SNAPPY_HAVE_X86_STREAMING_STORES)
+// SSE2 is part of x86-64. It provides the streaming stores, CLFLUSH and SFENCE
+// used by RawUncompressNonTemporal().
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SNAPPY_HAVE_X86_STREAMING_STORES 1
+#else
+#define SNAPPY_HAVE_X86_STREAMING_STORES 0
+#endif
+#endif  // !defined(SNAPPY_HAVE_X86_STREAMING_STORES)
+
+#if SNAPPY_HAVE_X86_STREAMING_STORES
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// CLFLUSHOPT is detected at runtime; see CanEvictCacheLines().
+#include <cpuid.h>
+#include <immintrin.h>
+#define SNAPPY_HAVE_CLFLUSHOPT_DISPATCH 1
+#endif
+#endif  // SNAPPY_HAVE_X86_STREAMING_STORES
+
+#if !defined(SNAPPY_HAVE_CLFLUSHOPT_DISPATCH)
+#define SNAPPY_HAVE_CLFLUSHOPT_DISPATCH 0
+#endif
+
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
+#if SNAPPY_HAVE_THREADS
+#if HAVE_WINDOWS_H
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif  // WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif  // NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif  // HAVE_WINDOWS_H
+#endif  // SNAPPY_HAVE_THREADS
+
 namespace snappy {
 
 namespace {
@@ -74,6 +119,7 @@ using internal::COPY_2_BYTE_OFFSET;
 using internal::COPY_4_BYTE_OFFSET;
 using internal::kMaximumTagLength;
 using internal::LITERAL;
+using internal::SegmentBoundary;
 #if SNAPPY_HAVE_VECTOR_BYTE_SHUFFLE
 using internal::V128;
 using internal::V128_Load;
@@ -684,19 +730,25 @@ uint32_t CalculateTableSize(uint32_t input_size) {
 }  // namespace
 
 namespace internal {
-WorkingMemory::WorkingMemory(size_t input_size) {
+WorkingMemory::WorkingMemory(size_t input_size, Allocator* allocator)
+    : allocator_(allocator) {
   const size_t max_fragment_size = std::min(input_size, kBlockSize);
   const size_t table_size = CalculateTableSize(max_fragment_size);
   size_ = table_size * sizeof(*table_) + max_fragment_size +
           MaxCompressedLength(max_fragment_size);
-  mem_ = std::allocator<char>().allocate(size_);
+  mem_ = allocator_ != nullptr ? allocator_->Allocate(size_)
+                               : std::allocator<char>().allocate(size_);
   table_ = reinterpret_cast<uint16_t*>(mem_);
   input_ = mem_ + table_size * sizeof(*table_);
   output_ = input_ + max_fragment_size;
 }
 
 WorkingMemory::~WorkingMemory() {
-  std::allocator<char>().deallocate(mem_, size_);
+  if (allocator_ != nullptr) {
+    allocator_->Deallocate(mem_, size_);
+  } else {
+    std::allocator<char>().deallocate(mem_, size_);
+  }
 }
 
 uint16_t* WorkingMemory::GetHashTable(size_t fragment_size,
@@ -1190,6 +1242,21 @@ std::pair<const uint8_t*, ptrdiff_t> DecompressBranchless(
   return {ip, op};
 }
 
+static_assert(kDecompressionSlopBytes == kSlopBytes,
+              "GetBase() writers must provide the slop DecompressBranchless() "
+              "writes");
+
+namespace internal {
+const uint8_t* DecompressFlat(const uint8_t* ip, const uint8_t* ip_limit,
+                              char* op_base, ptrdiff_t* op,
+                              ptrdiff_t op_limit_min_slop) {
+  auto res =
+      DecompressBranchless(ip, ip_limit, *op, op_base, op_limit_min_slop);
+  *op = res.second;
+  return res.first;
+}
+}  // namespace internal
+
 // Helper class for decompression
 class SnappyDecompressor {
  private:
@@ -1492,7 +1559,14 @@ bool GetUncompressedLength(Source* source, uint32_t* result) {
   return decompressor.ReadUncompressedLength(result);
 }
 
-size_t Compress(Source* reader, Sink* writer) {
+namespace {
+
+// Implements Compress() and CompressWithCrc32c(). If "crc32c" is not null, the
+// CRC-32C of the input is stored there. Working memory comes from "*allocator",
+// or from the heap if it is null.
+size_t CompressAndChecksum(Source* reader, Sink* writer, uint32_t* crc32c,
+                           Allocator* allocator) {
+  uint32_t crc = 0;
   size_t written = 0;
   size_t N = reader->Available();
   const size_t uncompressed_size = N;
@@ -1501,7 +1575,7 @@ size_t Compress(Source* reader, Sink* writer) {
   writer->Append(ulength, p - ulength);
   written += (p - ulength);
 
-  internal::WorkingMemory wmem(N);
+  internal::WorkingMemory wmem(N, allocator);
 
   while (N > 0) {
     // Get next block to compress (without copying if possible)
@@ -1534,6 +1608,12 @@ size_t Compress(Source* reader, Sink* writer) {
     }
     assert(fragment_size == num_to_read);
 
+    // Checksum the fragment while it is in the caches for compression, instead
+    // of in a separate pass over the whole input.
+    if (crc32c != nullptr) {
+      crc = internal::Crc32cExtend(crc, fragment, fragment_size);
+    }
+
     // Get encoding table for compression
     int table_size;
     uint16_t* table = wmem.GetHashTable(num_to_read, &table_size);
@@ -1559,9 +1639,30 @@ size_t Compress(Source* reader, Sink* writer) {
 
   Report("snappy_compress", written, uncompressed_size);
 
+  if (crc32c != nullptr) *crc32c = crc;
   return written;
 }
 
+}  // namespace
+
+Allocator::~Allocator() = default;
+
+size_t Compress(Source* reader, Sink* writer) {
+  return CompressAndChecksum(reader, writer, nullptr, nullptr);
+}
+
+size_t Compress(Source* reader, Sink* writer, Allocator* allocator) {
+  return CompressAndChecksum(reader, writer, nullptr, allocator);
+}
+
+size_t CompressWithCrc32c(Source* reader, Sink* writer, uint32_t* crc32c) {
+  return CompressAndChecksum(reader, writer, crc32c, nullptr);
+}
+
+uint32_t Crc32c(const char* data, size_t n) {
+  return internal::Crc32c(data, n);
+}
+
 // -----------------------------------------------------------------------
 // IOVec interfaces
 // -----------------------------------------------------------------------
@@ -1745,9 +1846,97 @@ class SnappyIOVecWriter {
     return true;
   }
 
+  inline size_t Produced() const { return total_written_; }
   inline void Flush() {}
 };
 
+// Computes the CRC-32C of the output of a SnappyIOVecWriter in pieces of
+// kChecksumStep bytes, while they are still in the L1 cache.
+class SnappyChecksummingIOVecWriter {
+ private:
+  static constexpr size_t kChecksumStep = 4096;
+
+  SnappyIOVecWriter writer_;
+  // The output up to offset "checksummed_", which ends at offset
+  // "checksum_iov_offset_" of "checksum_iov_", is included in "crc_".
+  const struct iovec* checksum_iov_;
+  size_t checksum_iov_offset_;
+  size_t checksummed_;
+  uint32_t crc_;
+
+  void Checksum(size_t produced) {
+    size_t n = produced - checksummed_;
+    while (n > 0) {
+      if (checksum_iov_offset_ == checksum_iov_->iov_len) {
+        ++checksum_iov_;
+        checksum_iov_offset_ = 0;
+        continue;
+      }
+      const size_t to_checksum =
+          std::min(n, checksum_iov_->iov_len - checksum_iov_offset_);
+      crc_ = internal::Crc32cExtend(
+          crc_,
+          reinterpret_cast<const char*>(checksum_iov_->iov_base) +
+              checksum_iov_offset_,
+          to_checksum);
+      checksum_iov_offset_ += to_checksum;
+      n -= to_checksum;
+    }
+    checksummed_ = produced;
+  }
+
+  inline void MaybeChecksum() {
+    const size_t produced = writer_.Produced();
+    if (SNAPPY_PREDICT_FALSE(produced - checksummed_ >= kChecksumStep)) {
+      Checksum(produced);
+    }
+  }
+
+ public:
+  inline SnappyChecksummingIOVecWriter(const struct iovec* iov,
+                                       size_t iov_count)
+      : writer_(iov, iov_count),
+        checksum_iov_(iov),
+        checksum_iov_offset_(0),
+        checksummed_(0),
+        crc_(0) {}
+
+  inline void SetExpectedLength(size_t len) { writer_.SetExpectedLength(len); }
+  inline bool CheckLength() const { return writer_.CheckLength(); }
+
+  char* GetOutputPtr() { return writer_.GetOutputPtr(); }
+  char* GetBase(ptrdiff_t* op_limit_min_slop) {
+    return writer_.GetBase(op_limit_min_slop);
+  }
+  void SetOutputPtr(char* op) { writer_.SetOutputPtr(op); }
+
+  inline bool Append(const char* ip, size_t len, char** op_p) {
+    const bool ok = writer_.Append(ip, len, op_p);
+    MaybeChecksum();
+    return ok;
+  }
+
+  inline bool TryFastAppend(const char* ip, size_t available, size_t len,
+                            char** op_p) {
+    if (!writer_.TryFastAppend(ip, available, len, op_p)) return false;
+    MaybeChecksum();
+    return true;
+  }
+
+  inline bool AppendFromSelf(size_t offset, size_t len, char** op_p) {
+    const bool ok = writer_.AppendFromSelf(offset, len, op_p);
+    MaybeChecksum();
+    return ok;
+  }
+
+  inline void Flush() {
+    writer_.Flush();
+    Checksum(writer_.Produced());
+  }
+
+  uint32_t crc32c() const { return crc_; }
+};
+
 bool RawUncompressToIOVec(const char* compressed, size_t compressed_length,
                           const struct iovec* iov, size_t iov_cnt) {
   ByteArraySource reader(compressed, compressed_length);
@@ -1760,6 +1949,141 @@ bool RawUncompressToIOVec(Source* compressed, const struct iovec* iov,
   return InternalUncompress(compressed, &output);
 }
 
+bool RawUncompressToIOVecWithCrc32c(const char* compressed,
+                                    size_t compressed_length,
+                                    const struct iovec* iov, size_t iov_cnt,
+                                    uint32_t* crc32c) {
+  ByteArraySource reader(compressed, compressed_length);
+  SnappyChecksummingIOVecWriter output(iov, iov_cnt);
+  if (!InternalUncompress(&reader, &output)) return false;
+  *crc32c = output.crc32c();
+  return true;
+}
+
+// Builds the uncompressed data as a list of pieces, each of which either
+// refers to a literal inside the compressed data, or to bytes materialized in
+// a scratch buffer. Pieces are kept in uncompressed order, so the piece that
+// holds a given uncompressed offset can be found with a binary search.
+class SnappyIOVecReferenceWriter {
+ private:
+  struct Piece {
+    size_t start;           // uncompressed offset of the first byte
+    const char* reference;  // nullptr if the bytes live in the scratch buffer
+    size_t scratch_offset;  // valid if reference == nullptr
+    size_t length;
+  };
+
+  const size_t min_reference_length_;
+  std::string* const scratch_;
+  std::vector<Piece> pieces_;
+  size_t produced_;
+
+  // Appends "length" uninitialized bytes to the scratch buffer and returns a
+  // pointer to them. The pointer is invalidated by the next call.
+  char* AppendScratch(size_t length) {
+    if (pieces_.empty() || pieces_.back().reference != nullptr) {
+      pieces_.push_back({produced_, nullptr, scratch_->size(), 0});
+    }
+    pieces_.back().length += length;
+    produced_ += length;
+    const size_t old_size = scratch_->size();
+    STLStringResizeUninitialized(scratch_, old_size + length);
+    return string_as_array(scratch_) + old_size;
+  }
+
+  // REQUIRES: pos < produced_
+  const Piece& FindPiece(size_t pos) const {
+    if (pos >= pieces_.back().start) return pieces_.back();
+    auto it = std::upper_bound(
+        pieces_.begin(), pieces_.end(), pos,
+        [](size_t p, const Piece& piece) { return p < piece.start; });
+    return *(it - 1);
+  }
+
+ public:
+  SnappyIOVecReferenceWriter(size_t min_reference_length, std::string* scratch)
+      : min_reference_length_(min_reference_length),
+        scratch_(scratch),
+        produced_(0) {}
+
+  void AppendLiteral(const char* literal, size_t length) {
+    if (length >= min_reference_length_) {
+      pieces_.push_back({produced_, literal, 0, length});
+      produced_ += length;
+    } else {
+      std::memcpy(AppendScratch(length), literal, length);
+    }
+  }
+
+  // REQUIRES: 0 < offset <= produced_
+  void AppendFromSelf(size_t offset, size_t length) {
+    size_t pos = produced_ - offset;
+    while (length > 0) {
+      const bool in_last_piece = pos >= pieces_.back().start;
+      const Piece piece = FindPiece(pos);
+      const size_t skip = pos - piece.start;
+      if (piece.reference != nullptr) {
+        const size_t n = std::min(length, piece.length - skip);
+        std::memcpy(AppendScratch(n), piece.reference + skip, n);
+        pos += n;
+        length -= n;
+        continue;
+      }
+      // The last piece grows as the copy is appended to it, so like in
+      // IncrementalCopy() the copy may read bytes it has just written.
+      const size_t n =
+          in_last_piece ? length : std::min(length, piece.length - skip);
+      const bool overlapping = pos + n > produced_;
+      char* const dst = AppendScratch(n);
+      const char* const src = scratch_->data() + piece.scratch_offset + skip;
+      if (!overlapping) {
+        std::memcpy(dst, src, n);
+      } else {
+        for (size_t i = 0; i < n; ++i) dst[i] = src[i];
+      }
+      pos += n;
+      length -= n;
+    }
+  }
+
+  // Stores the pieces in "*iov". Must be called after the last append, as
+  // appending can move the scratch buffer.
+  void GetIOVec(std::vector<struct iovec>* iov) const {
+    iov->resize(pieces_.size());
+    for (size_t i = 0; i < pieces_.size(); ++i) {
+      const Piece& piece = pieces_[i];
+      const char* base = piece.reference != nullptr
+                             ? piece.reference
+                             : scratch_->data() + piece.scratch_offset;
+      (*iov)[i].iov_base = const_cast<char*>(base);
+      (*iov)[i].iov_len = piece.length;
+    }
+  }
+};
+
+bool UncompressToIOVecReferences(const char* compressed,
+                                  size_t compressed_length,
+                                  size_t min_reference_length,
+                                  std::string* scratch,
+                                  std::vector<struct iovec>* iov) {
+  scratch->clear();
+  iov->clear();
+  CompressedTagIterator it(compressed, compressed_length);
+  SnappyIOVecReferenceWriter writer(std::max<size_t>(min_reference_length, 1),
+                                    scratch);
+  CompressedTag tag;
+  while (it.Next(&tag)) {
+    if (tag.is_literal) {
+      writer.AppendLiteral(tag.literal, tag.length);
+    } else {
+      writer.AppendFromSelf(tag.copy_offset, tag.length);
+    }
+  }
+  if (!it.done()) return false;
+  writer.GetIOVec(iov);
+  return true;
+}
+
 // -----------------------------------------------------------------------
 // Flat array interfaces
 // -----------------------------------------------------------------------
@@ -1876,6 +2200,744 @@ bool Uncompress(const char* compressed, size_t compressed_length,
                        string_as_array(uncompressed));
 }
 
+namespace {
+
+#if SNAPPY_HAVE_CLFLUSHOPT_DISPATCH
+constexpr size_t kCacheLineSize = 64;
+
+__attribute__((target("clflushopt"))) void EvictCacheLines(const char* begin,
+                                                           const char* end) {
+  const char* const first_line = reinterpret_cast<const char*>(
+      reinterpret_cast<uintptr_t>(begin) & ~uintptr_t{kCacheLineSize - 1});
+  for (const char* p = first_line; p < end; p += kCacheLineSize) {
+    _mm_clflushopt(const_cast<char*>(p));
+  }
+}
+#endif  // SNAPPY_HAVE_CLFLUSHOPT_DISPATCH
+
+// Returns true if EvictCacheLines() can be used. Only CLFLUSHOPT is fast
+// enough to evict output at memory bandwidth; CLFLUSH is serializing and
+// about fifty times slower.
+bool CanEvictCacheLines() {
+#if SNAPPY_HAVE_CLFLUSHOPT_DISPATCH
+  static const bool has_clflushopt = [] {
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+           (ebx & (1u << 23)) != 0;
+  }();
+  return has_clflushopt;
+#else
+  return false;
+#endif  // SNAPPY_HAVE_CLFLUSHOPT_DISPATCH
+}
+
+// A Writer for RawUncompressNonTemporal(). It writes to a flat array like
+// SnappyArrayWriter, but keeps the output from displacing the caller's working
+// set in the CPU caches: long literals are written with streaming stores, and
+// output that lies further behind the write position than the copies emitted
+// by the compressor can reach is evicted from the caches as decompression
+// proceeds. Copies reaching further back are still correct, merely slower.
+class SnappyNonTemporalArrayWriter {
+ private:
+  // The compressor never emits copies with offsets above kBlockSize.
+  static constexpr size_t kEvictionWindow = kBlockSize;
+  // Output is evicted in pieces of this size, which bounds how often the
+  // fast path in DecompressBranchless() has to hand control back.
+  static constexpr size_t kEvictionStep = 16 << 10;
+  // Literals shorter than this are copied with regular stores; they are
+  // likely to be read back by nearby copies.
+  static constexpr size_t kMinStreamedLiteral = 256;
+
+  SnappyArrayWriter writer_;
+  char* const base_;
+  char* op_limit_;
+  // Output in [base_, base_ + evicted_) has been evicted from the caches.
+  size_t evicted_;
+  // Output offset at which the next piece can be evicted. Never reached if
+  // the CPU cannot evict cache lines efficiently.
+  size_t next_eviction_;
+
+  inline void MaybeEvict(const char* op) {
+    const size_t produced = op - base_;
+    if (SNAPPY_PREDICT_TRUE(produced < next_eviction_)) return;
+    const size_t evict_end =
+        (produced - kEvictionWindow) & ~(kEvictionStep - 1);
+    Evict(evict_end);
+  }
+
+  void Evict(size_t evict_end) {
+#if SNAPPY_HAVE_CLFLUSHOPT_DISPATCH
+    EvictCacheLines(base_ + evicted_, base_ + evict_end);
+#endif
+    evicted_ = evict_end;
+    next_eviction_ = evicted_ + kEvictionWindow + kEvictionStep;
+  }
+
+  static void StreamingCopy(char* dst, const char* src, size_t len) {
+#if SNAPPY_HAVE_X86_STREAMING_STORES
+    const size_t head = (0 - reinterpret_cast<uintptr_t>(dst)) & 15;
+    std::memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    len -= head;
+    for (; len >= 16; len -= 16, dst += 16, src += 16) {
+      _mm_stream_si128(
+          reinterpret_cast<__m128i*>(dst),
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    }
+#endif  // SNAPPY_HAVE_X86_STREAMING_STORES
+    std::memcpy(dst, src, len);
+  }
+
+ public:
+  inline explicit SnappyNonTemporalArrayWriter(char* dst)
+      : writer_(dst),
+        base_(dst),
+        op_limit_(dst),
+        evicted_(0),
+        next_eviction_(CanEvictCacheLines()
+                           ? kEvictionWindow + kEvictionStep
+                           : std::numeric_limits<size_t>::max()) {}
+
+  inline void SetExpectedLength(size_t len) {
+    writer_.SetExpectedLength(len);
+    op_limit_ = base_ + len;
+  }
+  inline bool CheckLength() const { return writer_.CheckLength(); }
+
+  char* GetOutputPtr() { return writer_.GetOutputPtr(); }
+  char* GetBase(ptrdiff_t* op_limit_min_slop) {
+    char* const base = writer_.GetBase(op_limit_min_slop);
+    // Stop the fast path when the next piece of output can be evicted.
+    if (next_eviction_ < static_cast<size_t>(*op_limit_min_slop)) {
+      *op_limit_min_slop = next_eviction_;
+    }
+    return base;
+  }
+  void SetOutputPtr(char* op) { writer_.SetOutputPtr(op); }
+
+  inline bool Append(const char* ip, size_t len, char** op_p) {
+    MaybeEvict(*op_p);
+    if (len < kMinStreamedLiteral) return writer_.Append(ip, len, op_p);
+    char* const op = *op_p;
+    const size_t space_left = op_limit_ - op;
+    if (space_left < len) return false;
+    StreamingCopy(op, ip, len);
+    *op_p = op + len;
+    return true;
+  }
+
+  inline bool TryFastAppend(const char* ip, size_t available, size_t len,
+                            char** op_p) {
+    MaybeEvict(*op_p);
+    return writer_.TryFastAppend(ip, available, len, op_p);
+  }
+
+  SNAPPY_ATTRIBUTE_ALWAYS_INLINE
+  inline bool AppendFromSelf(size_t offset, size_t len, char** op_p) {
+    MaybeEvict(*op_p);
+    return writer_.AppendFromSelf(offset, len, op_p);
+  }
+
+  inline void Flush() {
+    writer_.Flush();
+    // All output is complete at this point.
+    if (next_eviction_ != std::numeric_limits<size_t>::max()) {
+      Evict(writer_.Produced());
+    }
+#if SNAPPY_HAVE_X86_STREAMING_STORES
+    // Order the streaming stores before any later stores, e.g. of a flag that
+    // publishes the output to another thread.
+    _mm_sfence();
+#endif
+  }
+};
+
+// A Source for RawUncompressNonTemporal() that hands out a flat array in
+// pieces, and evicts each piece from the caches once the decompressor has
+// consumed it. Reading the compressed input displaces the caller's working set
+// just like writing the output does.
+class EvictingByteArraySource : public Source {
+ public:
+  EvictingByteArraySource(const char* p, size_t n)
+      : ptr_(p), left_(n), evict_(CanEvictCacheLines()) {}
+  ~EvictingByteArraySource() override {}
+
+  size_t Available() const override { return left_; }
+  const char* Peek(size_t* len) override {
+    *len = std::min<size_t>(left_, size_t{kPieceSize});
+    return ptr_;
+  }
+  void Skip(size_t n) override {
+    assert(n <= left_);
+#if SNAPPY_HAVE_CLFLUSHOPT_DISPATCH
+    if (evict_) EvictCacheLines(ptr_, ptr_ + n);
+#endif
+    ptr_ += n;
+    left_ -= n;
+  }
+
+ private:
+  static constexpr size_t kPieceSize = 64 << 10;
+
+  const char* ptr_;
+  size_t left_;
+  const bool evict_;
+};
+
+// A Writer that writes to a flat array like SnappyArrayWriter, and hands the
+// output to a Consumer in pieces of kChunkSize bytes, while they are still in
+// the L1 cache. Consumer(base, begin, end) is called with consecutive ranges
+// once the output in "base[begin..end-1]" is final.
+template <typename Consumer>
+class SnappyConsumingArrayWriter {
+ private:
+  static constexpr size_t kChunkSize = 4096;
+
+  SnappyArrayWriter writer_;
+  char* const base_;
+  Consumer* const consumer_;
+  // The output in [base_, base_ + consumed_) was handed to the consumer.
+  size_t consumed_;
+  // Output offset at which the next piece is handed to the consumer.
+  size_t next_chunk_;
+
+  inline void MaybeConsume(const char* op) {
+    const size_t produced = op - base_;
+    if (SNAPPY_PREDICT_TRUE(produced < next_chunk_)) return;
+    Consume(produced);
+  }
+
+  void Consume(size_t produced) {
+    (*consumer_)(base_, consumed_, produced);
+    consumed_ = produced;
+    next_chunk_ = produced + kChunkSize;
+  }
+
+ public:
+  inline SnappyConsumingArrayWriter(char* dst, Consumer* consumer)
+      : writer_(dst),
+        base_(dst),
+        consumer_(consumer),
+        consumed_(0),
+        next_chunk_(kChunkSize) {}
+
+  inline void SetExpectedLength(size_t len) { writer_.SetExpectedLength(len); }
+  inline bool CheckLength() const { return writer_.CheckLength(); }
+
+  char* GetOutputPtr() { return writer_.GetOutputPtr(); }
+  char* GetBase(ptrdiff_t* op_limit_min_slop) {
+    char* const base = writer_.GetBase(op_limit_min_slop);
+    // Stop the fast path once the next piece of output is complete.
+    const size_t limit = next_chunk_ + kSlopBytes;
+    if (limit < static_cast<size_t>(*op_limit_min_slop)) {
+      *op_limit_min_slop = limit;
+    }
+    return base;
+  }
+  void SetOutputPtr(char* op) { writer_.SetOutputPtr(op); }
+
+  inline bool Append(const char* ip, size_t len, char** op_p) {
+    MaybeConsume(*op_p);
+    return writer_.Append(ip, len, op_p);
+  }
+
+  inline bool TryFastAppend(const char* ip, size_t available, size_t len,
+                            char** op_p) {
+    MaybeConsume(*op_p);
+    return writer_.TryFastAppend(ip, available, len, op_p);
+  }
+
+  SNAPPY_ATTRIBUTE_ALWAYS_INLINE
+  inline bool AppendFromSelf(size_t offset, size_t len, char** op_p) {
+    MaybeConsume(*op_p);
+    return writer_.AppendFromSelf(offset, len, op_p);
+  }
+
+  inline void Flush() {
+    writer_.Flush();
+    Consume(writer_.Produced());
+  }
+};
+
+// Computes the CRC-32C of the output for RawUncompressWithCrc32c().
+struct Crc32cConsumer {
+  uint32_t crc = 0;
+
+  void operator()(const char* base, size_t begin, size_t end) {
+    crc = internal::Crc32cExtend(crc, base + begin, end - begin);
+  }
+};
+
+// Appends to "*offsets" the positions in "data[begin..end-pattern_length]" at
+// which "pattern[0..pattern_length-1]" occurs, plus "start".
+void FindAllOccurrences(const char* data, size_t start, size_t begin,
+                        size_t end, const char* pattern, size_t pattern_length,
+                        std::vector<size_t>* offsets) {
+  if (end - begin < pattern_length) return;
+  const char* p = data + begin;
+  const char* const last = data + end - pattern_length;
+  // memchr() is vectorized in common C libraries, so the scan for the first
+  // byte of the pattern runs at memory speed.
+  while (p <= last) {
+    p = static_cast<const char*>(std::memchr(p, pattern[0], last - p + 1));
+    if (p == nullptr) return;
+    if (std::memcmp(p + 1, pattern + 1, pattern_length - 1) == 0) {
+      offsets->push_back(start + (p - data));
+    }
+    ++p;
+  }
+}
+
+// Searches the output for FindInCompressed(). Occurrences that cross the end
+// of a piece are found with the next one, so the window must keep the last
+// pattern_length - 1 bytes of each piece.
+class PatternSearchConsumer {
+ public:
+  PatternSearchConsumer(const char* pattern, size_t pattern_length,
+                        std::vector<size_t>* offsets)
+      : pattern_(pattern),
+        pattern_length_(pattern_length),
+        offsets_(offsets),
+        scan_from_(0) {}
+
+  // "window[0]" is at output offset "start", and "window[begin..end-1]" is
+  // the new piece.
+  void operator()(const char* window, size_t start, size_t begin,
+                  size_t end) {
+    (void)begin;
+    assert(scan_from_ >= start);
+    FindAllOccurrences(window, start, scan_from_ - start, end, pattern_,
+                       pattern_length_, offsets_);
+    if (start + end - scan_from_ >= pattern_length_) {
+      scan_from_ = start + end - pattern_length_ + 1;
+    }
+  }
+
+ private:
+  const char* const pattern_;
+  const size_t pattern_length_;
+  std::vector<size_t>* const offsets_;
+  // The first output offset that may start an occurrence not yet found.
+  size_t scan_from_;
+};
+
+// A Writer that keeps only the tail of the output, in a fixed-size window, and
+// hands each piece to a Consumer while it is still in the L1 cache, as
+// (*consumer)(window, start, begin, end); see PatternSearchConsumer. When the
+// window fills up, all but its last "history" bytes are dropped. A copy that
+// reaches back past the window fails, and sets window_exceeded() if it would
+// have been valid with the whole output.
+template <typename Consumer>
+class SnappyWindowWriter {
+ private:
+  static constexpr size_t kChunkSize = 4096;
+
+  char* const base_;
+  const size_t capacity_;
+  const size_t history_;
+  Consumer* const consumer_;
+  size_t expected_;
+  // Output offset of base_[0].
+  size_t start_;
+  char* op_;
+  char* op_limit_;
+  // If op < op_limit_min_slop_ then it's safe to unconditionally write
+  // kSlopBytes starting at op.
+  char* op_limit_min_slop_;
+  // The window in [base_, base_ + consumed_) was handed to the consumer.
+  size_t consumed_;
+  // Window offset at which the next piece is handed to the consumer.
+  size_t next_chunk_;
+  bool window_exceeded_;
+
+  void SetLimits() {
+    const size_t room = std::min(capacity_, expected_ - start_);
+    op_limit_ = base_ + room;
+    op_limit_min_slop_ = op_limit_ - std::min<size_t>(kSlopBytes - 1, room);
+  }
+
+  inline size_t Remaining(const char* op) const {
+    return expected_ - start_ - (op - base_);
+  }
+
+  inline void MaybeConsume(char** op_p) {
+    const size_t produced = *op_p - base_;
+    if (SNAPPY_PREDICT_TRUE(produced < next_chunk_)) return;
+    Consume(produced);
+    // Slide before the fast path runs out of room, unless the rest of the
+    // output fits.
+    if (capacity_ - produced < kChunkSize + kSlopBytes &&
+        start_ + capacity_ < expected_) {
+      *op_p = Slide(*op_p);
+    }
+  }
+
+  void Consume(size_t produced) {
+    if (produced > consumed_) {
+      (*consumer_)(base_, start_, consumed_, produced);
+    }
+    consumed_ = produced;
+    next_chunk_ = produced + kChunkSize;
+  }
+
+  // Consumes the window up to "op", moves its last history_ bytes to the
+  // front, and returns the new output pointer.
+  char* Slide(char* op) {
+    const size_t produced = op - base_;
+    Consume(produced);
+    const size_t keep = std::min(history_, produced);
+    std::memmove(base_, op - keep, keep);
+    start_ += produced - keep;
+    consumed_ = keep;
+    next_chunk_ = keep + kChunkSize;
+    SetLimits();
+    return base_ + keep;
+  }
+
+ public:
+  // "capacity" must exceed "history" by at least kBlockSize, unless the whole
+  // output fits in the window.
+  SnappyWindowWriter(char* window, size_t capacity, size_t history,
+                     Consumer* consumer)
+      : base_(window),
+        capacity_(capacity),
+        history_(history),
+        consumer_(consumer),
+        expected_(0),
+        start_(0),
+        op_(window),
+        op_limit_(window),
+        op_limit_min_slop_(window),
+        consumed_(0),
+        next_chunk_(kChunkSize),
+        window_exceeded_(false) {}
+
+  bool window_exceeded() const { return window_exceeded_; }
+
+  inline void SetExpectedLength(size_t len) {
+    expected_ = len;
+    SetLimits();
+  }
+  inline bool CheckLength() const { return Remaining(op_) == 0; }
+
+  char* GetOutputPtr() { return op_; }
+  char* GetBase(ptrdiff_t* op_limit_min_slop) {
+    *op_limit_min_slop = op_limit_min_slop_ - base_;
+    // Stop the fast path once the next piece of output is complete.
+    const size_t limit = next_chunk_ + kSlopBytes;
+    if (limit < static_cast<size_t>(*op_limit_min_slop)) {
+      *op_limit_min_slop = limit;
+    }
+    return base_;
+  }
+  void SetOutputPtr(char* op) { op_ = op; }
+
+  inline bool Append(const char* ip, size_t len, char** op_p) {
+    MaybeConsume(op_p);
+    char* op = *op_p;
+    if (Remaining(op) < len) return false;
+    // A long literal may not fit in the window.
+    while (static_cast<size_t>(op_limit_ - op) < len) {
+      const size_t n = op_limit_ - op;
+      std::memcpy(op, ip, n);
+      ip += n;
+      len -= n;
+      op = Slide(op + n);
+    }
+    std::memcpy(op, ip, len);
+    *op_p = op + len;
+    return true;
+  }
+
+  inline bool TryFastAppend(const char* ip, size_t available, size_t len,
+                            char** op_p) {
+    MaybeConsume(op_p);
+    char* op = *op_p;
+    const size_t space_left = op_limit_ - op;
+    if (len <= 16 && available >= 16 + kMaximumTagLength && space_left >= 16) {
+      UnalignedCopy128(ip, op);
+      *op_p = op + len;
+      return true;
+    }
+    return false;
+  }
+
+  inline bool AppendFromSelf(size_t offset, size_t len, char** op_p) {
+    assert(len > 0);
+    MaybeConsume(op_p);
+    char* op = *op_p;
+    if (SNAPPY_PREDICT_FALSE(static_cast<size_t>(op_limit_ - op) < len)) {
+      if (Remaining(op) < len) return false;
+      op = Slide(op);
+      *op_p = op;
+    }
+    const size_t produced = op - base_;
+    if (SNAPPY_PREDICT_FALSE(produced < offset)) {
+      // See SnappyArrayWriter::AppendFromSelf for the "offset - 1u" trick.
+      window_exceeded_ = offset - 1u < start_ + produced;
+      return false;
+    }
+    char* const op_end = op + len;
+    if (SNAPPY_PREDICT_FALSE((kSlopBytes < 64 && len > kSlopBytes) ||
+                            op >= op_limit_min_slop_ || offset < len)) {
+      if (offset == 0) return false;
+      *op_p = IncrementalCopy(op - offset, op, op_end, op_limit_);
+      return true;
+    }
+    std::memmove(op, op - offset, kSlopBytes);
+    *op_p = op_end;
+    return true;
+  }
+
+  inline void Flush() { Consume(op_ - base_); }
+};
+
+}  // namespace
+
+bool RawUncompressNonTemporal(const char* compressed, size_t compressed_length,
+                              char* uncompressed) {
+  EvictingByteArraySource reader(compressed, compressed_length);
+  SnappyNonTemporalArrayWriter output(uncompressed);
+  return InternalUncompress(&reader, &output);
+}
+
+bool RawUncompressWithCrc32c(const char* compressed, size_t compressed_length,
+                             char* uncompressed, uint32_t* crc32c) {
+  ByteArraySource reader(compressed, compressed_length);
+  Crc32cConsumer consumer;
+  SnappyConsumingArrayWriter<Crc32cConsumer> output(uncompressed, &consumer);
+  if (!InternalUncompress(&reader, &output)) return false;
+  *crc32c = consumer.crc;
+  return true;
+}
+
+namespace internal {
+
+bool FindSegmentBoundaries(const char* const ip_start,
+                           const char* const ip_limit, size_t uncompressed_len,
+                           size_t segment_size,
+                           std::vector<SegmentBoundary>* boundaries) {
+  // Candidate boundaries, with the lowest output offset that a copy inside
+  // the segment starting at the candidate reads from.
+  struct Candidate {
+    SegmentBoundary boundary;
+    size_t min_copy_source;
+  };
+  std::vector<Candidate> candidates;
+  candidates.reserve(uncompressed_len / segment_size);
+
+  // The loop is kept free of data-dependent branches, which would mispredict
+  // on the mix of literals and copies; invalid copies are only recorded and
+  // checked at the end.
+  const size_t ip_length = ip_limit - ip_start;
+  size_t ip = 0;
+  size_t op = 0;
+  size_t next_boundary = segment_size;
+  // Lowest copy source in the current segment.
+  size_t min_source = ~size_t{0};
+  bool invalid_copy = false;
+  while (ip < ip_length) {
+    if (SNAPPY_PREDICT_FALSE(op >= next_boundary)) {
+      if (op == next_boundary) {
+        if (!candidates.empty()) {
+          candidates.back().min_copy_source = min_source;
+        }
+        candidates.push_back({{ip, op}, ~size_t{0}});
+        min_source = ~size_t{0};
+      }
+      // A tag that spans a boundary rules it out.
+      while (next_boundary <= op) next_boundary += segment_size;
+    }
+
+    const uint8_t c = static_cast<uint8_t>(ip_start[ip++]);
+    const uint16_t entry = char_table[c];
+    const size_t trailer_length = entry >> 11;
+    uint32_t trailer;
+    if (SNAPPY_PREDICT_TRUE(ip_length - ip >= 4)) {
+      trailer =
+          ExtractLowBytes(LittleEndian::Load32(ip_start + ip), trailer_length);
+    } else {
+      if (ip_length - ip < trailer_length) return false;
+      trailer = 0;
+      for (size_t i = 0; i < trailer_length; ++i) {
+        trailer |= static_cast<uint32_t>(static_cast<uint8_t>(ip_start[ip + i]))
+                   << (8 * i);
+      }
+    }
+    ip += trailer_length;
+
+    const bool is_literal = (c & 0x3) == LITERAL;
+    const size_t length =
+        (is_literal && c >= (60 << 2)) ? size_t{trailer} + 1 : (entry & 0xff);
+    const size_t copy_offset = (entry & 0x700) + trailer;
+    invalid_copy |= (!is_literal) & ((copy_offset == 0) | (copy_offset > op));
+    const size_t source = is_literal ? ~size_t{0} : op - copy_offset;
+    min_source = std::min(min_source, source);
+    ip += is_literal ? length : 0;
+    op += length;
+  }
+  if (ip != ip_length || invalid_copy || op != uncompressed_len) return false;
+  if (!candidates.empty()) candidates.back().min_copy_source = min_source;
+
+  // A candidate is usable if no copy in its segment or any later segment
+  // reads from before it.
+  boundaries->clear();
+  min_source = ~size_t{0};
+  for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+    min_source = std::min(min_source, it->min_copy_source);
+    if (min_source >= it->boundary.uncompressed_offset) {
+      boundaries->push_back(it->boundary);
+    }
+  }
+  std::reverse(boundaries->begin(), boundaries->end());
+  return true;
+}
+
+}  // namespace internal
+
+namespace {
+
+#if SNAPPY_HAVE_THREADS
+
+// Decodes the tags in "compressed[0, compressed_length-1]" into
+// "uncompressed[0, uncompressed_length-1]", without a length prefix.
+bool RawUncompressSegment(const char* compressed, size_t compressed_length,
+                          char* uncompressed, size_t uncompressed_length) {
+  ByteArraySource reader(compressed, compressed_length);
+  SnappyDecompressor decompressor(&reader);
+  SnappyArrayWriter writer(uncompressed);
+  return InternalUncompressAllTags(&decompressor, &writer, compressed_length,
+                                   uncompressed_length);
+}
+
+// One piece of the output of ParallelRawUncompress().
+struct SegmentTask {
+  const char* compressed;
+  size_t compressed_length;
+  char* uncompressed;
+  size_t uncompressed_length;
+  bool ok;
+
+  void Run() {
+    ok = RawUncompressSegment(compressed, compressed_length, uncompressed,
+                              uncompressed_length);
+  }
+};
+
+// The threads are started through the platform API rather than std::thread,
+// which terminates the program when it cannot start one, since exceptions
+// are disabled.
+#if HAVE_WINDOWS_H
+
+using SegmentThread = HANDLE;
+
+DWORD WINAPI RunSegmentTask(LPVOID task) {
+  static_cast<SegmentTask*>(task)->Run();
+  return 0;
+}
+
+bool StartSegmentThread(SegmentTask* task, SegmentThread* thread) {
+  *thread = CreateThread(nullptr, 0, RunSegmentTask, task, 0, nullptr);
+  return *thread != nullptr;
+}
+
+void JoinSegmentThread(SegmentThread thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+#else  // HAVE_WINDOWS_H
+
+using SegmentThread = pthread_t;
+
+void* RunSegmentTask(void* task) {
+  static_cast<SegmentTask*>(task)->Run();
+  return nullptr;
+}
+
+bool StartSegmentThread(SegmentTask* task, SegmentThread* thread) {
+  return pthread_create(thread, nullptr, RunSegmentTask, task) == 0;
+}
+
+void JoinSegmentThread(SegmentThread thread) { pthread_join(thread, nullptr); }
+
+#endif  // HAVE_WINDOWS_H
+
+#endif  // SNAPPY_HAVE_THREADS
+
+}  // namespace
+
+bool ParallelRawUncompress(const char* compressed, size_t compressed_length,
+                           char* uncompressed, int num_threads) {
+#if !SNAPPY_HAVE_THREADS
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)num_threads;
+
+  return RawUncompress(compressed, compressed_length, uncompressed);
+#else   // !SNAPPY_HAVE_THREADS
+  uint32_t uncompressed_len;
+  const char* const tags =
+      Varint::Parse32WithLimit(compressed, compressed + compressed_length,
+                               &uncompressed_len);
+  if (tags == nullptr) return false;
+  const char* const tags_limit = compressed + compressed_length;
+
+  std::vector<SegmentBoundary> boundaries;
+  if (num_threads <= 1 || uncompressed_len <= 2 * kBlockSize ||
+      !internal::FindSegmentBoundaries(tags, tags_limit, uncompressed_len,
+                                       kBlockSize, &boundaries) ||
+      boundaries.empty()) {
+    return RawUncompress(compressed, compressed_length, uncompressed);
+  }
+
+  // Pick one boundary close to each multiple of uncompressed_len / threads.
+  std::vector<SegmentBoundary> cuts;
+  cuts.push_back({0, 0});
+  const size_t num_segments = std::min<size_t>(
+      static_cast<size_t>(num_threads), boundaries.size() + 1);
+  const size_t target_size = uncompressed_len / num_segments;
+  for (const SegmentBoundary& boundary : boundaries) {
+    if (boundary.uncompressed_offset >=
+        cuts.back().uncompressed_offset + target_size) {
+      cuts.push_back(boundary);
+    }
+  }
+  cuts.push_back({static_cast<size_t>(tags_limit - tags), uncompressed_len});
+
+  std::vector<SegmentTask> tasks(cuts.size() - 1);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    tasks[i].compressed = tags + cuts[i].compressed_offset;
+    tasks[i].compressed_length =
+        cuts[i + 1].compressed_offset - cuts[i].compressed_offset;
+    tasks[i].uncompressed = uncompressed + cuts[i].uncompressed_offset;
+    tasks[i].uncompressed_length =
+        cuts[i + 1].uncompressed_offset - cuts[i].uncompressed_offset;
+  }
+  // The calling thread decodes the last segment itself, and any segment
+  // whose thread could not be started.
+  std::vector<SegmentThread> threads;
+  threads.reserve(tasks.size() - 1);
+  for (size_t i = 0; i + 1 < tasks.size(); ++i) {
+    SegmentThread thread;
+    if (StartSegmentThread(&tasks[i], &thread)) {
+      threads.push_back(thread);
+    } else {
+      tasks[i].Run();
+    }
+  }
+  tasks.back().Run();
+  for (SegmentThread thread : threads) JoinSegmentThread(thread);
+
+  for (const SegmentTask& task : tasks) {
+    if (!task.ok) {
+      return RawUncompress(compressed, compressed_length, uncompressed);
+    }
+  }
+  return true;
+#endif  // !SNAPPY_HAVE_THREADS
+}
+
 // A Writer that drops everything on the floor and just does validation
 class SnappyDecompressionValidator {
  private:
@@ -1930,11 +2992,306 @@ bool IsValidCompressed(Source* compressed) {
   return InternalUncompress(compressed, &writer);
 }
 
+bool FindInCompressed(const char* compressed, size_t compressed_length,
+                      const char* pattern, size_t pattern_length,
+                      std::vector<size_t>* offsets) {
+  if (pattern_length == 0) {
+    return IsValidCompressedBuffer(compressed, compressed_length);
+  }
+  size_t ulength;
+  if (!GetUncompressedLength(compressed, compressed_length, &ulength)) {
+    return false;
+  }
+  // Copies from Compress() reach back less than kBlockSize bytes, and an
+  // occurrence that crosses pieces needs the last pattern_length - 1 bytes, so
+  // only that much of the output is kept. The unvalidated header can only
+  // shrink the window.
+  const size_t history = std::max(kBlockSize, pattern_length - 1);
+  const size_t capacity = std::min(ulength, history + 3 * kBlockSize);
+  const size_t first = offsets->size();
+  {
+    std::unique_ptr<char[]> window(new char[capacity]);
+    PatternSearchConsumer consumer(pattern, pattern_length, offsets);
+    ByteArraySource reader(compressed, compressed_length);
+    SnappyWindowWriter<PatternSearchConsumer> output(window.get(), capacity,
+                                                     history, &consumer);
+    if (InternalUncompress(&reader, &output)) return true;
+    offsets->resize(first);
+    if (!output.window_exceeded()) return false;
+  }
+  // Other encoders may copy from further back. That is rare, so the whole
+  // output is kept then, but only once the input is known to be valid.
+  if (!IsValidCompressedBuffer(compressed, compressed_length)) return false;
+  std::unique_ptr<char[]> uncompressed(new char[ulength]);
+  PatternSearchConsumer consumer(pattern, pattern_length, offsets);
+  ByteArraySource reader(compressed, compressed_length);
+  SnappyWindowWriter<PatternSearchConsumer> output(uncompressed.get(), ulength,
+                                                   ulength, &consumer);
+  return InternalUncompress(&reader, &output);
+}
+
+bool ConcatCompressed(const char* a, size_t a_length, const char* b,
+                      size_t b_length, std::string* out) {
+  const uint8_t* a_ip = reinterpret_cast<const uint8_t*>(a);
+  const uint8_t* b_ip = reinterpret_cast<const uint8_t*>(b);
+  uint32_t a_ulength, b_ulength;
+  if (!internal::ParseUncompressedLength(&a_ip, a_ip + a_length, &a_ulength) ||
+      !internal::ParseUncompressedLength(&b_ip, b_ip + b_length, &b_ulength) ||
+      b_ulength > std::numeric_limits<uint32_t>::max() - a_ulength) {
+    return false;
+  }
+  // Copies are relative to the current position and never reach back past
+  // the start of their own stream, so the tag streams can be concatenated
+  // unchanged.
+  const char* const a_tags = reinterpret_cast<const char*>(a_ip);
+  const char* const b_tags = reinterpret_cast<const char*>(b_ip);
+  const size_t a_tags_length = a + a_length - a_tags;
+  const size_t b_tags_length = b + b_length - b_tags;
+  char header[Varint::kMax32];
+  const size_t header_length =
+      Varint::Encode32(header, a_ulength + b_ulength) - header;
+  STLStringResizeUninitialized(out,
+                               header_length + a_tags_length + b_tags_length);
+  char* dst = string_as_array(out);
+  std::memcpy(dst, header, header_length);
+  std::memcpy(dst + header_length, a_tags, a_tags_length);
+  std::memcpy(dst + header_length + a_tags_length, b_tags, b_tags_length);
+  return true;
+}
+
+bool SplitCompressed(const char* compressed, size_t compressed_length,
+                     std::vector<std::string>* pieces) {
+  // The candidate split points, as (compressed, uncompressed) offsets of the
+  // elements that start at a fragment boundary. A copy that reaches back
+  // across a candidate rules it out; such candidates are always the most
+  // recent ones, so they are popped off the back.
+  std::vector<std::pair<size_t, size_t>> splits;
+  CompressedTagIterator it(compressed, compressed_length);
+  CompressedTag tag;
+  while (it.Next(&tag)) {
+    if (tag.uncompressed_offset % kBlockSize == 0 &&
+        tag.uncompressed_offset != 0) {
+      splits.emplace_back(tag.compressed_offset, tag.uncompressed_offset);
+    }
+    if (!tag.is_literal) {
+      const size_t source = tag.uncompressed_offset - tag.copy_offset;
+      while (!splits.empty() && splits.back().second > source) {
+        splits.pop_back();
+      }
+    }
+  }
+  if (!it.done()) return false;
+
+  const uint8_t* tags = reinterpret_cast<const uint8_t*>(compressed);
+  uint32_t ulength;
+  internal::ParseUncompressedLength(&tags, tags + compressed_length, &ulength);
+  splits.emplace_back(compressed_length, ulength);
+  pieces->clear();
+  pieces->reserve(splits.size());
+  size_t begin = reinterpret_cast<const char*>(tags) - compressed;
+  size_t ubegin = 0;
+  for (const auto& split : splits) {
+    pieces->emplace_back();
+    std::string* piece = &pieces->back();
+    Varint::Append32(piece, static_cast<uint32_t>(split.second - ubegin));
+    piece->append(compressed + begin, split.first - begin);
+    begin = split.first;
+    ubegin = split.second;
+  }
+  return true;
+}
+
+namespace {
+
+// Re-encodes the elements of decompressed data "base[0..n-1]" for
+// Recompress(). Matches are found from the hints in the original elements
+// (their copies, and the offset of the last copy), and from a hash table
+// probed only at bytes that were literals in the original.
+class Recompressor {
+ public:
+  Recompressor(const char* base, size_t n, std::string* out)
+      : base_(base),
+        n_(n),
+        out_(out),
+        op_(0),
+        pos_(0),
+        literal_start_(0),
+        last_offset_(0),
+        table_(new uint32_t[kTableSize]()) {
+    char* const op = Reserve(Varint::kMax32);
+    op_ += Varint::Encode32(op, static_cast<uint32_t>(n)) - op;
+  }
+
+  // Elements must be added in order.
+  void AddLiteral(size_t start, size_t end) {
+    ScanLiteral(std::max(start, pos_), end);
+  }
+
+  void AddCopy(size_t start, size_t end, size_t offset) {
+    start = std::max(start, pos_);
+    if (start >= end) return;
+    // A tail of a copy that was overlapped by an extended match is still a
+    // valid copy, unless it is too short to be worth one.
+    if (end - start < 4) {
+      ScanLiteral(start, end);
+      return;
+    }
+    Table(start) = static_cast<uint32_t>(start);
+    EmitMatch(start, end, offset);
+  }
+
+  // Emits the pending literal and returns the size of the output.
+  size_t Finish() {
+    assert(pos_ == n_);
+    EmitPendingLiteral(n_);
+    return op_;
+  }
+
+ private:
+  static constexpr int kTableBits = 14;
+  static constexpr size_t kTableSize = size_t{1} << kTableBits;
+  // New matches use at most 2-byte offsets.
+  static constexpr size_t kMaxNewOffset = 65535;
+
+  uint32_t& Table(size_t i) {
+    const uint32_t bytes = LittleEndian::Load32(base_ + i);
+    return table_[(bytes * 0x1e35a7bd) >> (32 - kTableBits)];
+  }
+
+  char* Reserve(size_t n) {
+    if (out_->size() - op_ < n) {
+      STLStringResizeUninitialized(out_, std::max(2 * out_->size(), op_ + n));
+    }
+    return string_as_array(out_) + op_;
+  }
+
+  // Emits the pending literal in pieces of at most kBlockSize bytes, like
+  // Compress() does, so that each length fits EmitLiteral()'s int.
+  void EmitPendingLiteral(size_t end) {
+    while (literal_start_ < end) {
+      const size_t len = std::min(end - literal_start_, kBlockSize);
+      char* const op = Reserve(len + 5);
+      op_ += EmitLiteral</*allow_fast_path=*/false>(
+                 op, base_ + literal_start_, static_cast<int>(len)) -
+             op;
+      literal_start_ += len;
+    }
+  }
+
+  // Emits a copy of "base_[start - offset..end - offset - 1]" that is
+  // extended in both directions as far as possible, preceded by the pending
+  // literal.
+  void EmitMatch(size_t start, size_t end, size_t offset) {
+    while (start > literal_start_ && start > offset &&
+           base_[start - 1] == base_[start - 1 - offset]) {
+      --start;
+    }
+    if (end < n_) {
+      uint64_t data;
+      end += internal::FindMatchLength(base_ + end - offset, base_ + end,
+                                       base_ + n_, &data)
+                 .first;
+    }
+    EmitPendingLiteral(start);
+    size_t len = end - start;
+    // Copies with a 4-byte offset hold at most 64 bytes each.
+    char* op = Reserve((len / 60 + 2) * 5 + 4);
+    if (offset <= kMaxNewOffset) {
+      op = len < 12 ? EmitCopy</*len_less_than_12=*/true>(op, offset, len)
+                    : EmitCopy</*len_less_than_12=*/false>(op, offset, len);
+    } else {
+      while (len > 0) {
+        const size_t chunk = std::min<size_t>(len, 64);
+        *op++ = static_cast<char>(COPY_4_BYTE_OFFSET | ((chunk - 1) << 2));
+        LittleEndian::Store32(op, static_cast<uint32_t>(offset));
+        op += 4;
+        len -= chunk;
+      }
+    }
+    op_ = op - string_as_array(out_);
+    pos_ = literal_start_ = end;
+    last_offset_ = offset;
+    if (end + 4 <= n_) Table(end - 1) = static_cast<uint32_t>(end - 1);
+  }
+
+  // Looks for matches starting in "base_[start..end-1]", trying the offset of
+  // the last copy first. Like CompressFragment(), it probes less often the
+  // longer it goes without finding one.
+  void ScanLiteral(size_t start, size_t end) {
+    size_t i = start;
+    uint32_t skip = 32;
+    while (i < end && i + 4 <= n_) {
+      const uint32_t bytes = LittleEndian::Load32(base_ + i);
+      uint32_t& entry = Table(i);
+      const size_t candidate = entry;
+      entry = static_cast<uint32_t>(i);
+      size_t offset = 0;
+      if (last_offset_ != 0 && i >= last_offset_ &&
+          LittleEndian::Load32(base_ + i - last_offset_) == bytes) {
+        offset = last_offset_;
+      } else if (candidate < i && i - candidate <= kMaxNewOffset &&
+                 LittleEndian::Load32(base_ + candidate) == bytes) {
+        offset = i - candidate;
+      }
+      if (offset != 0) {
+        EmitMatch(i, i + 4, offset);
+        i = pos_;
+        skip = 32;
+        continue;
+      }
+      i += skip++ >> 5;
+    }
+    pos_ = std::max(pos_, end);
+  }
+
+  const char* const base_;
+  const size_t n_;
+  std::string* const out_;
+  size_t op_;             // size of the output so far
+  size_t pos_;            // data before this has been emitted or is pending
+  size_t literal_start_;  // start of the pending literal, which ends at pos_
+  size_t last_offset_;
+  std::unique_ptr<uint32_t[]> table_;
+};
+
+}  // namespace
+
+bool Recompress(const char* compressed, size_t compressed_length,
+                std::string* out) {
+  std::string uncompressed;
+  if (!Uncompress(compressed, compressed_length, &uncompressed)) return false;
+  Recompressor recompressor(uncompressed.data(), uncompressed.size(), out);
+  CompressedTagIterator it(compressed, compressed_length);
+  CompressedTag tag;
+  while (it.Next(&tag)) {
+    const size_t end = tag.uncompressed_offset + tag.length;
+    if (tag.is_literal) {
+      recompressor.AddLiteral(tag.uncompressed_offset, end);
+    } else {
+      recompressor.AddCopy(tag.uncompressed_offset, end, tag.copy_offset);
+    }
+  }
+  assert(it.done());
+  const size_t size = recompressor.Finish();
+  // The re-encoding is greedy, so it is not always smaller.
+  if (size >= compressed_length) {
+    out->assign(compressed, compressed_length);
+  } else {
+    out->resize(size);
+  }
+  return true;
+}
+
 void RawCompress(const char* input, size_t input_length, char* compressed,
                  size_t* compressed_length) {
+  RawCompress(input, input_length, compressed, compressed_length, nullptr);
+}
+
+void RawCompress(const char* input, size_t input_length, char* compressed,
+                 size_t* compressed_length, Allocator* allocator) {
   ByteArraySource reader(input, input_length);
   UncheckedByteArraySink writer(compressed);
-  Compress(&reader, &writer);
+  Compress(&reader, &writer, allocator);
 
   // Compute how many bytes were added
   *compressed_length = (writer.CurrentDestination() - compressed);
@@ -2134,13 +3491,152 @@ bool SnappyScatteredWriter<Allocator>::SlowAppendFromSelf(size_t offset,
   return true;
 }
 
+namespace {
+
+// Recycles the kBlockSize blocks that SnappySinkAllocator hands to sinks, once
+// enabled with SetBlockPoolLimits().
+// Freed blocks go to a small per-thread cache first, which needs no locking,
+// and overflow into a shared pool, which lets blocks that are freed on other
+// threads than the decompressing one find their way back. Each level is only
+// touched while its limit is nonzero, so the disabled pool costs two relaxed
+// loads per block on top of the heap.
+class BlockPool {
+ public:
+  static char* Allocate() {
+    if (per_thread_limit().load(std::memory_order_relaxed) > 0) {
+      ThreadCache& cache = GetThreadCache();
+      if (!cache.blocks.empty()) {
+        char* block = cache.blocks.back();
+        cache.blocks.pop_back();
+        return block;
+      }
+    }
+    if (shared_limit().load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(shared_mutex());
+      std::vector<char*>& shared = shared_blocks();
+      if (!shared.empty()) {
+        char* block = shared.back();
+        shared.pop_back();
+        return block;
+      }
+    }
+    return new char[kBlockSize];
+  }
+
+  static void Free(char* block) {
+    const size_t per_thread =
+        per_thread_limit().load(std::memory_order_relaxed);
+    if (per_thread > 0) {
+      ThreadCache& cache = GetThreadCache();
+      if (cache.blocks.size() < per_thread) {
+        cache.blocks.push_back(block);
+        return;
+      }
+    }
+    const size_t shared_max = shared_limit().load(std::memory_order_relaxed);
+    if (shared_max > 0) {
+      std::lock_guard<std::mutex> lock(shared_mutex());
+      std::vector<char*>& shared = shared_blocks();
+      if (shared.size() < shared_max) {
+        shared.push_back(block);
+        return;
+      }
+    }
+    delete[] block;
+  }
+
+  static void SetLimits(size_t per_thread_blocks, size_t shared_blocks) {
+    per_thread_limit().store(per_thread_blocks, std::memory_order_relaxed);
+    shared_limit().store(shared_blocks, std::memory_order_relaxed);
+  }
+
+  static void Trim() {
+    GetThreadCache().Clear();
+    std::vector<char*> blocks;
+    {
+      std::lock_guard<std::mutex> lock(shared_mutex());
+      blocks.swap(shared_blocks());
+    }
+    for (char* block : blocks) delete[] block;
+  }
+
+ private:
+  struct ThreadCache {
+    std::vector<char*> blocks;
+
+    void Clear() {
+      for (char* block : blocks) delete[] block;
+      blocks.clear();
+    }
+    // Hands the blocks of an exiting thread to the shared pool.
+    ~ThreadCache() {
+      if (blocks.empty()) return;
+      const size_t shared_max = shared_limit().load(std::memory_order_relaxed);
+      if (shared_max > 0) {
+        std::lock_guard<std::mutex> lock(shared_mutex());
+        std::vector<char*>& shared = shared_blocks();
+        while (!blocks.empty() && shared.size() < shared_max) {
+          shared.push_back(blocks.back());
+          blocks.pop_back();
+        }
+      }
+      Clear();
+    }
+  };
+
+  static ThreadCache& GetThreadCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+  }
+
+  // Function-local statics, so that the pool works during the static
+  // initialization and destruction of other translation units. They are
+  // never destroyed, as threads may still exit afterwards.
+  static std::mutex& shared_mutex() {
+    static std::mutex* const mutex = new std::mutex();
+    return *mutex;
+  }
+  static std::vector<char*>& shared_blocks() {
+    static std::vector<char*>* const blocks = new std::vector<char*>();
+    return *blocks;
+  }
+  static std::atomic<size_t>& per_thread_limit() {
+    static std::atomic<size_t>* const limit = new std::atomic<size_t>(0);
+    return *limit;
+  }
+  static std::atomic<size_t>& shared_limit() {
+    static std::atomic<size_t>* const limit = new std::atomic<size_t>(0);
+    return *limit;
+  }
+};
+
+}  // namespace
+
+void SetBlockPoolLimits(size_t per_thread_blocks, size_t shared_blocks) {
+  BlockPool::SetLimits(per_thread_blocks, shared_blocks);
+}
+
+void TrimBlockPool() { BlockPool::Trim(); }
+
+// Blocks come from "*allocator" if it is not null. Otherwise they come from
+// the heap, and full ones are recycled through the BlockPool.
 class SnappySinkAllocator {
  public:
-  explicit SnappySinkAllocator(Sink* dest) : dest_(dest) {}
+  explicit SnappySinkAllocator(Sink* dest, Allocator* allocator = nullptr)
+      : dest_(dest), allocator_(allocator) {}
   ~SnappySinkAllocator() {}
 
   char* Allocate(int size) {
-    Datablock block(new char[size], size);
+    char* data;
+    if (allocator_ != nullptr) {
+      data = allocator_->Allocate(size);
+    } else if (static_cast<size_t>(size) == kBlockSize) {
+      data = BlockPool::Allocate();
+    } else {
+      // Only full blocks are pooled; a shorter one ends the output.
+      data = new char[size];
+    }
+    Datablock block(data, size);
     blocks_.push_back(block);
     return block.data;
   }
@@ -2154,9 +3650,25 @@ class SnappySinkAllocator {
     size_t size_written = 0;
     for (Datablock& block : blocks_) {
       size_t block_size = std::min<size_t>(block.size, size - size_written);
-      dest_->AppendAndTakeOwnership(block.data, block_size,
-                                    &SnappySinkAllocator::Deleter, NULL);
       size_written += block_size;
+      if (allocator_ != nullptr) {
+        // Allocator::Deallocate() needs the allocated size, which is the
+        // appended one unless decompression failed.
+        if (block_size == block.size) {
+          dest_->AppendAndTakeOwnership(block.data, block_size,
+                                        &SnappySinkAllocator::Deallocate,
+                                        allocator_);
+        } else {
+          dest_->Append(block.data, block_size);
+          allocator_->Deallocate(block.data, block.size);
+        }
+        continue;
+      }
+      // The deleter is told the appended size, which can be less than the
+      // allocated one, so whether the block is pooled is passed separately.
+      dest_->AppendAndTakeOwnership(
+          block.data, block_size, &SnappySinkAllocator::Deleter,
+          block.size == kBlockSize ? &SnappySinkAllocator::kPooled : nullptr);
     }
     blocks_.clear();
   }
@@ -2170,26 +3682,48 @@ class SnappySinkAllocator {
 
   static void Deleter(void* arg, const char* bytes, size_t size) {
     // TODO: Switch to [[maybe_unused]] when we can assume C++17.
-    (void)arg;
     (void)size;
 
-    delete[] bytes;
+    if (arg == &kPooled) {
+      BlockPool::Free(const_cast<char*>(bytes));
+    } else {
+      delete[] bytes;
+    }
+  }
+
+  static void Deallocate(void* arg, const char* bytes, size_t size) {
+    static_cast<Allocator*>(arg)->Deallocate(const_cast<char*>(bytes), size);
   }
 
+  // The address of this marks pooled blocks for Deleter().
+  static char kPooled;
+
   Sink* dest_;
+  Allocator* allocator_;
   std::vector<Datablock> blocks_;
 
   // Note: copying this object is allowed
 };
 
+char SnappySinkAllocator::kPooled = 0;
+
 size_t UncompressAsMuchAsPossible(Source* compressed, Sink* uncompressed) {
-  SnappySinkAllocator allocator(uncompressed);
-  SnappyScatteredWriter<SnappySinkAllocator> writer(allocator);
+  return UncompressAsMuchAsPossible(compressed, uncompressed, nullptr);
+}
+
+size_t UncompressAsMuchAsPossible(Source* compressed, Sink* uncompressed,
+                                  Allocator* allocator) {
+  SnappySinkAllocator sink_allocator(uncompressed, allocator);
+  SnappyScatteredWriter<SnappySinkAllocator> writer(sink_allocator);
   InternalUncompress(compressed, &writer);
   return writer.Produced();
 }
 
 bool Uncompress(Source* compressed, Sink* uncompressed) {
+  return Uncompress(compressed, uncompressed, nullptr);
+}
+
+bool Uncompress(Source* compressed, Sink* uncompressed, Allocator* allocator) {
   // Read the uncompressed length from the front of the compressed input
   SnappyDecompressor decompressor(compressed);
   uint32_t uncompressed_len = 0;
@@ -2212,8 +3746,8 @@ bool Uncompress(Source* compressed, Sink* uncompressed) {
     uncompressed->Append(buf, writer.Produced());
     return result;
   } else {
-    SnappySinkAllocator allocator(uncompressed);
-    SnappyScatteredWriter<SnappySinkAllocator> writer(allocator);
+    SnappySinkAllocator sink_allocator(uncompressed, allocator);
+    SnappyScatteredWriter<SnappySinkAllocator> writer(sink_allocator);
     return InternalUncompressAllTags(&decompressor, &writer, compressed_len,
                                      uncompressed_len);
   }
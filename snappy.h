@@ -43,6 +43,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 #include "snappy-stubs-public.h"
 
@@ -50,6 +51,27 @@ namespace snappy {
   class Source;
   class Sink;
 
+  // Supplies the memory that snappy allocates internally, e.g. from a
+  // per-request arena. The routines below that take an "Allocator*" get all
+  // of their scratch memory, and the blocks they hand over to sinks, from it.
+  // A null "Allocator*" means the heap, as for the routines without one.
+  class Allocator {
+   public:
+    Allocator() { }
+    virtual ~Allocator();
+
+    // Returns a buffer of at least "size" bytes. Must not return nullptr.
+    virtual char* Allocate(size_t size) = 0;
+
+    // Releases "ptr", which Allocate(size) returned.
+    virtual void Deallocate(char* ptr, size_t size) = 0;
+
+   private:
+    // No copying
+    Allocator(const Allocator&);
+    void operator=(const Allocator&);
+  };
+
   // ------------------------------------------------------------------------
   // Generic compression/decompression routines.
   // ------------------------------------------------------------------------
@@ -58,6 +80,21 @@ namespace snappy {
   // number of bytes written.
   size_t Compress(Source* source, Sink* sink);
 
+  // Same as Compress(source, sink), with the working memory of the
+  // compressor taken from "*allocator".
+  size_t Compress(Source* source, Sink* sink, Allocator* allocator);
+
+  // Same as Compress(), and also stores the CRC-32C (Castagnoli) of the bytes
+  // read from "*source" in "*crc32c". Each input fragment is checksummed
+  // right before it is compressed, while it is in the CPU caches, instead of
+  // in a separate pass over the whole input.
+  size_t CompressWithCrc32c(Source* source, Sink* sink, uint32_t* crc32c);
+
+  // Returns the CRC-32C (Castagnoli) of "data[0..n-1]", as computed by the
+  // *WithCrc32c() routines. This is the unmasked checksum; the framing format
+  // stores a masked version of it.
+  uint32_t Crc32c(const char* data, size_t n);
+
   // Find the uncompressed length of the given stream, as given by the header.
   // Note that the true length could deviate from this; the stream could e.g.
   // be truncated.
@@ -92,6 +129,33 @@ namespace snappy {
   // returns false if the message is corrupted and could not be decompressed
   bool Uncompress(Source* compressed, Sink* uncompressed);
 
+  // Same as Uncompress(compressed, uncompressed), except that the blocks
+  // that may be handed to "*uncompressed" with Sink::AppendAndTakeOwnership()
+  // come from "*allocator" instead of the block pool below, and their deleter
+  // returns them to it. "*allocator" must outlive those blocks.
+  bool Uncompress(Source* compressed, Sink* uncompressed,
+                  Allocator* allocator);
+
+  // When "*uncompressed" cannot provide a flat buffer for all of the output,
+  // Uncompress() decompresses into kBlockSize blocks and hands them over with
+  // Sink::AppendAndTakeOwnership(). Those blocks can be recycled through a
+  // pool: each thread keeps up to "per_thread_blocks" freed blocks for itself,
+  // and up to "shared_blocks" more are kept in a pool shared by all threads,
+  // so that decompression does not hit the central heap for every block.
+  // Blocks beyond these limits are freed.
+  //
+  // Pooled blocks stay allocated until TrimBlockPool() is called or, for a
+  // thread's own blocks, the thread exits, which moves them to the shared
+  // pool. For example, limits of 4 and 64 keep up to 256 KiB per thread plus
+  // 4 MiB shared for the life of the process.
+  //
+  // The limits apply from the next time each thread frees a block. Both
+  // default to 0, which disables the pool.
+  void SetBlockPoolLimits(size_t per_thread_blocks, size_t shared_blocks);
+
+  // Frees the blocks in the shared pool and in the calling thread's pool.
+  void TrimBlockPool();
+
   // This routine uncompresses as much of the "compressed" as possible
   // into sink.  It returns the number of valid bytes added to sink
   // (extra invalid bytes may have been added due to errors; the caller
@@ -100,6 +164,10 @@ namespace snappy {
   // encountered.
   size_t UncompressAsMuchAsPossible(Source* compressed, Sink* uncompressed);
 
+  // Same as above, with blocks from "*allocator" as for Uncompress().
+  size_t UncompressAsMuchAsPossible(Source* compressed, Sink* uncompressed,
+                                    Allocator* allocator);
+
   // ------------------------------------------------------------------------
   // Lower-level character array based routines.  May be useful for
   // efficiency reasons in certain circumstances.
@@ -124,6 +192,12 @@ namespace snappy {
                    char* compressed,
                    size_t* compressed_length);
 
+  // Same as above, with the working memory of the compressor taken from
+  // "*allocator". Together with RawUncompress(), which allocates nothing,
+  // this lets callers keep all memory in their own buffers.
+  void RawCompress(const char* input, size_t input_length, char* compressed,
+                   size_t* compressed_length, Allocator* allocator);
+
   // Given data in "compressed[0..compressed_length-1]" generated by
   // calling the Snappy::Compress routine, this routine
   // stores the uncompressed data to
@@ -139,6 +213,49 @@ namespace snappy {
   // returns false if the message is corrupted and could not be decrypted
   bool RawUncompress(Source* compressed, char* uncompressed);
 
+  // Same as RawUncompress(compressed, compressed_length, uncompressed), but
+  // may use up to "num_threads" threads (including the calling one).
+  //
+  // The compressor never emits copies that reach back across the 64 KiB
+  // (kBlockSize) fragments it compresses independently. A first pass scans the
+  // tags, without producing output, to find the tags starting at fragment
+  // boundaries; the output is then split at some of them and the pieces are
+  // decoded concurrently straight into "uncompressed". Input where copies do
+  // reach across boundaries (e.g. produced by another encoder) is decoded
+  // serially. The scan costs about as much as IsValidCompressedBuffer(), so
+  // "num_threads" should not exceed the number of idle cores. Segments whose
+  // thread cannot be started are decoded by the calling thread, and builds
+  // without thread support (SNAPPY_WITH_THREADS=OFF) decode serially.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool ParallelRawUncompress(const char* compressed, size_t compressed_length,
+                             char* uncompressed, int num_threads);
+
+  // Same as RawUncompress(compressed, compressed_length, uncompressed), for
+  // input and output that will not be read again soon (e.g. when
+  // decompressing large archives into buffers that are written to disk).
+  // Long literals are written with non-temporal stores, and output that no
+  // copy produced by the compressor can reach any more is evicted from the
+  // CPU caches while decompressing, so the output occupies at most ~80 KiB of
+  // cache at a time instead of displacing the caller's working set. Consumed
+  // input is evicted as well, and the output is evicted entirely when this
+  // returns. Eviction needs the x86 CLFLUSHOPT instruction, which is detected
+  // at runtime; otherwise only the streaming stores are used.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool RawUncompressNonTemporal(const char* compressed,
+                                size_t compressed_length, char* uncompressed);
+
+  // Same as RawUncompress(), and also stores the CRC-32C of the uncompressed
+  // data in "*crc32c". The output is checksummed in small pieces while it is
+  // being decompressed and is still in the L1 cache, which is much cheaper than
+  // checksumming it in a separate pass afterwards.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool RawUncompressWithCrc32c(const char* compressed,
+                               size_t compressed_length, char* uncompressed,
+                               uint32_t* crc32c);
+
   // Given data in "compressed[0..compressed_length-1]" generated by
   // calling the Snappy::Compress routine, this routine
   // stores the uncompressed data to the iovec "iov". The number of physical
@@ -161,6 +278,35 @@ namespace snappy {
   bool RawUncompressToIOVec(Source* compressed, const struct iovec* iov,
                             size_t iov_cnt);
 
+  // Same as RawUncompressToIOVec(), and also stores the CRC-32C of the
+  // uncompressed data in "*crc32c", computed while decompressing like
+  // RawUncompressWithCrc32c() does.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool RawUncompressToIOVecWithCrc32c(const char* compressed,
+                                      size_t compressed_length,
+                                      const struct iovec* iov, size_t iov_cnt,
+                                      uint32_t* crc32c);
+
+  // Decompresses "compressed[0..compressed_length-1]" into a list of buffers
+  // "*iov" whose concatenation is the uncompressed data, without copying
+  // literals of at least "min_reference_length" bytes: their buffers point
+  // straight into "compressed". Only copies and shorter literals are
+  // materialized, into "*scratch". This makes writev() of incompressible
+  // data, which is stored almost entirely as long literals, nearly zero-copy.
+  // Compressible data is better decompressed with RawUncompressToIOVec().
+  //
+  // The buffers stay valid as long as "compressed" and "*scratch" are neither
+  // modified nor destroyed. The previous contents of "*scratch" and "*iov" are
+  // replaced.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool UncompressToIOVecReferences(const char* compressed,
+                                   size_t compressed_length,
+                                   size_t min_reference_length,
+                                   std::string* scratch,
+                                   std::vector<struct iovec>* iov);
+
   // Returns the maximal size of the compressed representation of
   // input data that is "source_bytes" bytes in length;
   size_t MaxCompressedLength(size_t source_bytes);
@@ -187,6 +333,93 @@ namespace snappy {
   // unspecified prefix of *compressed.
   bool IsValidCompressed(Source* compressed);
 
+  // Searches the data that "compressed[0..compressed_length-1]" decompresses
+  // to for "pattern[0..pattern_length-1]", and appends the uncompressed
+  // offsets of all occurrences, including overlapping ones, to "*offsets" in
+  // increasing order. An empty pattern has no occurrences.
+  //
+  // The data is searched in small pieces as it is decompressed, while they are
+  // still in the L1 cache. The output is kept in a window that holds its last
+  // max(64 KiB, pattern_length - 1) bytes plus 192 KiB, which covers every
+  // copy that Compress() emits. Input from other encoders that copies from
+  // further back is validated first and then decompressed in full.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool FindInCompressed(const char* compressed, size_t compressed_length,
+                        const char* pattern, size_t pattern_length,
+                        std::vector<size_t>* offsets);
+
+  // Stores in "*out" a compressed buffer that decompresses to the
+  // concatenation of what "a[0..a_length-1]" and "b[0..b_length-1]"
+  // decompress to, without decompressing either: the result is a new length
+  // header followed by the elements of "a" and "b". Runs at memcpy speed.
+  //
+  // Only the length headers are checked; if "a" or "b" may be corrupted, check
+  // them (or the result) with IsValidCompressedBuffer().
+  //
+  // returns false if a header is corrupted, or if the total uncompressed length
+  // does not fit in 32 bits
+  bool ConcatCompressed(const char* a, size_t a_length, const char* b,
+                        size_t b_length, std::string* out);
+
+  // Splits "compressed[0..compressed_length-1]" into compressed "*pieces" that
+  // decompress to consecutive parts of the original data, without
+  // recompressing. The data is split at the fragment boundaries (every
+  // kBlockSize bytes of uncompressed data) that no copy reaches back across,
+  // which for the output of Compress() is all of them. ConcatCompressed()
+  // joins the pieces back into the original buffer.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool SplitCompressed(const char* compressed, size_t compressed_length,
+                       std::vector<std::string>* pieces);
+
+  // Stores in "*out" a re-encoding of "compressed[0..compressed_length-1]"
+  // that is usually smaller, and never larger. The elements of the original
+  // serve as hints: its copies are extended in both directions, the offset
+  // of the last copy is tried first, and new matches, also reaching across
+  // fragments, are only searched for in what were literals. This is cheaper
+  // than searching all the data again, and is meant for data that is kept
+  // around for long.
+  //
+  // returns false if the message is corrupted and could not be decrypted
+  bool Recompress(const char* compressed, size_t compressed_length,
+                  std::string* out);
+
+  // ------------------------------------------------------------------------
+  // String based routines for strings with other allocators, such as
+  // std::pmr::string.
+  // ------------------------------------------------------------------------
+
+  // Same as Compress(input, input_length, compressed) for std::string, with
+  // the working memory of the compressor taken from "*allocator".
+  template <typename StringAllocator>
+  size_t Compress(const char* input, size_t input_length,
+                  std::basic_string<char, std::char_traits<char>,
+                                    StringAllocator>* compressed,
+                  Allocator* allocator) {
+    compressed->resize(MaxCompressedLength(input_length));
+    size_t compressed_length;
+    RawCompress(input, input_length, &(*compressed)[0], &compressed_length,
+                allocator);
+    compressed->resize(compressed_length);
+    return compressed_length;
+  }
+
+  // Same as Uncompress(compressed, compressed_length, uncompressed) for
+  // std::string.
+  template <typename StringAllocator>
+  bool Uncompress(const char* compressed, size_t compressed_length,
+                  std::basic_string<char, std::char_traits<char>,
+                                    StringAllocator>* uncompressed) {
+    size_t ulength;
+    if (!GetUncompressedLength(compressed, compressed_length, &ulength) ||
+        ulength > uncompressed->max_size()) {
+      return false;
+    }
+    uncompressed->resize(ulength);
+    return RawUncompress(compressed, compressed_length, &(*uncompressed)[0]);
+  }
+
   // The size of a compression block. Note that many parts of the compression
   // code assumes that kBlockSize <= 65536; in particular, the hash table
   // can only store 16-bit offsets, and EmitCopy() also assumes the offset
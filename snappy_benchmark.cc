@@ -26,17 +26,46 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
 #include <string>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define SNAPPY_BENCHMARK_HAVE_RDTSC 1
+#else
+#define SNAPPY_BENCHMARK_HAVE_RDTSC 0
+#endif
+
 #include "snappy-test.h"
 
+#if HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // HAVE_LINUX_PERF_EVENT_H
+
 #include "benchmark/benchmark.h"
 
+#include "snappy-appendable.h"
+#include "snappy-c.h"
+#include "snappy-decompression-writer.h"
 #include "snappy-internal.h"
 #include "snappy-sinksource.h"
+#include "snappy-tag-iterator.h"
 #include "snappy.h"
 #include "snappy_test_data.h"
 
@@ -44,31 +73,317 @@ namespace snappy {
 
 namespace {
 
+// Counts what the calling thread does from construction until Stop(), and
+// Report() adds it to the benchmark.
+//
+// Allocations are always counted, and reported as allocs_per_iteration and
+// alloc_bytes_per_iteration. Hardware events are reported as cycles_per_byte,
+// IPC and misses per KiB of the bytes processed. Counting them is opt-in,
+// through the SNAPPY_BENCHMARK_PERF_COUNTERS environment variable, because it
+// needs perf_event_open(2) and a PMU the kernel lets us use. When either is
+// missing the benchmarks run as usual without these counters.
+//
+// Neither kind of count follows threads that the benchmark spawns, so
+// benchmarks that do their work on such threads pass kSpawnsThreads and
+// report neither.
+class PerfCounters {
+ public:
+  enum Threads {
+    kBenchmarkThread,
+    kSpawnsThreads,
+  };
+
+  explicit PerfCounters(benchmark::State& state,
+                        Threads threads = kBenchmarkThread);
+  ~PerfCounters();
+
+  // Stops counting. Call it right after the benchmark loop.
+  void Stop();
+
+  // Reports the counts of this thread. Must be called after Stop() and
+  // state.SetBytesProcessed().
+  void Report();
+
+ private:
+  enum Event {
+    kCycles,  // The group leader, so it has to be opened first.
+    kInstructions,
+    kBranchMisses,
+    kL1DMisses,
+    kLLCMisses,
+    kNumEvents,
+  };
+
+  static bool Requested();
+  void Open();
+
+  benchmark::State& state_;
+  const bool enabled_;
+  AllocationCounter allocation_counter_;
+  int64_t allocations_ = 0;
+  int64_t allocated_bytes_ = 0;
+  // File descriptors of the open events, or -1.
+  int fds_[kNumEvents];
+  // Events in the order the kernel reports them for the group.
+  Event order_[kNumEvents];
+  int num_open_ = 0;
+
+  // No copying
+  PerfCounters(const PerfCounters&);
+  void operator=(const PerfCounters&);
+};
+
+PerfCounters::PerfCounters(benchmark::State& state, Threads threads)
+    : state_(state), enabled_(threads == kBenchmarkThread) {
+  for (int i = 0; i < kNumEvents; ++i) fds_[i] = -1;
+  if (!enabled_ || !Requested()) return;
+  Open();
+  if (num_open_ == 0) {
+    static const bool warned = [] {
+      std::fprintf(stderr,
+                   "Hardware performance counters are not available, "
+                   "not reporting them.\n");
+      return true;
+    }();
+    (void)warned;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+#if HAVE_LINUX_PERF_EVENT_H
+  for (int i = 0; i < kNumEvents; ++i) {
+    if (fds_[i] >= 0) close(fds_[i]);
+  }
+#endif  // HAVE_LINUX_PERF_EVENT_H
+}
+
+bool PerfCounters::Requested() {
+  static const bool requested = [] {
+    const char* value = std::getenv("SNAPPY_BENCHMARK_PERF_COUNTERS");
+    return value != nullptr && *value != '\0' && std::strcmp(value, "0") != 0;
+  }();
+  return requested;
+}
+
+void PerfCounters::Open() {
+#if HAVE_LINUX_PERF_EVENT_H
+  constexpr uint64_t kL1DReadMiss =
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  const struct {
+    uint32_t type;
+    uint64_t config;
+  } kConfigs[kNumEvents] = {
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {PERF_TYPE_HW_CACHE, kL1DReadMiss},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  };
+
+  for (int i = 0; i < kNumEvents; ++i) {
+    const int leader = fds_[kCycles];
+    // Without cycles there is no group to add the other events to.
+    if (i != kCycles && leader < 0) break;
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = kConfigs[i].type;
+    attr.config = kConfigs[i].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Only the leader starts disabled, the others follow it.
+    attr.disabled = leader < 0;
+    const long fd = syscall(__NR_perf_event_open, &attr, /*pid=*/0,
+                            /*cpu=*/-1, /*group_fd=*/leader, /*flags=*/0);
+    // Events the CPU does not support are left out.
+    if (fd < 0) continue;
+    fds_[i] = static_cast<int>(fd);
+    order_[num_open_++] = static_cast<Event>(i);
+  }
+  if (num_open_ == 0) return;
+  ioctl(fds_[kCycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds_[kCycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif  // HAVE_LINUX_PERF_EVENT_H
+}
+
+void PerfCounters::Stop() {
+#if HAVE_LINUX_PERF_EVENT_H
+  if (num_open_ > 0) {
+    ioctl(fds_[kCycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif  // HAVE_LINUX_PERF_EVENT_H
+  allocations_ = allocation_counter_.allocations();
+  allocated_bytes_ = allocation_counter_.bytes();
+}
+
+void PerfCounters::Report() {
+  if (!enabled_) return;
+  // Summed over the threads, and divided by the iterations of all of them.
+  state_.counters["allocs_per_iteration"] = benchmark::Counter(
+      static_cast<double>(allocations_), benchmark::Counter::kAvgIterations);
+  state_.counters["alloc_bytes_per_iteration"] =
+      benchmark::Counter(static_cast<double>(allocated_bytes_),
+                         benchmark::Counter::kAvgIterations);
+
+#if HAVE_LINUX_PERF_EVENT_H
+  if (num_open_ == 0) return;
+
+  // nr, time_enabled, time_running and then one value per event.
+  uint64_t buffer[3 + kNumEvents];
+  const ssize_t n = read(fds_[kCycles], buffer, sizeof(buffer));
+  if (n < static_cast<ssize_t>((3 + num_open_) * sizeof(uint64_t))) return;
+  // The group was multiplexed with other events if it did not run all the
+  // time it was enabled, so extrapolate to the whole period.
+  const uint64_t enabled = buffer[1];
+  const uint64_t running = buffer[2];
+  if (running == 0) return;
+  const double scale = static_cast<double>(enabled) / running;
+  double counts[kNumEvents] = {};
+  for (int i = 0; i < num_open_; ++i) {
+    counts[order_[i]] = buffer[3 + i] * scale;
+  }
+
+  // Each thread reports its own ratios, so average rather than sum them.
+  constexpr benchmark::Counter::Flags kFlags = benchmark::Counter::kAvgThreads;
+  const double bytes = static_cast<double>(state_.bytes_processed());
+  if (bytes > 0) {
+    state_.counters["cycles_per_byte"] =
+        benchmark::Counter(counts[kCycles] / bytes, kFlags);
+  }
+  const double kib = bytes / 1024;
+  const struct {
+    Event event;
+    const char* name;
+  } kPerKiB[] = {
+      {kBranchMisses, "branch_misses_per_KiB"},
+      {kL1DMisses, "L1D_misses_per_KiB"},
+      {kLLCMisses, "LLC_misses_per_KiB"},
+  };
+  for (const auto& per_kib : kPerKiB) {
+    if (fds_[per_kib.event] < 0 || kib == 0) continue;
+    state_.counters[per_kib.name] =
+        benchmark::Counter(counts[per_kib.event] / kib, kFlags);
+  }
+  if (fds_[kInstructions] >= 0 && counts[kCycles] > 0) {
+    state_.counters["IPC"] =
+        benchmark::Counter(counts[kInstructions] / counts[kCycles], kFlags);
+  }
+#endif  // HAVE_LINUX_PERF_EVENT_H
+}
+
+// The body of BM_UFlat, also used for corpus files and synthetic data.
+void RunUFlat(benchmark::State& state, const std::string& contents,
+              const std::string& label) {
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  char* dst = new char[contents.size()];
+
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    CHECK(snappy::RawUncompress(zcontents.data(), zcontents.size(), dst));
+    benchmark::DoNotOptimize(dst);
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(label);
+
+  delete[] dst;
+}
+
 void BM_UFlat(benchmark::State& state) {
   // Pick file to process based on state.range(0).
   int file_index = state.range(0);
 
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  RunUFlat(state,
+           ReadTestDataFile(kTestDataFiles[file_index].filename,
+                            kTestDataFiles[file_index].size_limit),
+           kTestDataFiles[file_index].label);
+}
+BENCHMARK(BM_UFlat)->DenseRange(0, ARRAYSIZE(kTestDataFiles) - 1);
+
+// Working set sizes that land in the L2 cache, the L3 cache and DRAM on
+// typical server CPUs, for the *WorkingSet benchmarks.
+constexpr struct {
+  const char* label;
+  size_t size;
+} kWorkingSets[] = {
+    {"L2", 256 << 10},
+    {"L3", 8 << 20},
+    {"DRAM", 256 << 20},
+};
+
+// Copies "data" into "copies" distinct buffers of at least "buffer_size"
+// bytes within "*storage", whose starts are returned.
+std::vector<char*> MakeCopies(const std::string& data, size_t buffer_size,
+                              size_t copies, std::vector<char>* storage) {
+  // Keep the buffers cache line aligned relative to each other.
+  const size_t stride = (buffer_size + 63) & ~size_t{63};
+  storage->resize(stride * copies);
+  std::vector<char*> buffers;
+  for (size_t i = 0; i < copies; ++i) {
+    char* buffer = storage->data() + i * stride;
+    std::memcpy(buffer, data.data(), data.size());
+    buffers.push_back(buffer);
+  }
+  return buffers;
+}
+
+// Same as BM_UFlat, except that each iteration decompresses a different copy
+// of the compressed file into a different output buffer. The copies and
+// buffers add up to the working set given by state.range(1), so that after
+// the first pass the data comes from that level of the memory hierarchy
+// instead of the L1 cache. BM_UFlat is the in-cache case.
+void BM_UFlatWorkingSet(benchmark::State& state) {
+  int file_index = state.range(0);
+  const auto& working_set = kWorkingSets[state.range(1)];
+
   CHECK_GE(file_index, 0);
   CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
   std::string contents =
       ReadTestDataFile(kTestDataFiles[file_index].filename,
                        kTestDataFiles[file_index].size_limit);
-
   std::string zcontents;
   snappy::Compress(contents.data(), contents.size(), &zcontents);
-  char* dst = new char[contents.size()];
 
+  const size_t copies = std::max<size_t>(
+      1, working_set.size / (zcontents.size() + contents.size()));
+  std::vector<char> source_storage;
+  std::vector<char*> sources =
+      MakeCopies(zcontents, zcontents.size(), copies, &source_storage);
+  std::vector<char> dst_storage;
+  std::vector<char*> dsts =
+      MakeCopies(std::string(), contents.size(), copies, &dst_storage);
+
+  size_t i = 0;
+  PerfCounters perf_counters(state);
   for (auto s : state) {
-    CHECK(snappy::RawUncompress(zcontents.data(), zcontents.size(), dst));
-    benchmark::DoNotOptimize(dst);
+    CHECK(snappy::RawUncompress(sources[i], zcontents.size(), dsts[i]));
+    benchmark::DoNotOptimize(dsts[i]);
+    if (++i == copies) i = 0;
   }
+  perf_counters.Stop();
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           static_cast<int64_t>(contents.size()));
-  state.SetLabel(kTestDataFiles[file_index].label);
-
-  delete[] dst;
+  perf_counters.Report();
+  state.SetLabel(StrFormat("%s %s (%d copies)",
+                           kTestDataFiles[file_index].label, working_set.label,
+                           static_cast<int>(copies)));
 }
-BENCHMARK(BM_UFlat)->DenseRange(0, ARRAYSIZE(kTestDataFiles) - 1);
+BENCHMARK(BM_UFlatWorkingSet)
+    ->Args({0, 0})->Args({0, 1})->Args({0, 2})
+    ->Args({2, 0})->Args({2, 1})->Args({2, 2})
+    ->Args({10, 0})->Args({10, 1})->Args({10, 2});
+
+// Each thread decompresses its own copy of the file. The bytes_per_second of
+// these runs add up all threads.
+BENCHMARK(BM_UFlat)->Arg(0)->Arg(2)->Arg(5)->ThreadRange(1, 16)->UseRealTime();
 
 struct SourceFiles {
   SourceFiles() {
@@ -91,6 +406,7 @@ void BM_UFlatMedley(benchmark::State& state) {
 
   std::vector<char> dst(source->max_size);
 
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     for (int i = 0; i < SourceFiles::kFiles; i++) {
       CHECK(snappy::RawUncompress(source->zcontents[i].data(),
@@ -98,6 +414,7 @@ void BM_UFlatMedley(benchmark::State& state) {
       benchmark::DoNotOptimize(dst);
     }
   }
+  perf_counters.Stop();
 
   int64_t source_sizes = 0;
   for (int i = 0; i < SourceFiles::kFiles; i++) {
@@ -105,9 +422,242 @@ void BM_UFlatMedley(benchmark::State& state) {
   }
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           source_sizes);
+  perf_counters.Report();
 }
 BENCHMARK(BM_UFlatMedley);
 
+void BM_UFlatParallel(benchmark::State& state) {
+  // Pick number of threads based on state.range(0).
+  const int num_threads = state.range(0);
+
+  // Decompress all test files concatenated, so that there are enough 64 KiB
+  // fragments to spread across the threads.
+  std::string contents;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    contents += ReadTestDataFile(kTestDataFiles[i].filename,
+                                 kTestDataFiles[i].size_limit);
+  }
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  std::vector<char> dst(contents.size());
+
+  PerfCounters perf_counters(state, PerfCounters::kSpawnsThreads);
+  for (auto s : state) {
+    CHECK(snappy::ParallelRawUncompress(zcontents.data(), zcontents.size(),
+                                        dst.data(), num_threads));
+    benchmark::DoNotOptimize(dst);
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+}
+BENCHMARK(BM_UFlatParallel)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+// Decompresses and checksums all test files concatenated, either with
+// RawUncompress() followed by a separate Crc32c() pass (state.range(0) == 0) or
+// with RawUncompressWithCrc32c() (state.range(0) == 1).
+void BM_UFlatCrc32c(benchmark::State& state) {
+  const bool fused = state.range(0) != 0;
+
+  std::string contents;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    contents += ReadTestDataFile(kTestDataFiles[i].filename,
+                                 kTestDataFiles[i].size_limit);
+  }
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  std::vector<char> dst(contents.size());
+  const uint32_t expected_crc =
+      snappy::Crc32c(contents.data(), contents.size());
+
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    uint32_t crc;
+    if (fused) {
+      CHECK(snappy::RawUncompressWithCrc32c(zcontents.data(), zcontents.size(),
+                                            dst.data(), &crc));
+    } else {
+      CHECK(snappy::RawUncompress(zcontents.data(), zcontents.size(),
+                                  dst.data()));
+      crc = snappy::Crc32c(dst.data(), dst.size());
+    }
+    CHECK_EQ(crc, expected_crc);
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(fused ? "fused" : "separate");
+}
+BENCHMARK(BM_UFlatCrc32c)->DenseRange(0, 1);
+
+// Measures how much decompressing a large buffer evicts the working set of a
+// co-running workload. state.range(0) selects RawUncompress() (0) or
+// RawUncompressNonTemporal() (1); state.range(1) is the working set size in
+// KiB. After each decompression the benchmark walks the working set in random
+// order, one load per cache line, and reports the average latency of those
+// loads as "hot_ns_per_line". The walk also brings the working set back into
+// the caches for the next iteration.
+void BM_UFlatCachePollution(benchmark::State& state) {
+  const bool non_temporal = state.range(0) != 0;
+  const size_t hot_set_size = static_cast<size_t>(state.range(1)) << 10;
+
+  // The output should be larger than the last level cache.
+  std::string contents;
+  while (contents.size() < (32 << 20)) {
+    for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+      contents += ReadTestDataFile(kTestDataFiles[i].filename,
+                                   kTestDataFiles[i].size_limit);
+    }
+  }
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  std::vector<char> dst(contents.size());
+
+  // A random cyclic permutation of the cache lines in the working set, so that
+  // the walk cannot be hidden by hardware prefetching.
+  constexpr size_t kLineWords = 64 / sizeof(size_t);
+  const size_t num_lines = hot_set_size / 64;
+  std::vector<size_t> order(num_lines);
+  for (size_t i = 0; i < num_lines; ++i) order[i] = i;
+  std::shuffle(order.begin(), order.end(), std::mt19937(301));
+  std::vector<size_t> hot_set(num_lines * kLineWords);
+  for (size_t i = 0; i < num_lines; ++i) {
+    hot_set[order[i] * kLineWords] = order[(i + 1) % num_lines] * kLineWords;
+  }
+
+  double hot_set_seconds = 0;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    if (non_temporal) {
+      CHECK(snappy::RawUncompressNonTemporal(zcontents.data(),
+                                             zcontents.size(), dst.data()));
+    } else {
+      CHECK(snappy::RawUncompress(zcontents.data(), zcontents.size(),
+                                  dst.data()));
+    }
+    benchmark::DoNotOptimize(dst);
+
+    state.PauseTiming();
+    const auto start = std::chrono::steady_clock::now();
+    size_t index = 0;
+    for (size_t i = 0; i < num_lines; ++i) index = hot_set[index];
+    benchmark::DoNotOptimize(index);
+    hot_set_seconds += std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    state.ResumeTiming();
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.counters["hot_ns_per_line"] =
+      hot_set_seconds * 1e9 / (static_cast<double>(state.iterations()) *
+                               static_cast<double>(num_lines));
+  state.SetLabel(non_temporal ? "non-temporal" : "regular");
+}
+BENCHMARK(BM_UFlatCachePollution)
+    ->Args({0, 256})
+    ->Args({1, 256})
+    ->Args({0, 2048})
+    ->Args({1, 2048});
+
+// A DecompressionWriter into a flat array, the same destination as
+// RawUncompress(). Without GetBase() ("flat" false), it measures the cost of
+// UncompressTo()'s generic loop.
+class ArrayDecompressionWriter {
+ public:
+  ArrayDecompressionWriter(char* dst, bool flat) : base_(dst), flat_(flat) {}
+
+  void SetExpectedLength(size_t len) { limit_ = base_ + len; }
+  bool CheckLength() const { return op_ == limit_; }
+
+  char* GetOutputPtr() { return base_; }
+  void SetOutputPtr(char* op) { op_ = op; }
+
+  bool Append(const char* ip, size_t len, char** op) {
+    if (static_cast<size_t>(limit_ - *op) < len) return false;
+    std::memcpy(*op, ip, len);
+    *op += len;
+    return true;
+  }
+  bool TryFastAppend(const char* ip, size_t available, size_t len,
+                     char** op) {
+    // Copy 16 bytes unconditionally when there is room on both sides.
+    if (len > 16 || available < 16 || limit_ - *op < 16) return false;
+    std::memcpy(*op, ip, 16);
+    *op += len;
+    return true;
+  }
+  bool AppendFromSelf(size_t offset, size_t len, char** op) {
+    if (offset == 0 || offset > static_cast<size_t>(*op - base_) ||
+        static_cast<size_t>(limit_ - *op) < len) {
+      return false;
+    }
+    char* const dst = *op;
+    if (offset >= len) {
+      std::memcpy(dst, dst - offset, len);
+    } else {
+      for (size_t i = 0; i < len; ++i) dst[i] = dst[i - offset];
+    }
+    *op += len;
+    return true;
+  }
+  void Flush() {}
+  char* GetBase(ptrdiff_t* op_limit_min_slop) {
+    if (!flat_) return nullptr;
+    const ptrdiff_t len = limit_ - base_;
+    *op_limit_min_slop =
+        len - std::min<ptrdiff_t>(len, kDecompressionSlopBytes - 1);
+    return base_;
+  }
+
+ private:
+  char* const base_;
+  const bool flat_;
+  char* limit_ = nullptr;
+  char* op_ = nullptr;
+};
+
+// Same as BM_UFlat, through UncompressTo() and ArrayDecompressionWriter, with
+// (state.range(1) == 1) or without GetBase().
+void BM_UFlatDecompressionWriter(benchmark::State& state) {
+  int file_index = state.range(0);
+  bool flat = state.range(1) != 0;
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  std::string contents =
+      ReadTestDataFile(kTestDataFiles[file_index].filename,
+                       kTestDataFiles[file_index].size_limit);
+
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  std::vector<char> dst(contents.size());
+
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    ArrayDecompressionWriter writer(dst.data(), flat);
+    CHECK(snappy::UncompressTo(zcontents.data(), zcontents.size(), &writer));
+    benchmark::DoNotOptimize(dst.data());
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(std::string(kTestDataFiles[file_index].label) +
+                 (flat ? " (GetBase)" : " (generic)"));
+}
+
+void DecompressionWriterArguments(benchmark::internal::Benchmark* b) {
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    b->Args({i, 0})->Args({i, 1});
+  }
+}
+BENCHMARK(BM_UFlatDecompressionWriter)->Apply(DecompressionWriterArguments);
+
 void BM_UValidate(benchmark::State& state) {
   // Pick file to process based on state.range(0).
   int file_index = state.range(0);
@@ -121,24 +671,59 @@ void BM_UValidate(benchmark::State& state) {
   std::string zcontents;
   snappy::Compress(contents.data(), contents.size(), &zcontents);
 
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     CHECK(snappy::IsValidCompressedBuffer(zcontents.data(), zcontents.size()));
   }
+  perf_counters.Stop();
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
   state.SetLabel(kTestDataFiles[file_index].label);
 }
 BENCHMARK(BM_UValidate)->DenseRange(0, ARRAYSIZE(kTestDataFiles) - 1);
 
+void BM_UTagIterator(benchmark::State& state) {
+  // Pick file to process based on state.range(0).
+  int file_index = state.range(0);
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  std::string contents =
+      ReadTestDataFile(kTestDataFiles[file_index].filename,
+                       kTestDataFiles[file_index].size_limit);
+
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    snappy::CompressedTagIterator it(zcontents.data(), zcontents.size());
+    snappy::CompressedTag tag;
+    size_t num_copies = 0;
+    while (it.Next(&tag)) num_copies += !tag.is_literal;
+    CHECK(it.done());
+    benchmark::DoNotOptimize(num_copies);
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(kTestDataFiles[file_index].label);
+}
+BENCHMARK(BM_UTagIterator)->DenseRange(0, ARRAYSIZE(kTestDataFiles) - 1);
+
 void BM_UValidateMedley(benchmark::State& state) {
   static const SourceFiles* const source = new SourceFiles();
 
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     for (int i = 0; i < SourceFiles::kFiles; i++) {
       CHECK(snappy::IsValidCompressedBuffer(source->zcontents[i].data(),
                                             source->zcontents[i].size()));
     }
   }
+  perf_counters.Stop();
 
   int64_t source_sizes = 0;
   for (int i = 0; i < SourceFiles::kFiles; i++) {
@@ -146,9 +731,54 @@ void BM_UValidateMedley(benchmark::State& state) {
   }
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           source_sizes);
+  perf_counters.Report();
 }
 BENCHMARK(BM_UValidateMedley);
 
+// Searches all test files concatenated, whose decompressed size exceeds
+// common L2 cache sizes, for a pattern that does not occur in them. The data
+// is either decompressed and then scanned (state.range(0) == 0), or searched
+// with FindInCompressed() (state.range(0) == 1).
+void BM_UFind(benchmark::State& state) {
+  const bool in_compressed = state.range(0) != 0;
+
+  std::string contents;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    contents += ReadTestDataFile(kTestDataFiles[i].filename,
+                                 kTestDataFiles[i].size_limit);
+  }
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  const std::string pattern = "the snappy pattern";
+  CHECK_EQ(contents.find(pattern), std::string::npos);
+
+  std::string uncompressed;
+  std::vector<size_t> offsets;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    offsets.clear();
+    if (in_compressed) {
+      CHECK(snappy::FindInCompressed(zcontents.data(), zcontents.size(),
+                                     pattern.data(), pattern.size(),
+                                     &offsets));
+    } else {
+      CHECK(snappy::Uncompress(zcontents.data(), zcontents.size(),
+                               &uncompressed));
+      for (size_t pos = uncompressed.find(pattern); pos != std::string::npos;
+           pos = uncompressed.find(pattern, pos + 1)) {
+        offsets.push_back(pos);
+      }
+    }
+    CHECK(offsets.empty());
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(in_compressed ? "FindInCompressed" : "Uncompress+find");
+}
+BENCHMARK(BM_UFind)->DenseRange(0, 1);
+
 void BM_UIOVec(benchmark::State& state) {
   // Pick file to process based on state.range(0).
   int file_index = state.range(0);
@@ -182,19 +812,52 @@ void BM_UIOVec(benchmark::State& state) {
     used_so_far += iov[i].iov_len;
   }
 
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     CHECK(snappy::RawUncompressToIOVec(zcontents.data(), zcontents.size(), iov,
                                        kNumEntries));
     benchmark::DoNotOptimize(iov);
   }
+  perf_counters.Stop();
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
   state.SetLabel(kTestDataFiles[file_index].label);
 
   delete[] dst;
 }
 BENCHMARK(BM_UIOVec)->DenseRange(0, 4);
 
+void BM_UIOVecReferences(benchmark::State& state) {
+  // Pick file to process based on state.range(0).
+  int file_index = state.range(0);
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  std::string contents =
+      ReadTestDataFile(kTestDataFiles[file_index].filename,
+                       kTestDataFiles[file_index].size_limit);
+
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+
+  std::string scratch;
+  std::vector<struct iovec> iov;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    CHECK(snappy::UncompressToIOVecReferences(zcontents.data(),
+                                              zcontents.size(), 64, &scratch,
+                                              &iov));
+    benchmark::DoNotOptimize(iov.data());
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(kTestDataFiles[file_index].label);
+}
+BENCHMARK(BM_UIOVecReferences)->DenseRange(0, 4);
+
 void BM_UFlatSink(benchmark::State& state) {
   // Pick file to process based on state.range(0).
   int file_index = state.range(0);
@@ -209,14 +872,17 @@ void BM_UFlatSink(benchmark::State& state) {
   snappy::Compress(contents.data(), contents.size(), &zcontents);
   char* dst = new char[contents.size()];
 
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     snappy::ByteArraySource source(zcontents.data(), zcontents.size());
     snappy::UncheckedByteArraySink sink(dst);
     CHECK(snappy::Uncompress(&source, &sink));
     benchmark::DoNotOptimize(sink);
   }
+  perf_counters.Stop();
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
   state.SetLabel(kTestDataFiles[file_index].label);
 
   std::string s(dst, contents.size());
@@ -227,34 +893,275 @@ void BM_UFlatSink(benchmark::State& state) {
 
 BENCHMARK(BM_UFlatSink)->DenseRange(0, ARRAYSIZE(kTestDataFiles) - 1);
 
-void BM_ZFlat(benchmark::State& state) {
-  // Pick file to process based on state.range(0).
+// A Sink that consumes each block as soon as it is handed over, the way a
+// network or file writer would, so blocks go back to the pool right away.
+class ConsumingSink : public snappy::Sink {
+ public:
+  void Append(const char* data, size_t n) override {
+    benchmark::DoNotOptimize(data);
+    bytes_ += n;
+  }
+
+  void AppendAndTakeOwnership(char* bytes, size_t n,
+                              void (*deleter)(void*, const char*, size_t),
+                              void* deleter_arg) override {
+    Append(bytes, n);
+    (*deleter)(deleter_arg, bytes, n);
+  }
+
+  size_t bytes() const { return bytes_; }
+
+ private:
+  size_t bytes_ = 0;
+};
+
+// Decompresses into blocks handed over with AppendAndTakeOwnership(), with
+// the block pool enabled (state.range(1) == 1) or disabled.
+void BM_UScatteredSink(benchmark::State& state) {
   int file_index = state.range(0);
+  bool pooled = state.range(1) != 0;
 
   CHECK_GE(file_index, 0);
   CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
   std::string contents =
       ReadTestDataFile(kTestDataFiles[file_index].filename,
                        kTestDataFiles[file_index].size_limit);
+
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+
+  if (pooled) snappy::SetBlockPoolLimits(4, 64);
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    snappy::ByteArraySource source(zcontents.data(), zcontents.size());
+    ConsumingSink sink;
+    CHECK(snappy::Uncompress(&source, &sink));
+    CHECK_EQ(sink.bytes(), contents.size());
+  }
+  perf_counters.Stop();
+  snappy::SetBlockPoolLimits(0, 0);
+  snappy::TrimBlockPool();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(std::string(kTestDataFiles[file_index].label) +
+                 (pooled ? " (pooled)" : " (heap)"));
+}
+
+BENCHMARK(BM_UScatteredSink)
+    ->Args({0, 0})->Args({0, 1})
+    ->Args({2, 0})->Args({2, 1})
+    ->Args({5, 0})->Args({5, 1});
+
+// Decompresses into a StringSink (state.range(1) == 0) or a RopeSink.
+void BM_UGrowableSink(benchmark::State& state) {
+  int file_index = state.range(0);
+  bool rope = state.range(1) != 0;
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  std::string contents =
+      ReadTestDataFile(kTestDataFiles[file_index].filename,
+                       kTestDataFiles[file_index].size_limit);
+
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    snappy::ByteArraySource source(zcontents.data(), zcontents.size());
+    if (rope) {
+      snappy::RopeSink sink;
+      CHECK(snappy::Uncompress(&source, &sink));
+      CHECK_EQ(sink.size(), contents.size());
+    } else {
+      std::string uncompressed;
+      snappy::StringSink sink(&uncompressed);
+      CHECK(snappy::Uncompress(&source, &sink));
+      CHECK_EQ(uncompressed.size(), contents.size());
+    }
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(std::string(kTestDataFiles[file_index].label) +
+                 (rope ? " (rope)" : " (string)"));
+}
+
+BENCHMARK(BM_UGrowableSink)
+    ->Args({0, 0})->Args({0, 1})
+    ->Args({2, 0})->Args({2, 1})
+    ->Args({5, 0})->Args({5, 1});
+
+// The body of BM_ZFlat, also used for corpus files and synthetic data.
+void RunZFlat(benchmark::State& state, const std::string& contents,
+              const std::string& label) {
   char* dst = new char[snappy::MaxCompressedLength(contents.size())];
 
   size_t zsize = 0;
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     snappy::RawCompress(contents.data(), contents.size(), dst, &zsize);
     benchmark::DoNotOptimize(dst);
   }
+  perf_counters.Stop();
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
   const double compression_ratio =
       static_cast<double>(zsize) / std::max<size_t>(1, contents.size());
-  state.SetLabel(StrFormat("%s (%.2f %%)", kTestDataFiles[file_index].label,
+  state.SetLabel(StrFormat("%s (%.2f %%)", label.c_str(),
                            100.0 * compression_ratio));
-  VLOG(0) << StrFormat("compression for %s: %d -> %d bytes",
-                       kTestDataFiles[file_index].label, contents.size(),
-                       zsize);
+  VLOG(0) << StrFormat("compression for %s: %d -> %d bytes", label.c_str(),
+                       contents.size(), zsize);
   delete[] dst;
 }
+
+void BM_ZFlat(benchmark::State& state) {
+  // Pick file to process based on state.range(0).
+  int file_index = state.range(0);
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  RunZFlat(state,
+           ReadTestDataFile(kTestDataFiles[file_index].filename,
+                            kTestDataFiles[file_index].size_limit),
+           kTestDataFiles[file_index].label);
+}
 BENCHMARK(BM_ZFlat)->DenseRange(0, ARRAYSIZE(kTestDataFiles) - 1);
+BENCHMARK(BM_ZFlat)->Arg(0)->Arg(2)->Arg(5)->ThreadRange(1, 16)->UseRealTime();
+
+// Same as BM_ZFlat, compressing a different copy of the file into a different
+// output buffer in each iteration, as in BM_UFlatWorkingSet.
+void BM_ZFlatWorkingSet(benchmark::State& state) {
+  int file_index = state.range(0);
+  const auto& working_set = kWorkingSets[state.range(1)];
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  std::string contents =
+      ReadTestDataFile(kTestDataFiles[file_index].filename,
+                       kTestDataFiles[file_index].size_limit);
+  const size_t max_compressed_length =
+      snappy::MaxCompressedLength(contents.size());
+
+  const size_t copies = std::max<size_t>(
+      1, working_set.size / (contents.size() + max_compressed_length));
+  std::vector<char> source_storage;
+  std::vector<char*> sources =
+      MakeCopies(contents, contents.size(), copies, &source_storage);
+  std::vector<char> dst_storage;
+  std::vector<char*> dsts =
+      MakeCopies(std::string(), max_compressed_length, copies, &dst_storage);
+
+  size_t i = 0;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    size_t zsize;
+    snappy::RawCompress(sources[i], contents.size(), dsts[i], &zsize);
+    benchmark::DoNotOptimize(dsts[i]);
+    if (++i == copies) i = 0;
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(StrFormat("%s %s (%d copies)",
+                           kTestDataFiles[file_index].label, working_set.label,
+                           static_cast<int>(copies)));
+}
+BENCHMARK(BM_ZFlatWorkingSet)
+    ->Args({0, 0})->Args({0, 1})->Args({0, 2})
+    ->Args({2, 0})->Args({2, 1})->Args({2, 2})
+    ->Args({10, 0})->Args({10, 1})->Args({10, 2});
+
+// Runs one compression (state.range(0) == 0) or decompression loop per
+// thread over a private copy of all test files concatenated, the way a
+// server runs one compressor per core. bytes_per_second is the aggregate
+// over all threads and per_thread_bytes_per_second the average per thread;
+// scaling stops where the latter drops below its single-threaded value, as
+// the threads start to compete for memory bandwidth and the shared caches.
+void BM_ZUScaling(benchmark::State& state) {
+  const bool compress = state.range(0) == 0;
+
+  std::string contents;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    contents += ReadTestDataFile(kTestDataFiles[i].filename,
+                                 kTestDataFiles[i].size_limit);
+  }
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+  std::vector<char> dst(compress ? snappy::MaxCompressedLength(contents.size())
+                                 : contents.size());
+
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    if (compress) {
+      size_t zsize;
+      snappy::RawCompress(contents.data(), contents.size(), dst.data(), &zsize);
+    } else {
+      CHECK(snappy::RawUncompress(zcontents.data(), zcontents.size(),
+                                  dst.data()));
+    }
+    benchmark::DoNotOptimize(dst.data());
+  }
+  perf_counters.Stop();
+  const int64_t bytes = static_cast<int64_t>(state.iterations()) *
+                        static_cast<int64_t>(contents.size());
+  state.SetBytesProcessed(bytes);
+  perf_counters.Report();
+  state.counters["per_thread_bytes_per_second"] =
+      benchmark::Counter(static_cast<double>(bytes),
+                         benchmark::Counter::kAvgThreadsRate,
+                         benchmark::Counter::kIs1024);
+  state.SetLabel(compress ? "compress" : "uncompress");
+}
+BENCHMARK(BM_ZUScaling)->Arg(0)->Arg(1)->ThreadRange(1, 16)->UseRealTime();
+
+// Recompresses a test file, comparing with decompressing and compressing
+// again (state.range(1) == 0). The label shows the size relative to the
+// output of Compress().
+void BM_ZRecompress(benchmark::State& state) {
+  // Pick file to process based on state.range(0).
+  int file_index = state.range(0);
+  const bool recompress = state.range(1) != 0;
+
+  CHECK_GE(file_index, 0);
+  CHECK_LT(file_index, ARRAYSIZE(kTestDataFiles));
+  std::string contents =
+      ReadTestDataFile(kTestDataFiles[file_index].filename,
+                       kTestDataFiles[file_index].size_limit);
+  std::string zcontents;
+  snappy::Compress(contents.data(), contents.size(), &zcontents);
+
+  std::string uncompressed, out;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    if (recompress) {
+      CHECK(snappy::Recompress(zcontents.data(), zcontents.size(), &out));
+    } else {
+      CHECK(snappy::Uncompress(zcontents.data(), zcontents.size(),
+                               &uncompressed));
+      snappy::Compress(uncompressed.data(), uncompressed.size(), &out);
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(StrFormat("%s %s (%.2f %%)",
+                           kTestDataFiles[file_index].label,
+                           recompress ? "Recompress" : "Uncompress+Compress",
+                           100.0 * out.size() / zcontents.size()));
+}
+BENCHMARK(BM_ZRecompress)
+    ->Args({0, 0})->Args({0, 1})
+    ->Args({1, 0})->Args({1, 1})
+    ->Args({2, 0})->Args({2, 1})
+    ->Args({6, 0})->Args({6, 1})
+    ->Args({10, 0})->Args({10, 1});
 
 void BM_ZFlatAll(benchmark::State& state) {
   const int num_files = ARRAYSIZE(kTestDataFiles);
@@ -271,6 +1178,7 @@ void BM_ZFlatAll(benchmark::State& state) {
   }
 
   size_t zsize = 0;
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     for (int i = 0; i < num_files; ++i) {
       snappy::RawCompress(contents[i].data(), contents[i].size(), dst[i],
@@ -278,9 +1186,11 @@ void BM_ZFlatAll(benchmark::State& state) {
       benchmark::DoNotOptimize(dst);
     }
   }
+  perf_counters.Stop();
 
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           total_contents_size);
+  perf_counters.Report();
 
   for (char* dst_item : dst) {
     delete[] dst_item;
@@ -289,6 +1199,86 @@ void BM_ZFlatAll(benchmark::State& state) {
 }
 BENCHMARK(BM_ZFlatAll);
 
+// Appends a test file to an AppendableCompressedBuffer in records of
+// state.range(0) bytes.
+void BM_ZAppendable(benchmark::State& state) {
+  const size_t record_size = state.range(0);
+  std::string contents = ReadTestDataFile("html_x_4", 0);
+
+  snappy::AppendableCompressedBuffer buffer;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    buffer.Clear();
+    for (size_t pos = 0; pos < contents.size(); pos += record_size) {
+      CHECK(buffer.Append(contents.data() + pos,
+                          std::min(record_size, contents.size() - pos)));
+    }
+    benchmark::DoNotOptimize(buffer.compressed().data());
+  }
+  perf_counters.Stop();
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  state.SetLabel(StrFormat("ratio %.2f",
+                           static_cast<double>(buffer.compressed().size()) /
+                               contents.size()));
+}
+BENCHMARK(BM_ZAppendable)->Arg(256)->Arg(4096)->Arg(65536);
+
+// Compresses a test file cut into messages of state.range(0) bytes through
+// the C API: one snappy_compress() call per message (state.range(1) == 0),
+// one snappy_env_compress() call per message (1), or a single
+// snappy_env_compress_batch() call (2).
+void BM_ZCApi(benchmark::State& state) {
+  const size_t message_size = state.range(0);
+  const int mode = state.range(1);
+  std::string contents = ReadTestDataFile("html_x_4", 0);
+
+  std::vector<const char*> inputs;
+  std::vector<size_t> input_lengths;
+  for (size_t pos = 0; pos < contents.size(); pos += message_size) {
+    inputs.push_back(contents.data() + pos);
+    input_lengths.push_back(std::min(message_size, contents.size() - pos));
+  }
+  const size_t count = inputs.size();
+  const size_t max_length = snappy_max_compressed_length(message_size);
+  std::vector<char> output(count * max_length);
+  std::vector<char*> outputs(count);
+  for (size_t i = 0; i < count; ++i) outputs[i] = &output[i * max_length];
+  std::vector<size_t> output_lengths(count);
+
+  snappy_env* env = snappy_env_create();
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    std::fill(output_lengths.begin(), output_lengths.end(), max_length);
+    if (mode == 2) {
+      CHECK_EQ(SNAPPY_OK, snappy_env_compress_batch(
+                              env, count, inputs.data(), input_lengths.data(),
+                              outputs.data(), output_lengths.data(), nullptr));
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        CHECK_EQ(SNAPPY_OK,
+                 mode == 1
+                     ? snappy_env_compress(env, inputs[i], input_lengths[i],
+                                           outputs[i], &output_lengths[i])
+                     : snappy_compress(inputs[i], input_lengths[i],
+                                       outputs[i], &output_lengths[i]));
+      }
+    }
+    benchmark::DoNotOptimize(output.data());
+  }
+  perf_counters.Stop();
+  snappy_env_destroy(env);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(contents.size()));
+  perf_counters.Report();
+  static const char* const kModes[] = {"one-shot", "env", "batch"};
+  state.SetLabel(kModes[mode]);
+}
+BENCHMARK(BM_ZCApi)
+    ->Args({64, 0})->Args({64, 1})->Args({64, 2})
+    ->Args({1024, 0})->Args({1024, 1})->Args({1024, 2});
+
 void BM_ZFlatIncreasingTableSize(benchmark::State& state) {
   CHECK_GT(ARRAYSIZE(kTestDataFiles), 0);
   const std::string base_content = ReadTestDataFile(
@@ -307,6 +1297,7 @@ void BM_ZFlatIncreasingTableSize(benchmark::State& state) {
   }
 
   size_t zsize = 0;
+  PerfCounters perf_counters(state);
   for (auto s : state) {
     for (size_t i = 0; i < contents.size(); ++i) {
       snappy::RawCompress(contents[i].data(), contents[i].size(), dst[i],
@@ -314,9 +1305,11 @@ void BM_ZFlatIncreasingTableSize(benchmark::State& state) {
       benchmark::DoNotOptimize(dst);
     }
   }
+  perf_counters.Stop();
 
   state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
                           total_contents_size);
+  perf_counters.Report();
 
   for (char* dst_item : dst) {
     delete[] dst_item;
@@ -325,6 +1318,241 @@ void BM_ZFlatIncreasingTableSize(benchmark::State& state) {
 }
 BENCHMARK(BM_ZFlatIncreasingTableSize);
 
+// Reads a counter for timing individual calls: the TSC on x86, which is much
+// cheaper to read than the clocks, and std::chrono::steady_clock elsewhere.
+inline uint64_t ReadTicks() {
+#if SNAPPY_BENCHMARK_HAVE_RDTSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Returns the number of ReadTicks() ticks per nanosecond.
+double TicksPerNanosecond() {
+#if SNAPPY_BENCHMARK_HAVE_RDTSC
+  static const double ticks_per_ns = [] {
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t start_ticks = ReadTicks();
+    auto now = start;
+    while (now - start < std::chrono::milliseconds(20)) {
+      now = std::chrono::steady_clock::now();
+    }
+    const uint64_t ticks = ReadTicks() - start_ticks;
+    return static_cast<double>(ticks) /
+           std::chrono::duration_cast<std::chrono::nanoseconds>(now - start)
+               .count();
+  }();
+  return ticks_per_ns;
+#else
+  return 1.0;
+#endif
+}
+
+// Returns the smallest interval measured between two ReadTicks() calls, which
+// is subtracted from measurements as the cost of timing itself.
+uint64_t TimingOverheadTicks() {
+  uint64_t overhead = ~uint64_t{0};
+  for (int i = 0; i < 1000; ++i) {
+    const uint64_t start = ReadTicks();
+    overhead = std::min(overhead, ReadTicks() - start);
+  }
+  return overhead;
+}
+
+// A histogram of latencies in the style of HdrHistogram: values below
+// kSubBuckets are counted exactly, and each higher power of two range is split
+// into kSubBuckets / 2 buckets, so percentiles are within 1/16 of the true
+// value while the histogram stays small and recording stays cheap.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : counts_(kBuckets, 0), total_(0) {}
+
+  void Record(uint32_t value) {
+    ++counts_[Index(value)];
+    ++total_;
+  }
+
+  // Returns the value below which "percentile" percent of the recorded
+  // values lie, as the midpoint of the bucket holding it.
+  double Percentile(double percentile) const {
+    const uint64_t rank = static_cast<uint64_t>(
+        std::max(1.0, std::ceil(percentile / 100 * total_)));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) return BucketMidpoint(i);
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kHalfSubBuckets = kSubBuckets / 2;
+  static constexpr int kBuckets = kSubBuckets + (32 - kSubBucketBits) *
+                                                    kHalfSubBuckets;
+
+  static int Index(uint32_t value) {
+    if (value < kSubBuckets) return value;
+    // "value >> shift" is in [kHalfSubBuckets, kSubBuckets).
+    const int shift = Bits::Log2FloorNonZero(value) - kSubBucketBits + 1;
+    return kSubBuckets + (shift - 1) * kHalfSubBuckets +
+           static_cast<int>(value >> shift) - kHalfSubBuckets;
+  }
+
+  static double BucketMidpoint(int index) {
+    if (index < kSubBuckets) return index;
+    const int shift = (index - kSubBuckets) / kHalfSubBuckets + 1;
+    const double low = static_cast<double>(
+        uint64_t{static_cast<uint32_t>((index - kSubBuckets) % kHalfSubBuckets +
+                                       kHalfSubBuckets)}
+        << shift);
+    return low + static_cast<double>(uint64_t{1} << shift) / 2;
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_;
+};
+
+// Times individual Compress() (state.range(1) == 0) or RawUncompress() calls
+// on messages of state.range(0) bytes, and reports their latency percentiles
+// in nanoseconds, for workloads such as RPCs that are dominated by small
+// messages. The messages are cut from all test files, so they vary in
+// compressibility, and each iteration uses the next one.
+void BM_ZULatency(benchmark::State& state) {
+  const size_t size = state.range(0);
+  const bool compress = state.range(1) == 0;
+
+  std::string corpus;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    corpus += ReadTestDataFile(kTestDataFiles[i].filename,
+                               kTestDataFiles[i].size_limit);
+  }
+  constexpr size_t kMessages = 1024;
+  const size_t stride = (corpus.size() - size) / kMessages;
+  std::vector<std::string> messages;
+  std::vector<std::string> compressed_messages;
+  for (size_t i = 0; i < kMessages; ++i) {
+    messages.push_back(corpus.substr(i * stride, size));
+    compressed_messages.emplace_back();
+    snappy::Compress(messages.back().data(), size,
+                     &compressed_messages.back());
+  }
+  std::string compressed;
+  std::vector<char> uncompressed(size);
+
+  const uint64_t overhead = TimingOverheadTicks();
+  LatencyHistogram histogram;
+  size_t i = 0;
+  PerfCounters perf_counters(state);
+  for (auto s : state) {
+    const uint64_t start = ReadTicks();
+    if (compress) {
+      snappy::Compress(messages[i].data(), size, &compressed);
+    } else {
+      CHECK(snappy::RawUncompress(compressed_messages[i].data(),
+                                  compressed_messages[i].size(),
+                                  uncompressed.data()));
+    }
+    const uint64_t ticks = ReadTicks() - start;
+    histogram.Record(static_cast<uint32_t>(std::min<uint64_t>(
+        ticks - std::min(ticks, overhead), ~uint32_t{0})));
+    if (++i == kMessages) i = 0;
+  }
+  perf_counters.Stop();
+
+  const double ticks_per_ns = TicksPerNanosecond();
+  state.counters["p50_ns"] = histogram.Percentile(50) / ticks_per_ns;
+  state.counters["p99_ns"] = histogram.Percentile(99) / ticks_per_ns;
+  state.counters["p99.9_ns"] = histogram.Percentile(99.9) / ticks_per_ns;
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(size));
+  perf_counters.Report();
+  state.SetLabel(compress ? "compress" : "uncompress");
+}
+BENCHMARK(BM_ZULatency)
+    ->Args({64, 0})->Args({256, 0})->Args({1024, 0})->Args({4096, 0})
+    ->Args({64, 1})->Args({256, 1})->Args({1024, 1})->Args({4096, 1});
+
+// The synthetic data for state.range(0) bits of literal entropy,
+// state.range(1) percent of matches, matches of up to state.range(2) bytes,
+// and offsets of up to state.range(3).
+std::string SyntheticData(const benchmark::State& state, std::string* label) {
+  SyntheticDataOptions options;
+  options.literal_entropy_bits = static_cast<int>(state.range(0));
+  options.match_percent = static_cast<int>(state.range(1));
+  options.max_match_length = static_cast<size_t>(state.range(2));
+  options.max_offset = static_cast<size_t>(state.range(3));
+  *label = StrFormat("%d bits, %d%% matches, len <= %d, offset <= %d",
+                     options.literal_entropy_bits, options.match_percent,
+                     static_cast<int>(options.max_match_length),
+                     static_cast<int>(options.max_offset));
+  return GenerateSyntheticData(options);
+}
+
+void SyntheticArguments(benchmark::internal::Benchmark* b) {
+  for (int entropy_bits : {4, 8}) {
+    for (int match_percent : {0, 50, 90}) {
+      for (int max_match_length : {8, 64}) {
+        for (int max_offset : {256, 65536}) {
+          b->Args({entropy_bits, match_percent, max_match_length, max_offset});
+        }
+      }
+    }
+  }
+}
+
+// BM_UFlat and BM_ZFlat across the input space, to see how changes to the
+// kernels behave away from the files in kTestDataFiles.
+void BM_UFlatSynthetic(benchmark::State& state) {
+  std::string label;
+  const std::string contents = SyntheticData(state, &label);
+  RunUFlat(state, contents, label);
+}
+BENCHMARK(BM_UFlatSynthetic)->Apply(SyntheticArguments);
+
+void BM_ZFlatSynthetic(benchmark::State& state) {
+  std::string label;
+  const std::string contents = SyntheticData(state, &label);
+  RunZFlat(state, contents, label);
+}
+BENCHMARK(BM_ZFlatSynthetic)->Apply(SyntheticArguments);
+
+// Registers BM_UFlat and BM_ZFlat for each file that the directory or glob in
+// SNAPPY_BENCHMARK_CORPUS matches, to benchmark on one's own data. This is
+// not a flag because benchmark_main rejects the flags it does not know.
+int RegisterCorpusBenchmarks() {
+  const char* corpus = std::getenv("SNAPPY_BENCHMARK_CORPUS");
+  if (corpus == nullptr || *corpus == '\0') return 0;
+  const std::vector<std::string> files = ListCorpusFiles(corpus);
+  if (files.empty()) {
+    std::fprintf(stderr, "SNAPPY_BENCHMARK_CORPUS=%s matches no files.\n",
+                 corpus);
+  }
+  for (const std::string& file : files) {
+    const std::string label = file.substr(file.find_last_of('/') + 1);
+    benchmark::RegisterBenchmark(
+        ("BM_UFlat/corpus:" + label).c_str(),
+        [file, label](benchmark::State& state) {
+          std::string contents;
+          CHECK_OK(file::GetContents(file, &contents, file::Defaults()));
+          RunUFlat(state, contents, label);
+        });
+    benchmark::RegisterBenchmark(
+        ("BM_ZFlat/corpus:" + label).c_str(),
+        [file, label](benchmark::State& state) {
+          std::string contents;
+          CHECK_OK(file::GetContents(file, &contents, file::Defaults()));
+          RunZFlat(state, contents, label);
+        });
+  }
+  return static_cast<int>(files.size());
+}
+const int kNumCorpusFiles = RegisterCorpusBenchmarks();
+
 }  // namespace
 
 }  // namespace snappy
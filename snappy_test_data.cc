@@ -30,12 +30,21 @@
 
 #include "snappy_test_data.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <random>
 #include <string>
+#include <vector>
 
 #include "snappy-test.h"
 
+#if HAVE_GLOB_H
+#include <glob.h>
+#include <sys/stat.h>
+#endif  // HAVE_GLOB_H
+
 namespace snappy {
 
 std::string ReadTestDataFile(const char* base, size_t size_limit) {
@@ -54,4 +63,85 @@ std::string ReadTestDataFile(const char* base, size_t size_limit) {
   return contents;
 }
 
+std::vector<std::string> ListCorpusFiles(const std::string& pattern) {
+  std::vector<std::string> files;
+#if HAVE_GLOB_H
+  struct stat info;
+  std::string glob_pattern = pattern;
+  if (stat(pattern.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+    glob_pattern += "/*";
+  }
+  glob_t matches;
+  if (glob(glob_pattern.c_str(), 0, nullptr, &matches) == 0) {
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+      const char* path = matches.gl_pathv[i];
+      if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+        files.push_back(path);
+      }
+    }
+  }
+  globfree(&matches);
+#else
+  // TODO: Switch to [[maybe_unused]] when we can assume C++17.
+  (void)pattern;
+#endif  // HAVE_GLOB_H
+  return files;
+}
+
+namespace {
+
+// Draws a value in [min, max] from "distribution".
+size_t Draw(SyntheticDataOptions::Distribution distribution, size_t min,
+            size_t max, std::mt19937* rng) {
+  if (distribution == SyntheticDataOptions::Distribution::kLogUniform) {
+    int min_log = 0;
+    while ((size_t{2} << min_log) <= min) ++min_log;
+    int max_log = min_log;
+    while ((size_t{2} << max_log) <= max) ++max_log;
+    const int log =
+        std::uniform_int_distribution<int>(min_log, max_log)(*rng);
+    min = std::max(min, size_t{1} << log);
+    max = std::min(max, (size_t{2} << log) - 1);
+  }
+  return std::uniform_int_distribution<size_t>(min, max)(*rng);
+}
+
+}  // namespace
+
+std::string GenerateSyntheticData(const SyntheticDataOptions& options) {
+  CHECK_GE(options.literal_entropy_bits, 0);
+  CHECK_LE(options.literal_entropy_bits, 8);
+  CHECK_GE(options.min_match_length, 1);
+  CHECK_LE(options.min_match_length, options.max_match_length);
+  CHECK_GE(options.max_offset, 1);
+
+  std::mt19937 rng(options.seed);
+  std::uniform_int_distribution<int> literal(
+      0, (1 << options.literal_entropy_bits) - 1);
+  std::uniform_int_distribution<int> percent(0, 99);
+
+  std::string data;
+  data.reserve(options.size);
+  while (data.size() < options.size) {
+    const size_t length =
+        std::min(options.size - data.size(),
+                 Draw(options.length_distribution, options.min_match_length,
+                      options.max_match_length, &rng));
+    if (!data.empty() && percent(rng) < options.match_percent) {
+      const size_t offset =
+          Draw(options.offset_distribution, 1,
+               std::min(options.max_offset, data.size()), &rng);
+      // Byte by byte, because the copy may overlap its own output.
+      for (size_t i = 0; i < length; ++i) {
+        data.push_back(data[data.size() - offset]);
+      }
+    } else {
+      for (size_t i = 0; i < length; ++i) {
+        data.push_back(static_cast<char>(literal(rng)));
+      }
+    }
+  }
+  return data;
+}
+
 }  // namespace snappy
@@ -32,12 +32,48 @@
 #define THIRD_PARTY_SNAPPY_SNAPPY_TEST_DATA_H__
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace snappy {
 
 std::string ReadTestDataFile(const char* base, size_t size_limit);
 
+// Returns the regular files in "pattern", which is either a directory or a
+// glob such as "/data/logs/*.json", in sorted order.
+std::vector<std::string> ListCorpusFiles(const std::string& pattern);
+
+// Parameters for GenerateSyntheticData(), which mimics what the compressor
+// sees: runs of literals, and copies of earlier data.
+struct SyntheticDataOptions {
+  enum class Distribution {
+    kUniform,
+    // Every power of two in the range is equally likely, and values are
+    // uniform within one. This favors small values, like real data does.
+    kLogUniform,
+  };
+
+  size_t size = 1 << 18;
+  // Entropy of the literal bytes, from 0 (a single repeated byte) to 8.
+  // Literals are drawn uniformly from 2^literal_entropy_bits byte values.
+  int literal_entropy_bits = 8;
+  // Share of the output, in percent, that copies earlier data.
+  int match_percent = 50;
+  // Lengths of the copies, and of the literal runs between them.
+  size_t min_match_length = 4;
+  size_t max_match_length = 64;
+  Distribution length_distribution = Distribution::kUniform;
+  // How far back copies reach. Early copies reach at most to the start.
+  size_t max_offset = 1 << 16;
+  Distribution offset_distribution = Distribution::kLogUniform;
+  uint32_t seed = 301;
+};
+
+// Returns "options.size" bytes of data with the given properties. The same
+// options always give the same data.
+std::string GenerateSyntheticData(const SyntheticDataOptions& options);
+
 // TODO: Replace anonymous namespace with inline variable when we can
 //               rely on C++17.
 namespace {
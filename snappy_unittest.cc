@@ -28,18 +28,33 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <random>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "snappy-test.h"
 
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif  // HAVE_UNISTD_H
+
 #include "gtest/gtest.h"
 
+#include "snappy-appendable.h"
+#include "snappy-c.h"
+#include "snappy-decompression-writer.h"
+#include "snappy-framing.h"
 #include "snappy-internal.h"
 #include "snappy-sinksource.h"
+#include "snappy-tag-iterator.h"
+#include "snappy-uring.h"
 #include "snappy.h"
 #include "snappy_test_data.h"
 
@@ -178,6 +193,14 @@ void VerifyIOVec(const std::string& input) {
   CHECK(snappy::RawUncompressToIOVec(
       compressed.data(), compressed.size(), iov, num));
   CHECK(!memcmp(buf, input.data(), input.size()));
+
+  // Uncompress into the same iovec while checksumming.
+  std::memset(buf, 'x', input.size());
+  uint32_t crc = 0;
+  CHECK(snappy::RawUncompressToIOVecWithCrc32c(
+      compressed.data(), compressed.size(), iov, num, &crc));
+  CHECK(!memcmp(buf, input.data(), input.size()));
+  CHECK_EQ(crc, snappy::Crc32c(input.data(), input.size()));
   delete[] iov;
   delete[] buf;
 }
@@ -220,6 +243,20 @@ void VerifyNonBlockedCompression(const std::string& input) {
   CHECK(snappy::Uncompress(&source, &sink));
   CHECK_EQ(uncomp_str2, input);
 
+  // Uncompress using non-temporal stores
+  std::string uncomp_str3(input.size(), 'x');
+  CHECK(snappy::RawUncompressNonTemporal(compressed.data(), compressed.size(),
+                                         string_as_array(&uncomp_str3)));
+  CHECK_EQ(uncomp_str3, input);
+
+  // Uncompress while checksumming
+  std::string uncomp_str4(input.size(), 'x');
+  uint32_t crc = 0;
+  CHECK(snappy::RawUncompressWithCrc32c(compressed.data(), compressed.size(),
+                                        string_as_array(&uncomp_str4), &crc));
+  CHECK_EQ(uncomp_str4, input);
+  CHECK_EQ(crc, snappy::Crc32c(input.data(), input.size()));
+
   // Uncompress into iovec
   {
     static const int kNumBlocks = 10;
@@ -506,6 +543,36 @@ TEST(Snappy, RandomData) {
   }
 }
 
+TEST(Snappy, SyntheticData) {
+  SyntheticDataOptions options;
+  options.size = 100000;
+  const std::string data = GenerateSyntheticData(options);
+  EXPECT_EQ(options.size, data.size());
+  EXPECT_EQ(data, GenerateSyntheticData(options));
+
+  // Round trip across the input space, and check that the options move the
+  // compression ratio the way they should.
+  using Distribution = SyntheticDataOptions::Distribution;
+  for (int entropy_bits : {0, 1, 4, 8}) {
+    int previous_size = static_cast<int>(options.size) + 1;
+    for (int match_percent : {0, 50, 90, 100}) {
+      for (Distribution distribution :
+           {Distribution::kUniform, Distribution::kLogUniform}) {
+        options.literal_entropy_bits = entropy_bits;
+        options.match_percent = match_percent;
+        options.length_distribution = distribution;
+        options.offset_distribution = distribution;
+        const std::string input = GenerateSyntheticData(options);
+        const int compressed_size = Verify(input);
+        if (distribution == Distribution::kUniform) {
+          EXPECT_LE(compressed_size, previous_size);
+          previous_size = compressed_size;
+        }
+      }
+    }
+  }
+}
+
 TEST(Snappy, FourByteOffset) {
   // The new compressor cannot generate four-byte offsets since
   // it chops up the input into 32KB pieces.  So we hand-emit the
@@ -652,6 +719,67 @@ TEST(Snappy, IOVecCopyOverflow) {
   }
 }
 
+TEST(Snappy, IOVecReferences) {
+  std::vector<std::string> inputs;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    inputs.push_back(ReadTestDataFile(kTestDataFiles[i].filename,
+                                      kTestDataFiles[i].size_limit));
+  }
+  // A literal followed by an overlapping copy that starts inside it.
+  std::string literal_then_copy;
+  Varint::Append32(&literal_then_copy, 10 + 64);
+  AppendLiteral(&literal_then_copy, "0123456789");
+  AppendCopy(&literal_then_copy, 4, 64);
+
+  std::string scratch;
+  std::vector<struct iovec> iov;
+  for (const std::string& input : inputs) {
+    std::string compressed;
+    Compress(input.data(), input.size(), &compressed);
+    for (size_t min_reference_length : {0, 1, 16, 64, 1 << 20}) {
+      ASSERT_TRUE(snappy::UncompressToIOVecReferences(
+          compressed.data(), compressed.size(), min_reference_length,
+          &scratch, &iov));
+      std::string uncompressed;
+      size_t referenced = 0;
+      for (const struct iovec& v : iov) {
+        const char* base = static_cast<const char*>(v.iov_base);
+        uncompressed.append(base, v.iov_len);
+        if (base < scratch.data() || base >= scratch.data() + scratch.size()) {
+          EXPECT_GE(base, compressed.data());
+          EXPECT_LE(base + v.iov_len, compressed.data() + compressed.size());
+          EXPECT_GE(v.iov_len, min_reference_length);
+          referenced += v.iov_len;
+        }
+      }
+      EXPECT_EQ(input, uncompressed);
+      EXPECT_EQ(input.size(), referenced + scratch.size());
+    }
+  }
+
+  ASSERT_TRUE(snappy::UncompressToIOVecReferences(
+      literal_then_copy.data(), literal_then_copy.size(), 1, &scratch, &iov));
+  ASSERT_EQ(2, iov.size());
+  EXPECT_EQ(literal_then_copy.data() + 2, iov[0].iov_base);
+  std::string expected_copy;
+  while (expected_copy.size() < 64) expected_copy += "6789";
+  EXPECT_EQ(expected_copy, scratch);
+
+  // Incompressible data is referenced almost entirely.
+  const std::string& jpeg = inputs[2];
+  std::string compressed;
+  Compress(jpeg.data(), jpeg.size(), &compressed);
+  ASSERT_TRUE(snappy::UncompressToIOVecReferences(
+      compressed.data(), compressed.size(), 64, &scratch, &iov));
+  EXPECT_LT(scratch.size(), jpeg.size() / 10);
+
+  EXPECT_FALSE(snappy::UncompressToIOVecReferences(
+      compressed.data(), compressed.size() - 1, 64, &scratch, &iov));
+  AppendCopy(&literal_then_copy, 100, 4);
+  EXPECT_FALSE(snappy::UncompressToIOVecReferences(
+      literal_then_copy.data(), literal_then_copy.size(), 1, &scratch, &iov));
+}
+
 bool CheckUncompressedLength(const std::string& compressed, size_t* ulength) {
   const bool result1 = snappy::GetUncompressedLength(compressed.data(),
                                                      compressed.size(),
@@ -741,6 +869,779 @@ int TestFindMatchLength(const char* s1, const char *s2, unsigned length) {
   return p.first;
 }
 
+// A Sink that keeps the blocks it is given ownership of until it is
+// destroyed, like a rope would. It never offers a flat buffer, so
+// Uncompress() always takes the scattered path into it.
+class BlockOwningSink : public Sink {
+ public:
+  BlockOwningSink() {}
+  ~BlockOwningSink() override {
+    for (const Block& block : blocks_) {
+      (*block.deleter)(block.deleter_arg, block.data, block.size);
+    }
+  }
+
+  void Append(const char* data, size_t n) override {
+    flat_.append(data, n);
+  }
+
+  void AppendAndTakeOwnership(char* bytes, size_t n,
+                              void (*deleter)(void*, const char*, size_t),
+                              void* deleter_arg) override {
+    Block block = {bytes, n, deleter, deleter_arg};
+    blocks_.push_back(block);
+    flat_.append(bytes, n);
+  }
+
+  const std::string& contents() const { return flat_; }
+  std::vector<const char*> block_addresses() const {
+    std::vector<const char*> addresses;
+    for (const Block& block : blocks_) addresses.push_back(block.data);
+    return addresses;
+  }
+
+ private:
+  struct Block {
+    const char* data;
+    size_t size;
+    void (*deleter)(void*, const char*, size_t);
+    void* deleter_arg;
+  };
+
+  std::vector<Block> blocks_;
+  std::string flat_;
+
+  // No copying
+  BlockOwningSink(const BlockOwningSink&);
+  void operator=(const BlockOwningSink&);
+};
+
+TEST(Snappy, BlockPool) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+  const size_t num_blocks = (input.size() + kBlockSize - 1) / kBlockSize;
+
+  auto uncompress = [&](BlockOwningSink* sink) {
+    ByteArraySource source(compressed.data(), compressed.size());
+    EXPECT_TRUE(snappy::Uncompress(&source, sink));
+    EXPECT_EQ(input, sink->contents());
+  };
+
+  // Blocks freed by one decompression are reused by the next one.
+  SetBlockPoolLimits(num_blocks, num_blocks);
+  TrimBlockPool();
+  std::vector<const char*> first_blocks;
+  {
+    BlockOwningSink sink;
+    uncompress(&sink);
+    first_blocks = sink.block_addresses();
+  }
+  {
+    BlockOwningSink sink;
+    uncompress(&sink);
+    std::vector<const char*> blocks = sink.block_addresses();
+    // The last block is short and therefore not pooled.
+    ASSERT_EQ(first_blocks.size(), blocks.size());
+    std::sort(first_blocks.begin(), first_blocks.end() - 1);
+    std::sort(blocks.begin(), blocks.end() - 1);
+    EXPECT_TRUE(std::equal(blocks.begin(), blocks.end() - 1,
+                           first_blocks.begin()));
+  }
+
+  // Blocks freed on other threads than the decompressing one, and blocks
+  // left in the caches of exiting threads, go through the shared pool.
+  SetBlockPoolLimits(1, 2);
+  for (int round = 0; round < 3; ++round) {
+    std::vector<std::unique_ptr<BlockOwningSink>> sinks;
+    for (int i = 0; i < 4; ++i) {
+      sinks.emplace_back(new BlockOwningSink());
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+      threads.emplace_back([&, i] {
+        uncompress(sinks[i].get());
+        // Exercise the thread cache before the thread exits.
+        BlockOwningSink own;
+        uncompress(&own);
+      });
+    }
+    for (std::thread& thread : threads) thread.join();
+  }
+
+  // With the pool disabled, which is the default, every block comes from and
+  // goes to the heap.
+  SetBlockPoolLimits(0, 0);
+  TrimBlockPool();
+  for (int round = 0; round < 2; ++round) {
+    BlockOwningSink sink;
+    AllocationCounter counter;
+    uncompress(&sink);
+    EXPECT_GE(counter.bytes(), (num_blocks - 1) * kBlockSize);
+  }
+}
+
+TEST(Snappy, ParallelRawUncompress) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  for (int num_threads : {1, 2, 3, 4, 7, 64}) {
+    for (size_t size : {size_t{0}, size_t{1000}, size_t{3 * kBlockSize},
+                        input.size()}) {
+      std::string prefix_compressed;
+      Compress(input.data(), size, &prefix_compressed);
+      std::string uncompressed(size, '\0');
+      EXPECT_TRUE(ParallelRawUncompress(
+          prefix_compressed.data(), prefix_compressed.size(),
+          string_as_array(&uncompressed), num_threads));
+      EXPECT_EQ(input.substr(0, size), uncompressed);
+    }
+  }
+
+  // Corrupted or truncated input must be rejected.
+  std::string uncompressed(input.size(), '\0');
+  EXPECT_FALSE(ParallelRawUncompress(compressed.data(), compressed.size() - 1,
+                                     string_as_array(&uncompressed), 4));
+  std::string corrupted = compressed;
+  corrupted[corrupted.size() / 2] ^= 0x55;
+  if (!snappy::IsValidCompressedBuffer(corrupted.data(), corrupted.size())) {
+    EXPECT_FALSE(ParallelRawUncompress(corrupted.data(), corrupted.size(),
+                                       string_as_array(&uncompressed), 4));
+  }
+}
+
+TEST(Snappy, ParallelRawUncompressCrossBoundaryCopies) {
+  // Hand-emit streams whose copies reach back across 64 KiB boundaries, which
+  // the compressor never does; they must still decode correctly.
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<int> uniform_byte(0, 255);
+  std::string literal(50000, '\0');
+  for (char& c : literal) c = static_cast<char>(uniform_byte(rng));
+
+  std::string body;
+  std::string expected;
+  for (int i = 0; i < 10; ++i) {
+    AppendLiteral(&body, literal);
+    expected += literal;
+    // Copy from the previous literal, 50000 bytes back.
+    AppendCopy(&body, literal.size(), 60);
+    expected += expected.substr(expected.size() - literal.size(), 60);
+  }
+  // A copy reaching back to the very beginning of the output.
+  AppendCopy(&body, expected.size(), 64);
+  expected += expected.substr(0, 64);
+
+  std::string compressed;
+  Varint::Append32(&compressed, expected.size());
+  compressed += body;
+  std::string uncompressed(expected.size(), '\0');
+  for (int num_threads : {1, 4}) {
+    EXPECT_TRUE(ParallelRawUncompress(compressed.data(), compressed.size(),
+                                      string_as_array(&uncompressed),
+                                      num_threads));
+    EXPECT_EQ(expected, uncompressed);
+  }
+
+  // Tags that start exactly on a 64 KiB boundary are candidates to split at,
+  // and copies reaching back before them must rule them out. The copy at
+  // 64 KiB rules out its own boundary, and the copy at 192 KiB rules out the
+  // boundaries at 128 KiB and 192 KiB. Only the one at 256 KiB is left.
+  body.clear();
+  expected.clear();
+  auto append_literal = [&](size_t length) {
+    std::string bytes(length, '\0');
+    for (char& c : bytes) c = static_cast<char>(uniform_byte(rng));
+    AppendLiteral(&body, bytes);
+    expected += bytes;
+  };
+  auto append_copy = [&](size_t offset, size_t length) {
+    AppendCopy(&body, static_cast<int>(offset), static_cast<int>(length));
+    for (size_t i = 0; i < length; ++i) {
+      expected.push_back(expected[expected.size() - offset]);
+    }
+  };
+  append_literal(kBlockSize);
+  ASSERT_EQ(kBlockSize, expected.size());
+  append_copy(60000, 64);
+  append_literal(kBlockSize - 64);
+  ASSERT_EQ(2 * kBlockSize, expected.size());
+  append_literal(kBlockSize);
+  ASSERT_EQ(3 * kBlockSize, expected.size());
+  append_copy(100000, 64);
+  append_literal(kBlockSize - 64);
+  ASSERT_EQ(4 * kBlockSize, expected.size());
+  const size_t last_boundary_offset = body.size();
+  append_literal(1000);
+
+  std::vector<snappy::internal::SegmentBoundary> boundaries;
+  ASSERT_TRUE(snappy::internal::FindSegmentBoundaries(
+      body.data(), body.data() + body.size(), expected.size(), kBlockSize,
+      &boundaries));
+  ASSERT_EQ(1, boundaries.size());
+  EXPECT_EQ(last_boundary_offset, boundaries[0].compressed_offset);
+  EXPECT_EQ(4 * kBlockSize, boundaries[0].uncompressed_offset);
+
+  compressed.clear();
+  Varint::Append32(&compressed, expected.size());
+  compressed += body;
+  uncompressed.assign(expected.size(), '\0');
+  for (int num_threads : {1, 2, 4}) {
+    EXPECT_TRUE(ParallelRawUncompress(compressed.data(), compressed.size(),
+                                      string_as_array(&uncompressed),
+                                      num_threads));
+    EXPECT_EQ(expected, uncompressed);
+  }
+}
+
+TEST(Snappy, RawUncompressNonTemporal) {
+  // Large enough for output to be evicted while decompressing, and with long
+  // literals from the incompressible files.
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  // Use every alignment of the output buffer.
+  std::string buffer(input.size() + 16, '\0');
+  for (size_t alignment = 0; alignment < 16; ++alignment) {
+    char* uncompressed = string_as_array(&buffer) + alignment;
+    EXPECT_TRUE(RawUncompressNonTemporal(compressed.data(), compressed.size(),
+                                         uncompressed));
+    EXPECT_EQ(input, std::string(uncompressed, input.size()));
+  }
+
+  EXPECT_FALSE(RawUncompressNonTemporal(
+      compressed.data(), compressed.size() - 1, string_as_array(&buffer)));
+}
+
+// A DecompressionWriter that appends to a std::string, using the number of
+// bytes written as its output position.
+class StringDecompressionWriter {
+ public:
+  explicit StringDecompressionWriter(std::string* dest) : dest_(dest) {}
+
+  void SetExpectedLength(size_t len) { expected_ = len; }
+  bool CheckLength() const { return dest_->size() == expected_; }
+
+  size_t GetOutputPtr() { return 0; }
+  void SetOutputPtr(size_t op) { CHECK_EQ(op, dest_->size()); }
+
+  bool Append(const char* ip, size_t len, size_t* op) {
+    if (expected_ - *op < len) return false;
+    dest_->append(ip, len);
+    *op += len;
+    return true;
+  }
+  bool TryFastAppend(const char*, size_t, size_t, size_t*) { return false; }
+  bool AppendFromSelf(size_t offset, size_t len, size_t* op) {
+    if (offset == 0 || offset > *op || expected_ - *op < len) return false;
+    for (size_t i = 0; i < len; ++i) {
+      dest_->push_back((*dest_)[*op - offset + i]);
+    }
+    *op += len;
+    return true;
+  }
+  void Flush() { ++flushes_; }
+
+  int flushes() const { return flushes_; }
+
+ private:
+  std::string* dest_;
+  size_t expected_ = 0;
+  int flushes_ = 0;
+};
+
+// A DecompressionWriter that only counts the output, like
+// IsValidCompressedBuffer().
+class CountingDecompressionWriter {
+ public:
+  void SetExpectedLength(size_t len) { expected_ = len; }
+  bool CheckLength() const { return produced_ == expected_; }
+
+  size_t GetOutputPtr() { return 0; }
+  void SetOutputPtr(size_t op) { produced_ = op; }
+
+  bool Append(const char*, size_t len, size_t* op) {
+    if (expected_ - *op < len) return false;
+    *op += len;
+    return true;
+  }
+  bool TryFastAppend(const char*, size_t, size_t len, size_t* op) {
+    return Append(nullptr, len, op);
+  }
+  bool AppendFromSelf(size_t offset, size_t len, size_t* op) {
+    if (offset == 0 || offset > *op) return false;
+    return Append(nullptr, len, op);
+  }
+  void Flush() {}
+
+ private:
+  size_t expected_ = 0;
+  size_t produced_ = 0;
+};
+
+// A DecompressionWriter into an array of fixed size that provides GetBase(),
+// so that UncompressTo() decodes with the loop of RawUncompress().
+class FlatDecompressionWriter {
+ public:
+  explicit FlatDecompressionWriter(size_t capacity) : buffer_(capacity) {}
+
+  void SetExpectedLength(size_t len) {
+    expected_ = len;
+    limit_ = buffer_.data() + std::min(len, buffer_.size());
+  }
+  bool CheckLength() const {
+    return static_cast<size_t>(op_ - buffer_.data()) == expected_;
+  }
+
+  char* GetOutputPtr() { return buffer_.data(); }
+  void SetOutputPtr(char* op) { op_ = op; }
+
+  bool Append(const char* ip, size_t len, char** op) {
+    if (static_cast<size_t>(limit_ - *op) < len) return false;
+    std::memcpy(*op, ip, len);
+    *op += len;
+    return true;
+  }
+  bool TryFastAppend(const char*, size_t, size_t, char**) { return false; }
+  bool AppendFromSelf(size_t offset, size_t len, char** op) {
+    if (offset == 0 || offset > static_cast<size_t>(*op - buffer_.data()) ||
+        static_cast<size_t>(limit_ - *op) < len) {
+      return false;
+    }
+    for (size_t i = 0; i < len; ++i) (*op)[i] = (*op)[i - offset];
+    *op += len;
+    return true;
+  }
+  void Flush() {}
+  char* GetBase(ptrdiff_t* op_limit_min_slop) {
+    ++get_base_calls_;
+    const ptrdiff_t len = limit_ - buffer_.data();
+    *op_limit_min_slop =
+        len - std::min<ptrdiff_t>(len, kDecompressionSlopBytes - 1);
+    return buffer_.data();
+  }
+
+  std::string contents() const {
+    return std::string(buffer_.data(), op_ - buffer_.data());
+  }
+  int get_base_calls() const { return get_base_calls_; }
+
+ private:
+  std::vector<char> buffer_;
+  size_t expected_ = 0;
+  char* limit_ = nullptr;
+  char* op_ = nullptr;
+  int get_base_calls_ = 0;
+};
+
+TEST(Snappy, UncompressTo) {
+  std::vector<std::string> inputs = {"", "a", std::string(100, 'b')};
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    inputs.push_back(ReadTestDataFile(kTestDataFiles[i].filename,
+                                      kTestDataFiles[i].size_limit));
+  }
+  for (const std::string& input : inputs) {
+    std::string compressed;
+    Compress(input.data(), input.size(), &compressed);
+
+    std::string uncompressed;
+    StringDecompressionWriter writer(&uncompressed);
+    EXPECT_TRUE(UncompressTo(compressed.data(), compressed.size(), &writer));
+    EXPECT_EQ(input, uncompressed);
+    EXPECT_EQ(1, writer.flushes());
+
+    FlatDecompressionWriter flat_writer(input.size());
+    EXPECT_TRUE(
+        UncompressTo(compressed.data(), compressed.size(), &flat_writer));
+    EXPECT_EQ(input, flat_writer.contents());
+    EXPECT_GT(flat_writer.get_base_calls(), 0);
+  }
+
+  std::string empty;
+  StringDecompressionWriter writer(&empty);
+  EXPECT_FALSE(UncompressTo(empty.data(), empty.size(), &writer));
+}
+
+TEST(Snappy, UncompressToAndTagIteratorAgreeWithValidator) {
+  std::string input = ReadTestDataFile("alice29.txt", 2000);
+  input.append(500, 'a');
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  // Truncations, and random changes to single bytes.
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<int> uniform_byte(0, 255);
+  for (int i = 0; i < 20000; ++i) {
+    std::string corrupted = compressed;
+    if (i < static_cast<int>(compressed.size())) {
+      corrupted.resize(i);
+    } else {
+      std::uniform_int_distribution<size_t> uniform_pos(0,
+                                                        corrupted.size() - 1);
+      corrupted[uniform_pos(rng)] = static_cast<char>(uniform_byte(rng));
+    }
+    const bool valid = snappy::IsValidCompressedBuffer(corrupted.data(),
+                                                       corrupted.size());
+    CountingDecompressionWriter writer;
+    EXPECT_EQ(valid,
+              UncompressTo(corrupted.data(), corrupted.size(), &writer));
+    FlatDecompressionWriter flat_writer(input.size() + 100);
+    EXPECT_EQ(valid,
+              UncompressTo(corrupted.data(), corrupted.size(), &flat_writer));
+    CompressedTagIterator it(corrupted.data(), corrupted.size());
+    CompressedTag tag;
+    while (it.Next(&tag)) {
+    }
+    EXPECT_EQ(valid, it.done());
+  }
+}
+
+TEST(Snappy, CompressedTagIterator) {
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    const std::string input = ReadTestDataFile(kTestDataFiles[i].filename,
+                                               kTestDataFiles[i].size_limit);
+    std::string compressed;
+    Compress(input.data(), input.size(), &compressed);
+
+    // Rebuild the input from the elements, and check that they tile both the
+    // compressed and the uncompressed data.
+    CompressedTagIterator it(compressed.data(), compressed.size());
+    EXPECT_EQ(input.size(), it.uncompressed_length());
+    std::string uncompressed;
+    size_t compressed_offset = it.compressed_offset();
+    CompressedTag tag;
+    while (it.Next(&tag)) {
+      EXPECT_EQ(compressed_offset, tag.compressed_offset);
+      EXPECT_EQ(uncompressed.size(), tag.uncompressed_offset);
+      if (tag.is_literal) {
+        EXPECT_EQ(compressed.data() + tag.compressed_offset +
+                      tag.compressed_length,
+                  tag.literal + tag.length);
+        EXPECT_EQ(0, tag.copy_offset);
+        uncompressed.append(tag.literal, tag.length);
+      } else {
+        EXPECT_EQ(nullptr, tag.literal);
+        for (size_t j = 0; j < tag.length; ++j) {
+          uncompressed.push_back(
+              uncompressed[tag.uncompressed_offset - tag.copy_offset + j]);
+        }
+      }
+      compressed_offset += tag.compressed_length;
+    }
+    EXPECT_TRUE(it.done());
+    EXPECT_EQ(compressed.size(), it.compressed_offset());
+    EXPECT_EQ(input.size(), it.uncompressed_offset());
+    EXPECT_EQ(input, uncompressed);
+  }
+
+  // Every kind of tag, including copies with 4-byte offsets, which the
+  // compressor does not emit, each followed by every other kind, and a copy
+  // ending within 4 bytes of the end of the input.
+  const std::string html = ReadTestDataFile("html", 0);
+  std::string expected = html;
+  std::string body;
+  AppendLiteral(&body, html);  // A long literal.
+  auto append_copy = [&](size_t offset, size_t length) {
+    AppendCopy(&body, static_cast<int>(offset), static_cast<int>(length));
+    for (size_t j = 0; j < length; ++j) {
+      expected.push_back(expected[expected.size() - offset]);
+    }
+  };
+  append_copy(70000, 10);  // 4-byte offset.
+  AppendLiteral(&body, "abc");
+  expected += "abc";
+  append_copy(5, 4);  // 1-byte offset.
+  append_copy(70000, 4);
+  append_copy(3000, 20);  // 2-byte offset.
+  append_copy(70000, 60);
+  append_copy(1, 64);
+  append_copy(3000, 7);  // 3 bytes, decoded by the slow path.
+  std::string compressed;
+  Varint::Append32(&compressed, expected.size());
+  compressed += body;
+  {
+    CompressedTagIterator it(compressed.data(), compressed.size());
+    std::string uncompressed;
+    CompressedTag tag;
+    while (it.Next(&tag)) {
+      if (tag.is_literal) {
+        uncompressed.append(tag.literal, tag.length);
+      } else {
+        for (size_t j = 0; j < tag.length; ++j) {
+          uncompressed.push_back(
+              uncompressed[tag.uncompressed_offset - tag.copy_offset + j]);
+        }
+      }
+    }
+    EXPECT_TRUE(it.done());
+    EXPECT_EQ(expected, uncompressed);
+  }
+
+  // A copy from before the start of the output is reported at its position.
+  std::string corrupt;
+  Varint::Append32(&corrupt, 10);
+  corrupt += '\x00';  // 1-byte literal.
+  corrupt += 'a';
+  corrupt += '\x05';  // 5-byte copy with offset 2.
+  corrupt += '\x02';
+  CompressedTagIterator it(corrupt.data(), corrupt.size());
+  CompressedTag tag;
+  EXPECT_TRUE(it.Next(&tag));
+  EXPECT_FALSE(it.Next(&tag));
+  EXPECT_FALSE(it.ok());
+  EXPECT_FALSE(it.done());
+  EXPECT_EQ(3, it.compressed_offset());
+
+  // A literal of 2^32 bytes, whose length wraps around to 0 in a 32-bit
+  // size_t, is rejected, with and without the unconditional 4-byte load.
+  for (size_t padding : {0, 8}) {
+    std::string huge_literal;
+    Varint::Append32(&huge_literal, 0);
+    huge_literal += '\xfc';  // Literal with a 4-byte length.
+    huge_literal.append(4, '\xff');
+    huge_literal.append(padding, 'a');
+    CountingDecompressionWriter writer;
+    EXPECT_FALSE(
+        UncompressTo(huge_literal.data(), huge_literal.size(), &writer));
+    CompressedTagIterator huge_it(huge_literal.data(), huge_literal.size());
+    EXPECT_FALSE(huge_it.Next(&tag));
+    EXPECT_FALSE(huge_it.ok());
+  }
+}
+
+// Returns the offsets of all occurrences of "pattern" in "data".
+std::vector<size_t> NaiveFindAll(const std::string& data,
+                                 const std::string& pattern) {
+  std::vector<size_t> offsets;
+  for (size_t pos = data.find(pattern); pos != std::string::npos;
+       pos = data.find(pattern, pos + 1)) {
+    offsets.push_back(pos);
+  }
+  return offsets;
+}
+
+TEST(Snappy, FindInCompressed) {
+  std::vector<std::string> inputs;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    inputs.push_back(ReadTestDataFile(kTestDataFiles[i].filename,
+                                      kTestDataFiles[i].size_limit));
+  }
+  // Overlapping copies, and occurrences that overlap each other.
+  inputs.push_back(std::string(1000, 'a') + "b" + std::string(70000, 'a'));
+  // Many times the size of the window that FindInCompressed() keeps.
+  std::string all;
+  for (const std::string& input : inputs) all += input;
+  inputs.push_back(all);
+
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  for (const std::string& input : inputs) {
+    std::string compressed;
+    Compress(input.data(), input.size(), &compressed);
+
+    std::vector<std::string> patterns = {"a", "aa", "aaab", "http://", "the ",
+                                         "not present in any test file"};
+    for (size_t length : {1, 2, 3, 8, 40, 200}) {
+      if (input.size() < length) continue;
+      std::uniform_int_distribution<size_t> uniform_pos(0,
+                                                        input.size() - length);
+      patterns.push_back(input.substr(uniform_pos(rng), length));
+    }
+    for (const std::string& pattern : patterns) {
+      std::vector<size_t> offsets = {12345};
+      EXPECT_TRUE(FindInCompressed(compressed.data(), compressed.size(),
+                                   pattern.data(), pattern.size(), &offsets));
+      std::vector<size_t> expected = {12345};
+      for (size_t offset : NaiveFindAll(input, pattern)) {
+        expected.push_back(offset);
+      }
+      EXPECT_EQ(expected, offsets) << pattern;
+    }
+  }
+
+  std::string compressed;
+  Compress(inputs[0].data(), inputs[0].size(), &compressed);
+  std::vector<size_t> offsets;
+  EXPECT_TRUE(FindInCompressed(compressed.data(), compressed.size(), "", 0,
+                               &offsets));
+  EXPECT_TRUE(offsets.empty());
+  EXPECT_FALSE(FindInCompressed(compressed.data(), compressed.size() - 1,
+                                "a", 1, &offsets));
+
+  // A copy from further back than Compress() ever reaches, which does not fit
+  // in the window.
+  const std::string needle = "needle";
+  const std::string filler(1 << 20, 'x');
+  std::string far;
+  Varint::Append32(&far, 2 * needle.size() + filler.size());
+  AppendLiteral(&far, needle);
+  AppendLiteral(&far, filler);
+  AppendCopy(&far, needle.size() + filler.size(), needle.size());
+  offsets.clear();
+  EXPECT_TRUE(FindInCompressed(far.data(), far.size(), "xnee", 4, &offsets));
+  EXPECT_EQ(std::vector<size_t>({needle.size() + filler.size() - 1}), offsets);
+  offsets.clear();
+  far.back() ^= 1;  // Now reaches back before the start of the output.
+  EXPECT_FALSE(FindInCompressed(far.data(), far.size(), "xnee", 4, &offsets));
+  EXPECT_TRUE(offsets.empty());
+
+  // The window is not sized from the header before the input is validated.
+  std::string huge;
+  Varint::Append32(&huge, std::numeric_limits<uint32_t>::max());
+  AppendLiteral(&huge, needle);
+  AllocationCounter counter;
+  EXPECT_FALSE(FindInCompressed(huge.data(), huge.size(), "ne", 2, &offsets));
+  EXPECT_LT(counter.bytes(), 1 << 20);
+  EXPECT_TRUE(offsets.empty());
+}
+
+TEST(Snappy, ConcatAndSplitCompressed) {
+  std::vector<std::string> inputs = {""};
+  std::string all;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    inputs.push_back(ReadTestDataFile(kTestDataFiles[i].filename,
+                                      kTestDataFiles[i].size_limit));
+    all += inputs.back();
+  }
+  inputs.push_back(all);
+
+  std::vector<std::string> compressed(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    Compress(inputs[i].data(), inputs[i].size(), &compressed[i]);
+  }
+
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<size_t> uniform_index(0, inputs.size() - 1);
+  for (int i = 0; i < 20; ++i) {
+    const size_t a = uniform_index(rng);
+    const size_t b = uniform_index(rng);
+    std::string concatenated, uncompressed;
+    ASSERT_TRUE(ConcatCompressed(compressed[a].data(), compressed[a].size(),
+                                 compressed[b].data(), compressed[b].size(),
+                                 &concatenated));
+    ASSERT_TRUE(IsValidCompressedBuffer(concatenated));
+    ASSERT_TRUE(Uncompress(concatenated, &uncompressed));
+    EXPECT_EQ(inputs[a] + inputs[b], uncompressed);
+  }
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    std::vector<std::string> pieces;
+    ASSERT_TRUE(SplitCompressed(compressed[i].data(), compressed[i].size(),
+                                &pieces));
+    EXPECT_EQ(std::max<size_t>(1, (inputs[i].size() + kBlockSize - 1) /
+                                      kBlockSize),
+              pieces.size());
+    std::string uncompressed, joined = pieces[0];
+    for (size_t j = 0; j < pieces.size(); ++j) {
+      std::string piece;
+      ASSERT_TRUE(Uncompress(pieces[j], &piece));
+      EXPECT_EQ(inputs[i].substr(j * kBlockSize, kBlockSize), piece);
+      uncompressed += piece;
+      if (j > 0) {
+        std::string previous = joined;
+        ASSERT_TRUE(ConcatCompressed(previous.data(), previous.size(),
+                                     pieces[j].data(), pieces[j].size(),
+                                     &joined));
+      }
+    }
+    EXPECT_EQ(inputs[i], uncompressed);
+    EXPECT_EQ(compressed[i], joined);
+  }
+
+  // A copy that reaches back across the fragment boundary rules it out.
+  std::string long_copy;
+  Varint::Append32(&long_copy, kBlockSize + 64);
+  AppendLiteral(&long_copy, std::string(kBlockSize, 'x'));
+  AppendCopy(&long_copy, kBlockSize, 64);
+  std::vector<std::string> pieces;
+  ASSERT_TRUE(SplitCompressed(long_copy.data(), long_copy.size(), &pieces));
+  ASSERT_EQ(1, pieces.size());
+  EXPECT_EQ(long_copy, pieces[0]);
+
+  EXPECT_FALSE(SplitCompressed(compressed.back().data(),
+                               compressed.back().size() - 1, &pieces));
+  std::string concatenated;
+  EXPECT_FALSE(ConcatCompressed("\xff", 1, compressed[1].data(),
+                                compressed[1].size(), &concatenated));
+  const std::string huge = "\xff\xff\xff\xff\x0f";
+  EXPECT_FALSE(ConcatCompressed(huge.data(), huge.size(), huge.data(),
+                                huge.size(), &concatenated));
+}
+
+TEST(Snappy, Recompress) {
+  std::vector<std::string> inputs = {"", "a", std::string(100000, 'x')};
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    inputs.push_back(ReadTestDataFile(kTestDataFiles[i].filename,
+                                      kTestDataFiles[i].size_limit));
+  }
+  // A copy with a 4-byte offset.
+  std::string far_copy;
+  Varint::Append32(&far_copy, 70000 + 100);
+  AppendLiteral(&far_copy, std::string(70000, 'y'));
+  AppendCopy(&far_copy, 70000, 100);
+
+  size_t total_compressed = 0, total_recompressed = 0;
+  for (const std::string& input : inputs) {
+    std::string compressed, recompressed, uncompressed;
+    Compress(input.data(), input.size(), &compressed);
+    ASSERT_TRUE(Recompress(compressed.data(), compressed.size(),
+                           &recompressed));
+    EXPECT_LE(recompressed.size(), compressed.size());
+    ASSERT_TRUE(IsValidCompressedBuffer(recompressed));
+    ASSERT_TRUE(Uncompress(recompressed, &uncompressed));
+    EXPECT_EQ(input, uncompressed);
+    total_compressed += compressed.size();
+    total_recompressed += recompressed.size();
+  }
+  EXPECT_LT(total_recompressed, total_compressed);
+
+  std::string recompressed, uncompressed;
+  ASSERT_TRUE(Recompress(far_copy.data(), far_copy.size(), &recompressed));
+  ASSERT_TRUE(Uncompress(recompressed, &uncompressed));
+  EXPECT_EQ(std::string(70000, 'y') + std::string(100, 'y'), uncompressed);
+
+  EXPECT_FALSE(Recompress(far_copy.data(), far_copy.size() - 1,
+                          &recompressed));
+
+  // One-byte literals of random data merge into a pending literal that has to
+  // be emitted in several pieces.
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<int> uniform_byte(0, 255);
+  std::string random(3 * kBlockSize + 1000, '\0');
+  std::string one_byte_literals;
+  Varint::Append32(&one_byte_literals, random.size());
+  for (char& c : random) {
+    c = static_cast<char>(uniform_byte(rng));
+    AppendLiteral(&one_byte_literals, std::string(1, c));
+  }
+  ASSERT_TRUE(Recompress(one_byte_literals.data(), one_byte_literals.size(),
+                         &recompressed));
+  ASSERT_TRUE(Uncompress(recompressed, &uncompressed));
+  EXPECT_EQ(random, uncompressed);
+  int literals = 0;
+  CompressedTagIterator it(recompressed.data(), recompressed.size());
+  CompressedTag tag;
+  while (it.Next(&tag)) {
+    if (!tag.is_literal) continue;
+    EXPECT_LE(tag.length, kBlockSize);
+    ++literals;
+  }
+  EXPECT_TRUE(it.done());
+  EXPECT_GE(literals, 4);
+}
+
 TEST(Snappy, FindMatchLength) {
   // Exercise all different code paths through the function.
   // 64-bit version:
@@ -954,6 +1855,1022 @@ TEST(Snappy, VerifyCharTable) {
   }
 }
 
+TEST(Snappy, Crc32c) {
+  // Test vectors from RFC 3720, section B.4.
+  const std::string zeros(32, '\0');
+  EXPECT_EQ(0x8a9136aau, internal::Crc32c(zeros.data(), zeros.size()));
+  const std::string ones(32, '\xff');
+  EXPECT_EQ(0x62a8ab43u, internal::Crc32c(ones.data(), ones.size()));
+  std::string ascending;
+  for (int i = 0; i < 32; ++i) ascending.push_back(static_cast<char>(i));
+  EXPECT_EQ(0x46dd794eu, internal::Crc32c(ascending.data(), ascending.size()));
+  EXPECT_EQ(0xe3069283u, internal::Crc32c("123456789", 9));
+
+  // Extending must be equivalent to checksumming the concatenation.
+  const std::string input = ReadTestDataFile("alice29.txt", 5000);
+  const uint32_t crc = internal::Crc32c(input.data(), input.size());
+  for (size_t split : {0, 1, 7, 8, 9, 1000, 4999, 5000}) {
+    EXPECT_EQ(crc, internal::Crc32cExtend(
+                       internal::Crc32c(input.data(), split),
+                       input.data() + split, input.size() - split));
+  }
+  EXPECT_EQ(crc, internal::UnmaskCrc32c(internal::MaskCrc32c(crc)));
+}
+
+// A Sink that appends to a std::string.
+class StringAppendSink : public Sink {
+ public:
+  explicit StringAppendSink(std::string* dest) : dest_(dest) {}
+  void Append(const char* data, size_t n) override { dest_->append(data, n); }
+
+ private:
+  std::string* dest_;
+};
+
+// A bump allocator over a fixed buffer, like a per-request arena, that
+// counts what is allocated from it.
+class ArenaAllocator : public snappy::Allocator {
+ public:
+  explicit ArenaAllocator(size_t size) : arena_(size), used_(0) {}
+
+  char* Allocate(size_t size) override {
+    CHECK_LE(used_ + size, arena_.size());
+    char* ptr = arena_.data() + used_;
+    used_ += size;
+    ++allocations_;
+    live_bytes_ += size;
+    return ptr;
+  }
+
+  void Deallocate(char* ptr, size_t size) override {
+    EXPECT_TRUE(Owns(ptr));
+    live_bytes_ -= size;
+  }
+
+  bool Owns(const char* ptr) const {
+    return ptr >= arena_.data() && ptr < arena_.data() + arena_.size();
+  }
+  int allocations() const { return allocations_; }
+  size_t live_bytes() const { return live_bytes_; }
+
+ private:
+  std::vector<char> arena_;
+  size_t used_;
+  int allocations_ = 0;
+  size_t live_bytes_ = 0;
+};
+
+TEST(Snappy, Allocator) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string expected;
+  Compress(input.data(), input.size(), &expected);
+
+  ArenaAllocator arena(4 * input.size());
+  {
+    ByteArraySource source(input.data(), input.size());
+    std::string compressed;
+    StringAppendSink sink(&compressed);
+    EXPECT_EQ(expected.size(), Compress(&source, &sink, &arena));
+    EXPECT_EQ(expected, compressed);
+  }
+  {
+    std::string compressed;
+    EXPECT_EQ(expected.size(),
+              Compress(input.data(), input.size(), &compressed, &arena));
+    EXPECT_EQ(expected, compressed);
+
+    std::string uncompressed = "garbage";
+    EXPECT_TRUE(snappy::Uncompress<std::allocator<char>>(
+        compressed.data(), compressed.size(), &uncompressed));
+    EXPECT_EQ(input, uncompressed);
+  }
+  EXPECT_EQ(2, arena.allocations());
+  EXPECT_EQ(0, arena.live_bytes());
+
+  // The blocks handed to the sink come from the arena, and go back to it
+  // when the sink releases them.
+  {
+    BlockOwningSink sink;
+    ByteArraySource source(expected.data(), expected.size());
+    EXPECT_TRUE(snappy::Uncompress(&source, &sink, &arena));
+    EXPECT_EQ(input, sink.contents());
+    for (const char* block : sink.block_addresses()) {
+      EXPECT_TRUE(arena.Owns(block));
+    }
+    EXPECT_EQ(input.size(), arena.live_bytes());
+  }
+  EXPECT_EQ(0, arena.live_bytes());
+
+  // Truncated input: the partial last block is copied out and released.
+  {
+    BlockOwningSink sink;
+    ByteArraySource source(expected.data(), expected.size() - 10);
+    size_t produced = UncompressAsMuchAsPossible(&source, &sink, &arena);
+    EXPECT_LT(produced, input.size());
+    EXPECT_EQ(input.substr(0, produced), sink.contents().substr(0, produced));
+  }
+  EXPECT_EQ(0, arena.live_bytes());
+}
+
+// Every allocation a call makes shows up here, through AllocationCounter.
+// Compression allocates its WorkingMemory once unless it gets an Allocator,
+// and everything that writes into memory the caller provides allocates
+// nothing.
+TEST(Snappy, AllocationBudgets) {
+  std::string input = ReadTestDataFile("html", 0);
+  input += input;  // More than one block.
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+  std::vector<char> output(snappy::MaxCompressedLength(input.size()));
+  std::vector<char> uncompressed(input.size());
+  ArenaAllocator arena(4 * input.size());
+  size_t length;
+  // Builds its lookup tables on first use.
+  snappy::Crc32c(input.data(), input.size());
+
+  AllocationCounter counter;
+  snappy::RawCompress(input.data(), input.size(), output.data(), &length);
+  EXPECT_EQ(1, counter.allocations());
+  counter.Reset();
+  snappy::RawCompress(input.data(), input.size(), output.data(), &length,
+                      &arena);
+  EXPECT_EQ(0, counter.allocations());
+  {
+    std::string dest;
+    counter.Reset();
+    snappy::Compress(input.data(), input.size(), &dest);
+    // The string and the WorkingMemory.
+    EXPECT_EQ(2, counter.allocations());
+    dest.clear();
+    counter.Reset();
+    snappy::Compress(input.data(), input.size(), &dest, &arena);
+    EXPECT_EQ(0, counter.allocations());
+  }
+  {
+    ByteArraySource source(input.data(), input.size());
+    UncheckedByteArraySink sink(output.data());
+    counter.Reset();
+    snappy::Compress(&source, &sink);
+    EXPECT_EQ(1, counter.allocations());
+  }
+  {
+    ByteArraySource source(input.data(), input.size());
+    UncheckedByteArraySink sink(output.data());
+    counter.Reset();
+    snappy::Compress(&source, &sink, &arena);
+    EXPECT_EQ(0, counter.allocations());
+  }
+
+  counter.Reset();
+  EXPECT_TRUE(snappy::GetUncompressedLength(compressed.data(),
+                                            compressed.size(), &length));
+  EXPECT_TRUE(snappy::IsValidCompressedBuffer(compressed.data(),
+                                              compressed.size()));
+  EXPECT_TRUE(snappy::RawUncompress(compressed.data(), compressed.size(),
+                                    uncompressed.data()));
+  struct iovec iov[2] = {{uncompressed.data(), 1000},
+                         {uncompressed.data() + 1000, input.size() - 1000}};
+  EXPECT_TRUE(snappy::RawUncompressToIOVec(compressed.data(),
+                                           compressed.size(), iov, 2));
+  snappy::Crc32c(input.data(), input.size());
+  EXPECT_EQ(0, counter.allocations());
+  {
+    ByteArraySource source(compressed.data(), compressed.size());
+    ByteArraySource validate_source(compressed.data(), compressed.size());
+    counter.Reset();
+    EXPECT_TRUE(snappy::RawUncompress(&source, uncompressed.data()));
+    EXPECT_TRUE(snappy::IsValidCompressed(&validate_source));
+    EXPECT_EQ(0, counter.allocations());
+  }
+  {
+    ByteArraySource source(compressed.data(), compressed.size());
+    UncheckedByteArraySink sink(uncompressed.data());
+    counter.Reset();
+    EXPECT_TRUE(snappy::Uncompress(&source, &sink));
+    EXPECT_EQ(0, counter.allocations());
+  }
+  {
+    std::string dest;
+    counter.Reset();
+    EXPECT_TRUE(snappy::Uncompress(compressed.data(), compressed.size(),
+                                   &dest));
+    EXPECT_EQ(1, counter.allocations());
+    counter.Reset();
+    EXPECT_TRUE(snappy::Uncompress(compressed.data(), compressed.size(),
+                                   &dest));
+    EXPECT_EQ(0, counter.allocations());
+  }
+  // Once the block pool is enabled and warm, only the writer's bookkeeping is
+  // allocated, not the blocks themselves.
+  SetBlockPoolLimits(4, 64);
+  for (int i = 0; i < 2; ++i) {
+    ByteArraySource source(compressed.data(), compressed.size());
+    UncheckedByteArraySink sink(uncompressed.data());
+    counter.Reset();
+    EXPECT_EQ(input.size(),
+              snappy::UncompressAsMuchAsPossible(&source, &sink));
+  }
+  EXPECT_LT(counter.bytes(), static_cast<int64_t>(snappy::kBlockSize));
+  SetBlockPoolLimits(0, 0);
+  TrimBlockPool();
+
+  // The C API.
+  length = output.size();
+  counter.Reset();
+  EXPECT_EQ(SNAPPY_OK, snappy_compress(input.data(), input.size(),
+                                       output.data(), &length));
+  EXPECT_EQ(1, counter.allocations());
+  length = uncompressed.size();
+  counter.Reset();
+  EXPECT_EQ(SNAPPY_OK, snappy_uncompress(compressed.data(), compressed.size(),
+                                         uncompressed.data(), &length));
+  EXPECT_EQ(0, counter.allocations());
+  snappy_env* env = snappy_env_create();
+  for (int i = 0; i < 2; ++i) {
+    length = output.size();
+    counter.Reset();
+    EXPECT_EQ(SNAPPY_OK, snappy_env_compress(env, input.data(), input.size(),
+                                             output.data(), &length));
+  }
+  // The environment keeps its memory from the first call.
+  EXPECT_EQ(0, counter.allocations());
+  snappy_env_destroy(env);
+}
+
+TEST(Snappy, Crc32cWhileCompressingAndUncompressing) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  const uint32_t expected_crc = Crc32c(input.data(), input.size());
+
+  std::string compressed;
+  uint32_t compress_crc = 0;
+  ByteArraySource source(input.data(), input.size());
+  StringAppendSink sink(&compressed);
+  EXPECT_EQ(compressed.size(), CompressWithCrc32c(&source, &sink,
+                                                  &compress_crc));
+  EXPECT_EQ(expected_crc, compress_crc);
+
+  std::string uncompressed(input.size(), '\0');
+  uint32_t uncompress_crc = 0;
+  EXPECT_TRUE(RawUncompressWithCrc32c(compressed.data(), compressed.size(),
+                                      string_as_array(&uncompressed),
+                                      &uncompress_crc));
+  EXPECT_EQ(input, uncompressed);
+  EXPECT_EQ(expected_crc, uncompress_crc);
+
+  // Output split at odd sizes, so pieces straddle iovec entries.
+  std::string iovec_data(input.size(), '\0');
+  std::vector<struct iovec> iov;
+  for (size_t offset = 0; offset < input.size(); offset += 3001) {
+    struct iovec entry;
+    entry.iov_base = string_as_array(&iovec_data) + offset;
+    entry.iov_len = std::min<size_t>(3001, input.size() - offset);
+    iov.push_back(entry);
+  }
+  uncompress_crc = 0;
+  EXPECT_TRUE(RawUncompressToIOVecWithCrc32c(compressed.data(),
+                                             compressed.size(), iov.data(),
+                                             iov.size(), &uncompress_crc));
+  EXPECT_EQ(input, iovec_data);
+  EXPECT_EQ(expected_crc, uncompress_crc);
+
+  EXPECT_FALSE(RawUncompressWithCrc32c(compressed.data(),
+                                       compressed.size() - 1,
+                                       string_as_array(&uncompressed),
+                                       &uncompress_crc));
+}
+
+// Returns "size" bytes alternating between compressible text and random
+// data, so that framed streams contain both compressed and uncompressed
+// chunks.
+std::string FramingTestData(size_t size) {
+  const std::string text = ReadTestDataFile("alice29.txt", 0);
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<int> uniform_byte(0, 255);
+  std::string data;
+  size_t text_pos = 0;
+  while (data.size() < size) {
+    for (int i = 0; i < 40000 && data.size() < size; ++i) {
+      data.push_back(text[text_pos++ % text.size()]);
+    }
+    for (int i = 0; i < 70000 && data.size() < size; ++i) {
+      data.push_back(static_cast<char>(uniform_byte(rng)));
+    }
+  }
+  return data;
+}
+
+std::string CompressFramedString(const std::string& input,
+                                 bool with_seek_table) {
+  std::string framed;
+  ByteArraySource source(input.data(), input.size());
+  StringAppendSink sink(&framed);
+  const size_t written = CompressFramed(&source, &sink, with_seek_table);
+  CHECK_EQ(written, framed.size());
+  return framed;
+}
+
+TEST(SnappySinkSource, StringSink) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+
+  std::string compressed = "prefix";
+  {
+    ByteArraySource source(input.data(), input.size());
+    StringSink sink(&compressed);
+    const size_t written = Compress(&source, &sink);
+    EXPECT_EQ(6 + written, compressed.size());
+  }
+  std::string expected;
+  Compress(input.data(), input.size(), &expected);
+  EXPECT_EQ("prefix" + expected, compressed);
+  compressed.erase(0, 6);
+
+  // Decompression writes straight into the string.
+  std::string uncompressed;
+  {
+    ByteArraySource source(compressed.data(), compressed.size());
+    StringSink sink(&uncompressed);
+    EXPECT_TRUE(snappy::Uncompress(&source, &sink));
+    EXPECT_EQ(input, uncompressed);
+  }
+
+  // Appends that do not fill in the sink's own buffer are copied, and a
+  // buffer that is not appended does not show up.
+  std::string out;
+  {
+    StringSink sink(&out);
+    char scratch[16];
+    size_t allocated;
+    char* buf = sink.GetAppendBufferVariable(4, 100, scratch, sizeof(scratch),
+                                             &allocated);
+    EXPECT_GE(allocated, 100);
+    std::memcpy(buf, "abc", 3);
+    sink.Append(buf, 3);
+    EXPECT_EQ("abc", out);
+    sink.Append("def", 3);
+    sink.GetAppendBuffer(50, scratch);
+    sink.Append("gh", 2);
+    EXPECT_EQ("abcdefgh", out);
+    sink.GetAppendBuffer(50, scratch);
+  }
+  EXPECT_EQ("abcdefgh", out);
+}
+
+TEST(SnappySinkSource, RopeSink) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  auto flatten = [](const RopeSink& sink) {
+    std::string flat(sink.size(), '\0');
+    sink.CopyTo(string_as_array(&flat));
+    return flat;
+  };
+
+  {
+    ByteArraySource source(input.data(), input.size());
+    RopeSink sink;
+    Compress(&source, &sink);
+    EXPECT_EQ(compressed, flatten(sink));
+  }
+
+  // Decompression hands its blocks over instead of copying them.
+  {
+    ByteArraySource source(compressed.data(), compressed.size());
+    RopeSink sink;
+    EXPECT_TRUE(snappy::Uncompress(&source, &sink));
+    EXPECT_EQ(input, flatten(sink));
+    EXPECT_EQ((input.size() + kBlockSize - 1) / kBlockSize, sink.num_pieces());
+  }
+
+  // Small outputs are decompressed into a piece of the sink.
+  {
+    std::string small_compressed;
+    Compress(input.data(), 1000, &small_compressed);
+    ByteArraySource source(small_compressed.data(), small_compressed.size());
+    RopeSink sink;
+    EXPECT_TRUE(snappy::Uncompress(&source, &sink));
+    EXPECT_EQ(input.substr(0, 1000), flatten(sink));
+    EXPECT_EQ(1, sink.num_pieces());
+  }
+
+  // Copied appends are split across pieces of the block size.
+  {
+    RopeSink sink(100);
+    for (size_t i = 0; i < 1000; i += 30) {
+      sink.Append(input.data() + i, std::min<size_t>(30, 1000 - i));
+    }
+    EXPECT_EQ(input.substr(0, 1000), flatten(sink));
+    EXPECT_EQ(10, sink.num_pieces());
+    for (size_t i = 0; i < sink.num_pieces(); ++i) {
+      EXPECT_EQ(100, sink.piece_size(i));
+    }
+  }
+}
+
+#if HAVE_UNISTD_H
+
+// Returns the contents of "fd" from offset 0 to its end.
+std::string ReadFd(int fd) {
+  std::string contents;
+  char buf[4096];
+  ssize_t n;
+  CHECK_EQ(0, lseek(fd, 0, SEEK_SET));
+  while ((n = read(fd, buf, sizeof(buf))) > 0) contents.append(buf, n);
+  return contents;
+}
+
+TEST(SnappySinkSource, FileSourceAndSink) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  // Buffers smaller than a compressed block exercise the scratch paths;
+  // buffers larger than the output give flat decompression.
+  for (size_t buffer_size : {size_t{4096}, size_t{100000},
+                             FileSink::kDefaultBufferSize, size_t{8 << 20}}) {
+    std::FILE* in = std::tmpfile();
+    std::FILE* out = std::tmpfile();
+    ASSERT_NE(nullptr, in);
+    ASSERT_NE(nullptr, out);
+    const int in_fd = fileno(in), out_fd = fileno(out);
+
+    {
+      FileSink sink(in_fd, buffer_size);
+      sink.Append(input.data(), input.size());
+      EXPECT_TRUE(sink.Flush());
+    }
+    ASSERT_EQ(input, ReadFd(in_fd));
+
+    ASSERT_EQ(0, lseek(in_fd, 0, SEEK_SET));
+    {
+      FileSource source(in_fd, buffer_size);
+      FileSink sink(out_fd, buffer_size);
+      EXPECT_EQ(input.size(), source.Available());
+      Compress(&source, &sink);
+      EXPECT_EQ(0, source.Available());
+      EXPECT_TRUE(source.ok());
+      EXPECT_TRUE(sink.Flush());
+    }
+    const std::string file_compressed = ReadFd(out_fd);
+    EXPECT_EQ(compressed, file_compressed);
+
+    ASSERT_EQ(0, ftruncate(in_fd, 0));
+    ASSERT_EQ(0, lseek(in_fd, 0, SEEK_SET));
+    ASSERT_EQ(0, lseek(out_fd, 0, SEEK_SET));
+    {
+      FileSource source(out_fd, buffer_size);
+      FileSink sink(in_fd, buffer_size);
+      EXPECT_TRUE(Uncompress(&source, &sink));
+      EXPECT_TRUE(sink.Flush());
+    }
+    EXPECT_EQ(input, ReadFd(in_fd));
+
+    // Skipping past the buffered data, and reading from a nonzero offset.
+    ASSERT_EQ(10, lseek(in_fd, 10, SEEK_SET));
+    FileSource source(in_fd, buffer_size);
+    EXPECT_EQ(input.size() - 10, source.Available());
+    size_t len;
+    source.Peek(&len);
+    const size_t skip = std::min(len + 12345, source.Available() - 1);
+    source.Skip(skip);
+    const char* p = source.Peek(&len);
+    ASSERT_GT(len, 0);
+    EXPECT_EQ(input[10 + skip], *p);
+    EXPECT_TRUE(source.ok());
+
+    std::fclose(in);
+    std::fclose(out);
+  }
+}
+
+TEST(SnappySinkSource, UringFileSourceAndSink) {
+  std::string input;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    input += ReadTestDataFile(kTestDataFiles[i].filename,
+                              kTestDataFiles[i].size_limit);
+  }
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  // Files no larger than one buffer are read synchronously. Buffers smaller
+  // than a compressed block exercise the scratch paths.
+  for (size_t buffer_size : {size_t{4096}, size_t{100000},
+                             UringFileSink::kDefaultBufferSize,
+                             size_t{8 << 20}}) {
+    for (int num_buffers : {1, 2, UringFileSink::kDefaultNumBuffers}) {
+      std::FILE* in = std::tmpfile();
+      std::FILE* out = std::tmpfile();
+      ASSERT_NE(nullptr, in);
+      ASSERT_NE(nullptr, out);
+      const int in_fd = fileno(in), out_fd = fileno(out);
+
+      {
+        UringFileSink sink(in_fd, buffer_size, num_buffers);
+        sink.Append(input.data(), input.size());
+        EXPECT_TRUE(sink.Flush());
+        EXPECT_EQ(static_cast<off_t>(input.size()),
+                  lseek(in_fd, 0, SEEK_CUR));
+      }
+      ASSERT_EQ(input, ReadFd(in_fd));
+
+      ASSERT_EQ(0, lseek(in_fd, 0, SEEK_SET));
+      {
+        UringFileSource source(in_fd, buffer_size, num_buffers);
+        UringFileSink sink(out_fd, buffer_size, num_buffers);
+        EXPECT_EQ(input.size(), source.Available());
+        Compress(&source, &sink);
+        EXPECT_EQ(0, source.Available());
+        EXPECT_TRUE(source.ok());
+        EXPECT_TRUE(sink.Flush());
+      }
+      EXPECT_EQ(compressed, ReadFd(out_fd));
+
+      ASSERT_EQ(0, ftruncate(in_fd, 0));
+      ASSERT_EQ(0, lseek(in_fd, 0, SEEK_SET));
+      ASSERT_EQ(0, lseek(out_fd, 0, SEEK_SET));
+      {
+        UringFileSource source(out_fd, buffer_size, num_buffers);
+        UringFileSink sink(in_fd, buffer_size, num_buffers);
+        EXPECT_TRUE(Uncompress(&source, &sink));
+        EXPECT_TRUE(source.ok());
+        EXPECT_TRUE(sink.Flush());
+      }
+      EXPECT_EQ(input, ReadFd(in_fd));
+
+      // Skipping across buffers, from a nonzero offset.
+      ASSERT_EQ(10, lseek(in_fd, 10, SEEK_SET));
+      UringFileSource source(in_fd, buffer_size, num_buffers);
+      EXPECT_EQ(input.size() - 10, source.Available());
+      size_t len;
+      source.Peek(&len);
+      const size_t skip = std::min(3 * buffer_size + 12345,
+                                   source.Available() - 1);
+      source.Skip(skip);
+      const char* p = source.Peek(&len);
+      ASSERT_GT(len, 0);
+      EXPECT_EQ(input[10 + skip], *p);
+      EXPECT_TRUE(source.ok());
+
+      std::fclose(in);
+      std::fclose(out);
+    }
+  }
+}
+
+#endif  // HAVE_UNISTD_H
+
+#if HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H
+
+TEST(SnappySinkSource, MmapSource) {
+  const std::string input = ReadTestDataFile("html_x_4", 0);
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+
+  for (bool populate : {false, true}) {
+    std::FILE* file = std::tmpfile();
+    ASSERT_NE(nullptr, file);
+    const int fd = fileno(file);
+    {
+      MmapSource empty(fd, populate);
+      EXPECT_TRUE(empty.ok());
+      EXPECT_EQ(0, empty.Available());
+    }
+    ASSERT_EQ(input.size(), write(fd, input.data(), input.size()));
+
+    MmapSource source(fd, populate);
+    ASSERT_TRUE(source.ok());
+    EXPECT_EQ(input.size(), source.Available());
+    size_t len;
+    const char* p = source.Peek(&len);
+    ASSERT_EQ(input.size(), len);
+    EXPECT_EQ(input, std::string(p, len));
+
+    std::string file_compressed;
+    StringAppendSink sink(&file_compressed);
+    Compress(&source, &sink);
+    EXPECT_EQ(compressed, file_compressed);
+    EXPECT_EQ(0, source.Available());
+    std::fclose(file);
+  }
+}
+
+#endif  // HAVE_FUNC_MMAP && HAVE_SYS_MMAN_H
+
+TEST(SnappyFraming, RoundTrip) {
+  for (size_t size : {0, 1, 100, 65535, 65536, 65537, 300000}) {
+    const std::string input = FramingTestData(size);
+    for (bool with_seek_table : {false, true}) {
+      const std::string framed = CompressFramedString(input, with_seek_table);
+      EXPECT_EQ(0, std::memcmp(framed.data(), "\xff\x06\x00\x00sNaPpY", 10));
+
+      std::string uncompressed;
+      ByteArraySource source(framed.data(), framed.size());
+      StringAppendSink sink(&uncompressed);
+      EXPECT_TRUE(UncompressFramed(&source, &sink));
+      EXPECT_EQ(input, uncompressed);
+    }
+  }
+}
+
+TEST(SnappyFraming, WriterChunkingIsIndependentOfAppendSizes) {
+  const std::string input = FramingTestData(200000);
+  const std::string expected = CompressFramedString(input, true);
+
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<size_t> uniform_100k(0, 100000);
+  std::string framed;
+  StringAppendSink sink(&framed);
+  FramedWriter writer(&sink, true);
+  for (size_t pos = 0; pos < input.size();) {
+    const size_t n = std::min(uniform_100k(rng), input.size() - pos);
+    writer.Append(input.data() + pos, n);
+    pos += n;
+  }
+  EXPECT_EQ(expected.size(), writer.Finish());
+  EXPECT_EQ(expected, framed);
+}
+
+TEST(SnappyFraming, SeekableReadAt) {
+  const std::string input = FramingTestData(1000000);
+  const std::string framed = CompressFramedString(input, true);
+
+  SeekableFramedReader reader(framed.data(), framed.size());
+  ASSERT_TRUE(reader.ReadSeekTable());
+  EXPECT_EQ(input.size(), reader.UncompressedLength());
+  EXPECT_EQ((input.size() + kBlockSize - 1) / kBlockSize, reader.NumChunks());
+
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<size_t> uniform_offset(0, input.size());
+  std::uniform_int_distribution<size_t> uniform_length(0, 200000);
+  std::string buffer;
+  for (int i = 0; i < 200; ++i) {
+    const size_t offset = uniform_offset(rng);
+    const size_t n = std::min(uniform_length(rng), input.size() - offset);
+    buffer.resize(n);
+    ASSERT_TRUE(reader.ReadAt(offset, n, string_as_array(&buffer)));
+    EXPECT_EQ(input.substr(offset, n), buffer);
+  }
+
+  char c;
+  EXPECT_FALSE(reader.ReadAt(input.size(), 1, &c));
+  EXPECT_TRUE(reader.ReadAt(input.size(), 0, &c));
+}
+
+TEST(SnappyFraming, SeekTableRequired) {
+  const std::string input = FramingTestData(100000);
+  const std::string framed = CompressFramedString(input, false);
+  SeekableFramedReader reader(framed.data(), framed.size());
+  EXPECT_FALSE(reader.ReadSeekTable());
+}
+
+TEST(SnappyFraming, Corruption) {
+  const std::string input = FramingTestData(300000);
+  const std::string framed = CompressFramedString(input, true);
+
+  // Corrupt the last byte of the first data chunk, which is compressed.
+  const size_t first_chunk_length =
+      LittleEndian::Load32(framed.data() + 10) >> 8;
+  std::string corrupted = framed;
+  corrupted[10 + 4 + first_chunk_length - 1] ^= 0x01;
+
+  std::string uncompressed;
+  ByteArraySource source(corrupted.data(), corrupted.size());
+  StringAppendSink sink(&uncompressed);
+  EXPECT_FALSE(UncompressFramed(&source, &sink));
+
+  SeekableFramedReader reader(corrupted.data(), corrupted.size());
+  ASSERT_TRUE(reader.ReadSeekTable());
+  char c;
+  EXPECT_FALSE(reader.ReadAt(0, 1, &c));
+  EXPECT_TRUE(reader.ReadAt(kBlockSize, 1, &c));
+  EXPECT_EQ(input[kBlockSize], c);
+
+  // Corrupt the seek table.
+  corrupted = framed;
+  corrupted[corrupted.size() - 20] ^= 0x01;
+  SeekableFramedReader bad_table_reader(corrupted.data(), corrupted.size());
+  EXPECT_FALSE(bad_table_reader.ReadSeekTable());
+
+  // Reserved unskippable chunks are errors; skippable ones are ignored.
+  for (uint8_t type : {0x02, 0x7f, 0x80, 0xfd, 0xfe}) {
+    std::string with_chunk = framed;
+    with_chunk.insert(10, std::string("\x00\x03\x00\x00xyz", 7));
+    with_chunk[10] = static_cast<char>(type);
+    uncompressed.clear();
+    ByteArraySource chunk_source(with_chunk.data(), with_chunk.size());
+    EXPECT_EQ(type >= 0x80, UncompressFramed(&chunk_source, &sink));
+  }
+}
+
+TEST(SnappyFraming, Decoder) {
+  const std::string input = FramingTestData(300000);
+  for (bool with_seek_table : {false, true}) {
+    std::string framed = CompressFramedString(input, with_seek_table);
+    // A skippable chunk is dropped even when fed byte by byte.
+    framed.insert(10, std::string("\xfe\x03\x00\x00xyz", 7));
+    for (size_t piece_size : {size_t{1}, size_t{7}, size_t{1000},
+                              size_t{kBlockSize + 3}, framed.size()}) {
+      std::string uncompressed;
+      StringAppendSink sink(&uncompressed);
+      FramedDecoder decoder;
+      for (size_t pos = 0; pos < framed.size(); pos += piece_size) {
+        ASSERT_TRUE(decoder.Feed(framed.data() + pos,
+                                 std::min(piece_size, framed.size() - pos),
+                                 &sink));
+      }
+      EXPECT_TRUE(decoder.Finished());
+      EXPECT_EQ(input, uncompressed);
+    }
+  }
+
+  // Corruption is detected, and sticks.
+  std::string corrupted = CompressFramedString(input, false);
+  corrupted[corrupted.size() / 2] ^= 0x01;
+  std::string uncompressed;
+  StringAppendSink sink(&uncompressed);
+  FramedDecoder decoder;
+  EXPECT_FALSE(decoder.Feed(corrupted.data(), corrupted.size(), &sink));
+  EXPECT_FALSE(decoder.Feed(corrupted.data(), 10, &sink));
+  EXPECT_FALSE(decoder.Finished());
+
+  // So is truncation, including within the stream identifier.
+  const std::string framed = CompressFramedString(input, false);
+  for (size_t length : {size_t{5}, framed.size() - 1}) {
+    FramedDecoder truncated_decoder;
+    EXPECT_TRUE(truncated_decoder.Feed(framed.data(), length, &sink));
+    EXPECT_FALSE(truncated_decoder.Finished());
+  }
+  FramedDecoder empty_decoder;
+  EXPECT_FALSE(empty_decoder.Finished());
+}
+
+TEST(SnappyAppendable, MatchesUncompressedData) {
+  const std::string input = ReadTestDataFile("html_x_4", 0);
+  AppendableCompressedBuffer buffer;
+  std::string expected, uncompressed;
+  EXPECT_TRUE(Uncompress(buffer.compressed(), &uncompressed));
+  EXPECT_EQ("", uncompressed);
+
+  std::minstd_rand0 rng(snappy::GetFlag(FLAGS_test_random_seed));
+  std::uniform_int_distribution<size_t> uniform_length(0, 3 * kBlockSize);
+  size_t pos = 0;
+  while (pos < input.size()) {
+    const size_t n = std::min(uniform_length(rng), input.size() - pos);
+    const size_t old_compressed_length = buffer.compressed().size();
+    const std::string old_tail =
+        buffer.compressed().substr(AppendableCompressedBuffer::kHeaderSize);
+    ASSERT_TRUE(buffer.Append(input.data() + pos, n));
+    expected.append(input, pos, n);
+    pos += n;
+
+    // Earlier data is left in place; only the header changes.
+    const std::string& compressed = buffer.compressed();
+    ASSERT_GE(compressed.size(), old_compressed_length);
+    EXPECT_EQ(old_tail,
+              compressed.substr(AppendableCompressedBuffer::kHeaderSize,
+                                old_tail.size()));
+
+    EXPECT_EQ(expected.size(), buffer.uncompressed_length());
+    size_t ulength;
+    ASSERT_TRUE(GetUncompressedLength(compressed.data(), compressed.size(),
+                                      &ulength));
+    EXPECT_EQ(expected.size(), ulength);
+    ASSERT_TRUE(IsValidCompressedBuffer(compressed));
+    ASSERT_TRUE(Uncompress(compressed, &uncompressed));
+    EXPECT_EQ(expected, uncompressed);
+    std::string raw(expected.size(), '\0');
+    ASSERT_TRUE(RawUncompress(compressed.data(), compressed.size(), &raw[0]));
+    EXPECT_EQ(expected, raw);
+  }
+
+  buffer.Clear();
+  EXPECT_EQ(0, buffer.uncompressed_length());
+  EXPECT_TRUE(Uncompress(buffer.compressed(), &uncompressed));
+  EXPECT_EQ("", uncompressed);
+}
+
+TEST(SnappyC, EnvAndBatch) {
+  std::vector<std::string> inputs;
+  for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
+    inputs.push_back(ReadTestDataFile(kTestDataFiles[i].filename,
+                                      kTestDataFiles[i].size_limit));
+  }
+  inputs.push_back("");
+  const size_t count = inputs.size();
+
+  snappy_env* env = snappy_env_create();
+  std::vector<std::string> compressed(count);
+  std::vector<const char*> input_ptrs(count);
+  std::vector<size_t> input_lengths(count);
+  std::vector<char*> compressed_ptrs(count);
+  std::vector<size_t> compressed_lengths(count);
+  for (size_t i = 0; i < count; ++i) {
+    input_ptrs[i] = inputs[i].data();
+    input_lengths[i] = inputs[i].size();
+    compressed[i].resize(snappy_max_compressed_length(inputs[i].size()));
+    compressed_ptrs[i] = string_as_array(&compressed[i]);
+    compressed_lengths[i] = compressed[i].size();
+  }
+  std::vector<snappy_status> statuses(count);
+  ASSERT_EQ(SNAPPY_OK, snappy_env_compress_batch(
+                           env, count, input_ptrs.data(), input_lengths.data(),
+                           compressed_ptrs.data(), compressed_lengths.data(),
+                           statuses.data()));
+  for (size_t i = 0; i < count; ++i) {
+    EXPECT_EQ(SNAPPY_OK, statuses[i]);
+    compressed[i].resize(compressed_lengths[i]);
+    std::string expected;
+    Compress(inputs[i].data(), inputs[i].size(), &expected);
+    EXPECT_EQ(expected, compressed[i]);
+
+    // The single-message form agrees.
+    std::string single(snappy_max_compressed_length(inputs[i].size()), '\0');
+    size_t single_length = single.size();
+    EXPECT_EQ(SNAPPY_OK, snappy_env_compress(env, inputs[i].data(),
+                                             inputs[i].size(),
+                                             string_as_array(&single),
+                                             &single_length));
+    EXPECT_EQ(expected, single.substr(0, single_length));
+  }
+
+  // Corrupt one message and give another too small an output buffer; the
+  // others still decompress.
+  compressed[1][compressed[1].size() / 2] ^= 0x55;
+  std::vector<const char*> compressed_cptrs(count);
+  std::vector<std::string> uncompressed(count);
+  std::vector<char*> uncompressed_ptrs(count);
+  std::vector<size_t> uncompressed_lengths(count);
+  for (size_t i = 0; i < count; ++i) {
+    compressed_cptrs[i] = compressed[i].data();
+    uncompressed[i].resize(inputs[i].size());
+    uncompressed_ptrs[i] = string_as_array(&uncompressed[i]);
+    uncompressed_lengths[i] = uncompressed[i].size();
+  }
+  uncompressed_lengths[0] -= 1;
+  snappy_status result = snappy_env_uncompress_batch(
+      env, count, compressed_cptrs.data(), compressed_lengths.data(),
+      uncompressed_ptrs.data(), uncompressed_lengths.data(), statuses.data());
+  EXPECT_EQ(SNAPPY_BUFFER_TOO_SMALL, result);
+  EXPECT_EQ(SNAPPY_BUFFER_TOO_SMALL, statuses[0]);
+  const bool corrupted_is_valid = snappy::IsValidCompressedBuffer(
+      compressed[1].data(), compressed[1].size());
+  if (!corrupted_is_valid) {
+    EXPECT_EQ(SNAPPY_INVALID_INPUT, statuses[1]);
+  }
+  for (size_t i = 2; i < count; ++i) {
+    EXPECT_EQ(SNAPPY_OK, statuses[i]);
+    EXPECT_EQ(inputs[i], uncompressed[i]);
+  }
+  snappy_env_destroy(env);
+  snappy_env_destroy(nullptr);
+}
+
+TEST(SnappyC, FramedStreamsAndIOVec) {
+  const std::string input = FramingTestData(300000);
+  for (size_t output_size : {size_t{1}, size_t{1000}, size_t{128 << 10}}) {
+    std::vector<char> output(output_size);
+    snappy_framed_compressor* compressor = snappy_framed_compressor_create(1);
+    std::string framed;
+    for (size_t pos = 0; pos < input.size();) {
+      size_t input_length = std::min<size_t>(5000, input.size() - pos);
+      size_t output_length = output.size();
+      EXPECT_EQ(SNAPPY_OK, snappy_framed_compressor_feed(
+                               compressor, input.data() + pos, &input_length,
+                               output.data(), &output_length));
+      framed.append(output.data(), output_length);
+      pos += input_length;
+    }
+    do {
+      size_t output_length = output.size();
+      EXPECT_EQ(SNAPPY_OK, snappy_framed_compressor_finish(
+                               compressor, output.data(), &output_length));
+      framed.append(output.data(), output_length);
+    } while (snappy_framed_compressor_pending(compressor) > 0);
+    size_t input_length = 1;
+    size_t output_length = output.size();
+    EXPECT_EQ(SNAPPY_INVALID_INPUT,
+              snappy_framed_compressor_feed(compressor, "x", &input_length,
+                                            output.data(), &output_length));
+    EXPECT_EQ(0, input_length);
+    snappy_framed_compressor_destroy(compressor);
+    EXPECT_EQ(CompressFramedString(input, true), framed);
+
+    snappy_framed_decompressor* decompressor =
+        snappy_framed_decompressor_create();
+    std::string uncompressed;
+    for (size_t pos = 0; pos < framed.size();) {
+      input_length = std::min<size_t>(3000, framed.size() - pos);
+      output_length = output.size();
+      EXPECT_EQ(SNAPPY_OK, snappy_framed_decompressor_feed(
+                               decompressor, framed.data() + pos,
+                               &input_length, output.data(), &output_length));
+      uncompressed.append(output.data(), output_length);
+      pos += input_length;
+    }
+    do {
+      output_length = output.size();
+      EXPECT_EQ(SNAPPY_OK, snappy_framed_decompressor_finish(
+                               decompressor, output.data(), &output_length));
+      uncompressed.append(output.data(), output_length);
+    } while (snappy_framed_decompressor_pending(decompressor) > 0);
+    snappy_framed_decompressor_destroy(decompressor);
+    EXPECT_EQ(input, uncompressed);
+  }
+
+  // Output buffers that always leave part of the backlog behind. Input is
+  // taken only while there is no backlog, so it stays within about a chunk,
+  // and only about the backlog itself is kept, not everything written out so
+  // far.
+  {
+    const std::string long_input = FramingTestData(4 << 20);
+    const std::string framed = CompressFramedString(long_input, false);
+    snappy_framed_decompressor* decompressor =
+        snappy_framed_decompressor_create();
+    std::string uncompressed;
+    uncompressed.reserve(long_input.size());
+    std::vector<char> output(long_input.size());
+    AllocationCounter counter;
+    size_t pending = 0;
+    size_t max_pending = 0;
+    for (size_t pos = 0; pos < framed.size();) {
+      size_t input_length = std::min<size_t>(100000, framed.size() - pos);
+      size_t output_length = std::max<size_t>(1, pending / 2);
+      EXPECT_EQ(SNAPPY_OK, snappy_framed_decompressor_feed(
+                               decompressor, framed.data() + pos,
+                               &input_length, output.data(), &output_length));
+      uncompressed.append(output.data(), output_length);
+      pos += input_length;
+      pending = snappy_framed_decompressor_pending(decompressor);
+      max_pending = std::max(max_pending, pending);
+    }
+    EXPECT_GT(max_pending, 0);
+    EXPECT_LE(max_pending, size_t{64 << 10});
+    const int64_t bytes = counter.bytes();
+    size_t output_length = output.size();
+    EXPECT_EQ(SNAPPY_OK, snappy_framed_decompressor_finish(
+                             decompressor, output.data(), &output_length));
+    uncompressed.append(output.data(), output_length);
+    EXPECT_EQ(0, snappy_framed_decompressor_pending(decompressor));
+    snappy_framed_decompressor_destroy(decompressor);
+    EXPECT_EQ(long_input, uncompressed);
+    EXPECT_LT(bytes, static_cast<int64_t>(long_input.size()));
+  }
+
+  // A truncated stream does not finish.
+  const std::string framed = CompressFramedString(input, false);
+  snappy_framed_decompressor* decompressor =
+      snappy_framed_decompressor_create();
+  std::vector<char> output(input.size());
+  size_t input_length = framed.size() - 1;
+  size_t output_length = output.size();
+  EXPECT_EQ(SNAPPY_OK, snappy_framed_decompressor_feed(
+                           decompressor, framed.data(), &input_length,
+                           output.data(), &output_length));
+  EXPECT_EQ(framed.size() - 1, input_length);
+  output_length = output.size();
+  EXPECT_EQ(SNAPPY_INVALID_INPUT, snappy_framed_decompressor_finish(
+                                      decompressor, output.data(),
+                                      &output_length));
+  snappy_framed_decompressor_destroy(decompressor);
+
+  std::string compressed;
+  Compress(input.data(), input.size(), &compressed);
+  std::string uncompressed(input.size(), '\0');
+  struct iovec iov[3] = {{string_as_array(&uncompressed), 1000},
+                         {string_as_array(&uncompressed) + 1000, 100000},
+                         {string_as_array(&uncompressed) + 101000,
+                          input.size() - 101000}};
+  EXPECT_EQ(SNAPPY_OK, snappy_uncompress_iov(compressed.data(),
+                                             compressed.size(), iov, 3));
+  EXPECT_EQ(input, uncompressed);
+  EXPECT_EQ(SNAPPY_BUFFER_TOO_SMALL,
+            snappy_uncompress_iov(compressed.data(), compressed.size(), iov,
+                                  2));
+  EXPECT_EQ(SNAPPY_INVALID_INPUT,
+            snappy_uncompress_iov(compressed.data(), compressed.size() - 1,
+                                  iov, 3));
+}
+
 TEST(Snappy, TestBenchmarkFiles) {
   for (int i = 0; i < ARRAYSIZE(kTestDataFiles); ++i) {
     Verify(ReadTestDataFile(kTestDataFiles[i].filename,